@@ -0,0 +1,52 @@
+// shm_producer.c
+//
+// Produttore di esempio per la fonte shm: campiona due segnali a 1 kHz e
+// li accoda nell'anello in memoria condivisa, senza chiamate di sistema
+// per campione (a parte l'attesa tra un campione e l'altro).
+//
+//   gcc -O2 -o shm_producer examples/shm_producer.c -lm
+//   ./shm_producer /daq &
+//   ./swsws -m shm:/daq@50ms
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../src/shmring.h"
+
+int main(int argc, char* argv[]) {
+    const char* name = argc > 1 ? argv[1] : "/swsws";
+    int rate_hz = argc > 2 ? atoi(argv[2]) : 1000;
+    if (rate_hz <= 0) {
+        rate_hz = 1000;
+    }
+
+    ShmRing* ring = shmring_create(name, 4096);
+    if (!ring) {
+        return 1;
+    }
+    shmring_declare(ring, 0, "vibration", "mm/s");
+    shmring_declare(ring, 1, "temp{probe=\"1\"}", "°C");
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    long period_ns = 1000000000L / rate_hz;
+
+    for (unsigned long n = 0;; n++) {
+        // clock_gettime passa dal vDSO: nessuna chiamata di sistema
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        int64_t now_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+        double t = n / (double)rate_hz;
+        shmring_push(ring, 0, 4.0 * sin(2 * M_PI * 50 * t), now_ms);
+        if (n % rate_hz == 0) {
+            shmring_push(ring, 1, 40.0 + 5.0 * sin(t / 60), now_ms);
+        }
+
+        next.tv_nsec += period_ns;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+}
@@ -0,0 +1,42 @@
+// shm_read.c
+//
+// Lettore di esempio della tabella esportata con --export-shm: senza nomi
+// stampa tutte le metriche, altrimenti solo quelle richieste. La lettura
+// non usa socket né chiamate di sistema oltre alla mappatura iniziale.
+//
+//   gcc -O2 -o shm_read examples/shm_read.c
+//   ./shm_read /dev/shm/swsws.metrics cpu memory
+#include <stdio.h>
+#include "../src/shmexport.h"
+
+int main(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : "/dev/shm/swsws.metrics";
+    const ShmExportHeader* table = shmexport_map(path);
+    if (!table) {
+        fprintf(stderr, "Tabella non disponibile: %s\n", path);
+        return 1;
+    }
+
+    double value;
+    if (argc <= 2) {
+        for (uint32_t slot = 0; slot < table->count; slot++) {
+            const ShmExportEntry* entry = &table->entries[slot];
+            if (entry->name[0] && shmexport_value(table, (int)slot, &value, NULL)) {
+                printf("%s=%g[%s]\n", entry->name, value, entry->unit);
+            }
+        }
+        return 0;
+    }
+
+    int missing = 0;
+    for (int i = 2; i < argc; i++) {
+        int slot = shmexport_find(table, argv[i]);
+        if (slot >= 0 && shmexport_value(table, slot, &value, NULL)) {
+            printf("%s=%g[%s]\n", argv[i], value, table->entries[slot].unit);
+        } else {
+            fprintf(stderr, "%s: non trovata\n", argv[i]);
+            missing++;
+        }
+    }
+    return missing > 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/bash
+
+# Produttore per la fonte stream: resta attivo e scrive un blocco di
+# metriche al secondo, chiuso da "---". Legge /proc con i soli builtin
+# di bash, senza avviare altri processi a ogni campione (solo Linux).
+
+INTERVAL=${1:-1}
+
+# Tempi della CPU del campione precedente
+prev_total=0
+prev_idle=0
+
+while true; do
+    # CPU: differenza dei contatori di /proc/stat rispetto al campione precedente
+    read -r _ user nice system idle iowait irq softirq steal _ < /proc/stat
+    total=$((user + nice + system + idle + iowait + irq + softirq + steal))
+    busy_delta=$(( (total - prev_total) - (idle + iowait - prev_idle) ))
+    total_delta=$((total - prev_total))
+    prev_total=$total
+    prev_idle=$((idle + iowait))
+
+    # Memoria usata in MB
+    while read -r key value _; do
+        case $key in
+            MemTotal:) mem_total=$value ;;
+            MemAvailable:) mem_available=$value ;;
+        esac
+    done < /proc/meminfo
+
+    # Carico e processi
+    read -r load _ _ procs _ < /proc/loadavg
+
+    if ((total_delta > 0)); then
+        echo "cpu=$((busy_delta * 100 / total_delta))[%]"
+    fi
+    echo "memory=$(( (mem_total - mem_available) / 1024 ))[MB]"
+    echo "load=$load"
+    echo "processes=${procs#*/}"
+    echo "---"
+
+    sleep "$INTERVAL"
+done
@@ -0,0 +1,298 @@
+// alerts.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "alerts.h"
+#include "http_handler.h"
+#include "utils.h"
+
+// Soglie configurate per nome, fissate prima dell'avvio dell'acquisizione
+typedef struct {
+    char* name;
+    int page;           // 0 = --thresholds, altrimenti pages[page - 1]
+    double warning;
+    double critical;
+    double hysteresis;  // Distanza sotto la soglia per uscire da uno stato
+} Threshold;
+
+// Stato di una metrica rispetto a una delle sue soglie
+typedef struct {
+    const Threshold* threshold;
+    _Atomic int level;
+} AlertRule;
+
+// Stato di allarme di una metrica con soglie: una regola per ogni
+// origine (globale o pagina) che la definisce
+typedef struct {
+    int num_rules;
+    AlertRule rules[];
+} AlertState;
+
+typedef _Atomic(AlertState*) AlertSlot;
+
+static Threshold* thresholds = NULL;
+static int num_thresholds = 0;
+
+// Pagine con soglie proprie, nell'ordine di lettura
+static char** pages = NULL;
+static int num_pages = 0;
+
+// Stato per id, allocato a blocchi come il registro; letto senza lock
+static _Atomic(AlertSlot*) state_chunks[METRICS_MAX_CHUNKS];
+
+// Transizioni in attesa del thread di pubblicazione
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static AlertEvent pending[ALERTS_MAX_PENDING];
+static int pending_head = 0;
+static int pending_count = 0;
+
+static const char* level_names[] = { "normal", "warning", "critical" };
+
+static Threshold* find_threshold(const char* name, int page) {
+    for (int i = 0; i < num_thresholds; i++) {
+        if (thresholds[i].page == page && strcmp(thresholds[i].name, name) == 0) {
+            return &thresholds[i];
+        }
+    }
+    return NULL;
+}
+
+static bool parse_thresholds(const char* spec, const char* origin, int page) {
+    char* list = strdup(spec);
+    if (!list) {
+        return false;
+    }
+
+    bool success = true;
+    char* saveptr = NULL;
+    for (char* item = strtok_r(list, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        char name[256];
+        double warning, critical, hysteresis = NAN;
+        int fields = sscanf(item, " %255[^:]:%lf:%lf:%lf", name, &warning, &critical, &hysteresis);
+        if (fields < 3) {
+            fprintf(stderr, "Soglia non valida in %s: %s\n", origin, item);
+            success = false;
+            continue;
+        }
+
+        Threshold* existing = find_threshold(name, page);
+        if (existing) {
+            if (existing->warning != warning || existing->critical != critical) {
+                fprintf(stderr, "Soglie di %s in %s ignorate: già definite come %g:%g\n",
+                        name, origin, existing->warning, existing->critical);
+            }
+            continue;
+        }
+
+        Threshold* grown = realloc(thresholds, (num_thresholds + 1) * sizeof(Threshold));
+        if (!grown) {
+            success = false;
+            break;
+        }
+        thresholds = grown;
+
+        Threshold* t = &thresholds[num_thresholds];
+        t->name = strdup(name);
+        if (!t->name) {
+            success = false;
+            break;
+        }
+        t->page = page;
+        t->warning = warning;
+        t->critical = critical;
+        t->hysteresis = fields == 4 ? fabs(hysteresis)
+                                    : fabs(warning) * ALERTS_DEFAULT_HYSTERESIS / 100.0;
+        num_thresholds++;
+    }
+
+    free(list);
+    return success;
+}
+
+bool alerts_parse_thresholds(const char* spec, const char* origin) {
+    return parse_thresholds(spec, origin, 0);
+}
+
+// Registra una pagina con soglie proprie; restituisce il suo indice o 0
+static int add_page(const char* name) {
+    char** grown = realloc(pages, (num_pages + 1) * sizeof(char*));
+    if (!grown) {
+        return 0;
+    }
+    pages = grown;
+    pages[num_pages] = strdup(name);
+    return pages[num_pages] ? ++num_pages : 0;
+}
+
+int alerts_load_from_www(const char* www_root) {
+    struct dirent** entries;
+    int n = scandir(www_root, &entries, NULL, alphasort);
+    if (n < 0) {
+        return 0;
+    }
+
+    int loaded = 0;
+    for (int i = 0; i < n; i++) {
+        const char* name = entries[i]->d_name;
+        if (strcmp(get_file_extension(name), "html") == 0) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", www_root, name);
+
+            char* content = read_file(path);
+            char* spec = content ? extract_meta_content(content, "swsws-thresholds") : NULL;
+            int page = spec ? add_page(name) : 0;
+            if (page > 0) {
+                parse_thresholds(spec, path, page);
+                loaded++;
+            }
+            free(spec);
+            free(content);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    return loaded;
+}
+
+int alerts_page(const char* name) {
+    for (int i = 0; i < num_pages; i++) {
+        if (strcmp(pages[i], name) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static AlertState* get_state(metric_id_t id) {
+    AlertSlot* slots = atomic_load_explicit(&state_chunks[id / METRICS_CHUNK_SIZE], memory_order_acquire);
+    return slots ? atomic_load_explicit(&slots[id % METRICS_CHUNK_SIZE], memory_order_acquire) : NULL;
+}
+
+// Regola che determina lo stato per i client di una pagina: quella della
+// pagina se la definisce, altrimenti quella globale
+static const AlertRule* effective_rule(const AlertState* state, int page) {
+    const AlertRule* global = NULL;
+    for (int r = 0; r < state->num_rules; r++) {
+        int origin = state->rules[r].threshold->page;
+        if (origin == page) {
+            return &state->rules[r];
+        }
+        if (origin == 0) {
+            global = &state->rules[r];
+        }
+    }
+    return global;
+}
+
+void alerts_attach(metric_id_t id, const char* name) {
+    int num_rules = 0;
+    for (int i = 0; i < num_thresholds; i++) {
+        num_rules += strcmp(thresholds[i].name, name) == 0;
+    }
+    if (num_rules == 0) {
+        return;
+    }
+
+    uint32_t chunk = id / METRICS_CHUNK_SIZE;
+    AlertSlot* slots = atomic_load_explicit(&state_chunks[chunk], memory_order_acquire);
+    if (!slots) {
+        slots = calloc(METRICS_CHUNK_SIZE, sizeof(AlertSlot));
+        if (!slots) return;
+        atomic_store_explicit(&state_chunks[chunk], slots, memory_order_release);
+    }
+
+    AlertState* state = calloc(1, sizeof(AlertState) + num_rules * sizeof(AlertRule));
+    if (!state) {
+        return;
+    }
+    for (int i = 0; i < num_thresholds; i++) {
+        if (strcmp(thresholds[i].name, name) == 0) {
+            AlertRule* rule = &state->rules[state->num_rules++];
+            rule->threshold = &thresholds[i];
+            atomic_init(&rule->level, ALERT_NORMAL);
+        }
+    }
+    atomic_store_explicit(&slots[id % METRICS_CHUNK_SIZE], state, memory_order_release);
+}
+
+// Nuovo stato con isteresi: si sale appena si raggiunge una soglia,
+// si scende solo quando il valore è sotto la soglia di almeno l'isteresi
+static AlertLevel next_level(const Threshold* t, AlertLevel level, double value) {
+    double limits[] = { 0, t->warning, t->critical };
+
+    while (level < ALERT_CRITICAL && value >= limits[level + 1]) {
+        level++;
+    }
+    while (level > ALERT_NORMAL && value < limits[level] - t->hysteresis) {
+        level--;
+    }
+    return level;
+}
+
+// Accoda una transizione per il thread di pubblicazione
+static void queue_event(const AlertEvent* event) {
+    pthread_mutex_lock(&pending_mutex);
+    if (pending_count == ALERTS_MAX_PENDING) {
+        // Coda piena: si scarta la transizione più vecchia, lo stato finale resta corretto
+        pending_head = (pending_head + 1) % ALERTS_MAX_PENDING;
+        pending_count--;
+    }
+    pending[(pending_head + pending_count) % ALERTS_MAX_PENDING] = *event;
+    pending_count++;
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+void alerts_evaluate(metric_id_t id, int64_t ts_ms, double value) {
+    AlertState* state = get_state(id);
+    if (!state) {
+        return;
+    }
+
+    for (int r = 0; r < state->num_rules; r++) {
+        AlertRule* rule = &state->rules[r];
+        AlertLevel from = atomic_load_explicit(&rule->level, memory_order_relaxed);
+        AlertLevel to = next_level(rule->threshold, from, value);
+        if (to == from) {
+            continue;
+        }
+        atomic_store_explicit(&rule->level, to, memory_order_release);
+
+        queue_event(&(AlertEvent){
+            .id = id, .page = rule->threshold->page, .from = from, .to = to,
+            .value = value, .ts_ms = ts_ms
+        });
+    }
+}
+
+int alerts_take(AlertEvent* events, int max) {
+    pthread_mutex_lock(&pending_mutex);
+    int n = pending_count < max ? pending_count : max;
+    for (int i = 0; i < n; i++) {
+        events[i] = pending[(pending_head + i) % ALERTS_MAX_PENDING];
+    }
+    pending_head = (pending_head + n) % ALERTS_MAX_PENDING;
+    pending_count -= n;
+    pthread_mutex_unlock(&pending_mutex);
+    return n;
+}
+
+int alerts_level(metric_id_t id, int page) {
+    AlertState* state = get_state(id);
+    const AlertRule* rule = state ? effective_rule(state, page) : NULL;
+    return rule ? atomic_load_explicit(&rule->level, memory_order_acquire) : -1;
+}
+
+bool alerts_applies(const AlertEvent* event, int page) {
+    AlertState* state = get_state(event->id);
+    const AlertRule* rule = state ? effective_rule(state, page) : NULL;
+    return rule && rule->threshold->page == event->page;
+}
+
+const char* alerts_level_name(AlertLevel level) {
+    return level <= ALERT_CRITICAL ? level_names[level] : "?";
+}
@@ -0,0 +1,64 @@
+// alerts.h
+#ifndef ALERTS_H
+#define ALERTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "metrics.h"
+
+#define ALERTS_DEFAULT_HYSTERESIS 5.0  // Isteresi predefinita, in % della soglia
+#define ALERTS_MAX_PENDING 4096        // Transizioni in attesa di invio
+
+// Stati di allarme, in ordine di gravità
+typedef enum {
+    ALERT_NORMAL,
+    ALERT_WARNING,
+    ALERT_CRITICAL
+} AlertLevel;
+
+// Cambio di stato di una metrica per le soglie di una pagina
+typedef struct {
+    metric_id_t id;
+    int page;  // Origine delle soglie (0 = --thresholds, altrimenti la pagina)
+    AlertLevel from;
+    AlertLevel to;
+    double value;
+    int64_t ts_ms;
+} AlertEvent;
+
+// Callback invocato dal thread di pubblicazione con le transizioni in ordine
+typedef void (*alert_callback_t)(const AlertEvent* events, int count);
+
+// Aggiunge soglie globali nel formato "metrica:warning:critical[:isteresi],...",
+// valide per i client che non hanno soglie proprie per la metrica.
+// Per una metrica vale la prima definizione incontrata.
+bool alerts_parse_thresholds(const char* spec, const char* origin);
+
+// Legge le soglie dal meta tag swsws-thresholds delle pagine HTML in
+// www_root. Ogni pagina ha le proprie: valgono solo per i suoi client.
+int alerts_load_from_www(const char* www_root);
+
+// Indice delle soglie di una pagina ("index2.html"), 0 se non ne ha
+int alerts_page(const char* name);
+
+// Associa le soglie a una metrica appena registrata (scrittore del registro)
+void alerts_attach(metric_id_t id, const char* name);
+
+// Valuta un nuovo valore e accoda l'eventuale transizione (scrittore del registro)
+void alerts_evaluate(metric_id_t id, int64_t ts_ms, double value);
+
+// Preleva fino a max transizioni in attesa; restituisce quante ne ha copiate
+int alerts_take(AlertEvent* events, int max);
+
+// Stato corrente di una metrica per i client di una pagina (0 = nessuna
+// pagina): con le soglie della pagina se ne ha, altrimenti con quelle
+// globali; -1 se non ha soglie
+int alerts_level(metric_id_t id, int page);
+
+// Vero se una transizione riguarda i client di una pagina, cioè se viene
+// dalle soglie che per quella pagina determinano lo stato della metrica
+bool alerts_applies(const AlertEvent* event, int page);
+
+const char* alerts_level_name(AlertLevel level);
+
+#endif
@@ -0,0 +1,282 @@
+// api.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "api.h"
+#include "http_handler.h"
+#include "history.h"
+#include "stats.h"
+#include "labels.h"
+#include "lineproto.h"
+#include "metrics.h"
+#include "tokens.h"
+#include "utils.h"
+
+#define DEFAULT_HISTORY_POINTS 300                // Larghezza tipica di un grafico
+#define DEFAULT_HISTORY_RANGE_MS (3600 * 1000LL)  // Ultima ora
+
+// Invia un errore in formato JSON
+static void send_json_error(int client_socket, int status_code, const char* status_text,
+                            const char* message) {
+    char body[256];
+    int length = snprintf(body, sizeof(body), "{\"error\": \"%s\"}", message);
+    send_http_response(client_socket, status_code, status_text, "application/json", body, length);
+}
+
+// Legge un parametro intero della query, con valore predefinito
+static long long query_int(const char* query, const char* name, long long default_value) {
+    char value[32];
+    if (!http_query_param(query, name, value, sizeof(value)) || value[0] == '\0') {
+        return default_value;
+    }
+    return strtoll(value, NULL, 10);
+}
+
+// GET /api/history?metric=cpu&from=...&to=...&points=300[&tier=raw|1m|1h]
+// from e to sono in millisecondi dall'epoca; valori <= 0 sono relativi all'ora corrente
+static void handle_history(int client_socket, const char* query, const char* allowed) {
+    char name[256];
+    if (!http_query_param(query, "metric", name, sizeof(name))) {
+        send_json_error(client_socket, 400, "Bad Request", "missing metric parameter");
+        return;
+    }
+
+    metric_id_t id = metrics_find(name);
+    if (id == METRIC_ID_INVALID) {
+        send_json_error(client_socket, 404, "Not Found", "unknown metric");
+        return;
+    }
+    if (!token_allows(allowed, metrics_name(id))) {
+        send_json_error(client_socket, 403, "Forbidden", "metric not allowed by token");
+        return;
+    }
+    if (!history_tracked(id)) {
+        send_json_error(client_socket, 404, "Not Found", "no history for metric");
+        return;
+    }
+
+    int64_t now = wall_clock_ms();
+    int64_t from = query_int(query, "from", -DEFAULT_HISTORY_RANGE_MS);
+    int64_t to = query_int(query, "to", now);
+    if (from <= 0) from += now;
+    if (to <= 0) to += now;
+
+    long long points = query_int(query, "points", DEFAULT_HISTORY_POINTS);
+    if (points < 1) points = 1;
+    if (points > HISTORY_MAX_POINTS) points = HISTORY_MAX_POINTS;
+
+    HistoryTier tier = HISTORY_TIER_COUNT;
+    char tier_name[8];
+    if (http_query_param(query, "tier", tier_name, sizeof(tier_name)) &&
+        !history_parse_tier(tier_name, &tier)) {
+        send_json_error(client_socket, 400, "Bad Request", "unknown tier");
+        return;
+    }
+
+    HistoryPoint* data = malloc(points * sizeof(HistoryPoint));
+    if (!data) {
+        send_json_error(client_socket, 500, "Internal Server Error", "out of memory");
+        return;
+    }
+
+    HistoryTier used = HISTORY_TIER_RAW;
+    int n = history_query(id, from, to, tier, data, (int)points, &used);
+
+    // I campioni grezzi sono [ts, valore], gli aggregati [ts, min, max, media]
+    StrBuf body;
+    strbuf_init(&body);
+    strbuf_append(&body, "{\"metric\": ", 11);
+    strbuf_append_json(&body, metrics_name(id));
+    strbuf_append(&body, ", \"unit\": ", 10);
+    strbuf_append_json(&body, metrics_unit(id));
+    strbuf_appendf(&body, ", \"tier\": \"%s\", \"points\": [", history_tier_name(used));
+
+    for (int i = 0; i < n; i++) {
+        strbuf_append(&body, i ? ", [" : "[", i ? 3 : 1);
+        strbuf_append_int(&body, data[i].ts_ms);
+        if (used != HISTORY_TIER_RAW) {
+            strbuf_append(&body, ", ", 2);
+            strbuf_append_double(&body, data[i].min);
+            strbuf_append(&body, ", ", 2);
+            strbuf_append_double(&body, data[i].max);
+        }
+        strbuf_append(&body, ", ", 2);
+        strbuf_append_double(&body, data[i].avg);
+        strbuf_append(&body, "]", 1);
+    }
+    strbuf_append(&body, "]}", 2);
+
+    send_http_response(client_socket, 200, "OK", "application/json", body.data, body.length);
+
+    strbuf_free(&body);
+    free(data);
+}
+
+// Aggiunge al JSON il valore di una metrica, o null se non è mai stata aggiornata
+static void append_metric_value(StrBuf* body, const char* key, metric_id_t id) {
+    double value;
+    if (id != METRIC_ID_INVALID && metrics_read(id, &value, NULL)) {
+        strbuf_appendf(body, ", \"%s\": ", key);
+        strbuf_append_double(body, value);
+    } else {
+        strbuf_appendf(body, ", \"%s\": null", key);
+    }
+}
+
+// GET /api/stats?metric=cpu: valore corrente e statistiche sulla finestra
+static void handle_stats(int client_socket, const char* query, const char* allowed) {
+    char name[256];
+    if (!http_query_param(query, "metric", name, sizeof(name))) {
+        send_json_error(client_socket, 400, "Bad Request", "missing metric parameter");
+        return;
+    }
+
+    metric_id_t id = metrics_find(name);
+    if (id == METRIC_ID_INVALID) {
+        send_json_error(client_socket, 404, "Not Found", "unknown metric");
+        return;
+    }
+    if (!token_allows(allowed, metrics_name(id))) {
+        send_json_error(client_socket, 403, "Forbidden", "metric not allowed by token");
+        return;
+    }
+
+    // Le statistiche sono metriche derivate "<nome>.<campo>" già nel registro
+    char derived_name[512];
+    stats_metric_name(metrics_name(id), STATS_AVG, derived_name, sizeof(derived_name));
+    if (metrics_find(derived_name) == METRIC_ID_INVALID) {
+        send_json_error(client_socket, 404, "Not Found", "statistics not enabled for metric");
+        return;
+    }
+
+    StrBuf body;
+    strbuf_init(&body);
+    strbuf_append(&body, "{\"metric\": ", 11);
+    strbuf_append_json(&body, metrics_name(id));
+    strbuf_append(&body, ", \"unit\": ", 10);
+    strbuf_append_json(&body, metrics_unit(id));
+    strbuf_appendf(&body, ", \"window\": %d", stats_window());
+    append_metric_value(&body, "value", id);
+
+    for (int f = 0; f < STATS_FIELD_COUNT; f++) {
+        stats_metric_name(metrics_name(id), f, derived_name, sizeof(derived_name));
+        append_metric_value(&body, stats_field_name(f), metrics_find(derived_name));
+    }
+    strbuf_append(&body, "}", 1);
+
+    send_http_response(client_socket, 200, "OK", "application/json", body.data, body.length);
+    strbuf_free(&body);
+}
+
+// GET /api/query?match=disk_used{host="n12"}: serie selezionate per
+// etichette, tra quelle autorizzate dal token
+static void handle_query(int client_socket, const char* query, const char* allowed) {
+    char selector[256];
+    if (!http_query_param(query, "match", selector, sizeof(selector))) {
+        send_json_error(client_socket, 400, "Bad Request", "missing match parameter");
+        return;
+    }
+
+    metric_id_t* ids = NULL;
+    int n = labels_select(selector, &ids);
+    if (n < 0) {
+        send_json_error(client_socket, 400, "Bad Request", "invalid selector");
+        return;
+    }
+
+    StrBuf body;
+    strbuf_init(&body);
+    strbuf_append(&body, "{\"series\": [", 12);
+
+    bool first = true;
+    for (int i = 0; i < n; i++) {
+        if (!token_allows(allowed, metrics_name(ids[i]))) {
+            continue;
+        }
+        strbuf_append(&body, first ? "{\"name\": " : ", {\"name\": ", first ? 9 : 11);
+        first = false;
+        strbuf_append_json(&body, metrics_name(ids[i]));
+
+        Label labels[LABELS_MAX];
+        int num_labels = labels_get(ids[i], labels, LABELS_MAX);
+        strbuf_append(&body, ", \"labels\": {", 13);
+        for (int l = 0; l < num_labels; l++) {
+            if (l) strbuf_append(&body, ", ", 2);
+            strbuf_append_json(&body, labels[l].key);
+            strbuf_append(&body, ": ", 2);
+            strbuf_append_json(&body, labels[l].value);
+        }
+        strbuf_append(&body, "}", 1);
+
+        append_metric_value(&body, "value", ids[i]);
+        strbuf_append(&body, ", \"unit\": ", 10);
+        strbuf_append_json(&body, metrics_unit(ids[i]));
+        strbuf_append(&body, "}", 1);
+    }
+    strbuf_append(&body, "]}", 2);
+
+    send_http_response(client_socket, 200, "OK", "application/json", body.data, body.length);
+    strbuf_free(&body);
+    free(ids);
+}
+
+// POST /api/write: righe "nome=valore[unità]" o line protocol di InfluxDB,
+// interpretate in una sola passata e pubblicate come un unico aggiornamento.
+// Serve la chiave condivisa delle scritture: senza --write-key sono disabilitate.
+static void handle_write(int client_socket, const char* credential, char* body, size_t body_length) {
+    if (!token_verify_write_key(credential)) {
+        send_json_error(client_socket, 403, "Forbidden", "missing or invalid write key");
+        return;
+    }
+    
+    int rejected = 0;
+    int accepted = lineproto_parse_remote(body, body_length, &rejected);
+    if (accepted == 0 && rejected > 0) {
+        send_json_error(client_socket, 400, "Bad Request", "no valid lines");
+        return;
+    }
+
+    char response[64];
+    int length = snprintf(response, sizeof(response), "{\"accepted\": %d, \"rejected\": %d}",
+                          accepted, rejected);
+    send_http_response(client_socket, 200, "OK", "application/json", response, length);
+}
+
+bool api_handle_request(int client_socket, const char* method, const char* path, const char* query,
+                        const char* credential, char* body, size_t body_length) {
+    if (strncmp(path, "/api/", 5) != 0) {
+        return false;
+    }
+
+    // Solo /api/write accetta (e richiede) POST
+    bool write = strcmp(path, "/api/write") == 0;
+    if (write != (strcmp(method, "POST") == 0)) {
+        send_json_error(client_socket, 405, "Method Not Allowed", "method not allowed");
+        return true;
+    }
+
+    if (write) {
+        handle_write(client_socket, credential, body, body_length);
+        return true;
+    }
+
+    // Le letture richiedono un token, come le connessioni WebSocket, e
+    // riportano solo le metriche che autorizza
+    char* allowed = NULL;
+    if (!http_request_token(query, credential, &allowed)) {
+        send_json_error(client_socket, 403, "Forbidden", "missing or invalid token");
+        return true;
+    }
+
+    if (strcmp(path, "/api/history") == 0) {
+        handle_history(client_socket, query, allowed);
+    } else if (strcmp(path, "/api/stats") == 0) {
+        handle_stats(client_socket, query, allowed);
+    } else if (strcmp(path, "/api/query") == 0) {
+        handle_query(client_socket, query, allowed);
+    } else {
+        send_json_error(client_socket, 404, "Not Found", "unknown endpoint");
+    }
+    free(allowed);
+    return true;
+}
@@ -0,0 +1,16 @@
+// api.h
+#ifndef API_H
+#define API_H
+
+#include <stdbool.h>
+
+#include <stddef.h>
+
+// Gestisce le richieste agli endpoint /api/*; credential è il valore di
+// "Authorization: Bearer" ("" se assente), body il corpo delle richieste
+// POST (modificabile), NULL per le GET.
+// Restituisce false se il percorso non appartiene all'API.
+bool api_handle_request(int client_socket, const char* method, const char* path, const char* query,
+                        const char* credential, char* body, size_t body_length);
+
+#endif
@@ -0,0 +1,605 @@
+// expr.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "expr.h"
+
+#define DIRTY_WORDS (EXPR_MAX_DERIVED / 64)
+
+// Nodo dell'albero sintattico
+typedef enum {
+    NODE_NUMBER,
+    NODE_METRIC,
+    NODE_ADD,
+    NODE_SUB,
+    NODE_MUL,
+    NODE_DIV,
+    NODE_NEG,
+    NODE_MIN,
+    NODE_MAX,
+    NODE_ABS
+} NodeType;
+
+typedef struct Node {
+    NodeType type;
+    double number;
+    metric_id_t id;
+    struct Node* left;
+    struct Node* right;
+} Node;
+
+// Istruzione del programma in notazione postfissa ottenuto dall'albero
+typedef struct {
+    NodeType type;
+    double number;
+    metric_id_t id;
+} Op;
+
+// Metrica derivata: programma da valutare e metriche da cui dipende
+typedef struct {
+    metric_id_t output;
+    Op* program;
+    int length;
+    metric_id_t* inputs;
+    int num_inputs;
+    int rank;     // Posizione nell'ordine topologico
+} Derived;
+
+// Elenco delle metriche derivate che dipendono da un id
+typedef struct {
+    int* nodes;  // Indici in derived
+    int count;
+} Dependents;
+
+// Stato del parser
+typedef struct {
+    const char* text;
+    const char* pos;
+    const char* error;
+    Derived* target;
+} Parser;
+
+static Derived* derived = NULL;
+static int num_derived = 0;
+static int* order = NULL;  // Indici in derived, in ordine topologico
+
+// Dipendenze per id, allocate a blocchi come il registro.
+// Scritte solo all'avvio, poi lette dallo scrittore del registro.
+static Dependents* dependent_chunks[METRICS_MAX_CHUNKS];
+
+// Metriche derivate da ricalcolare, per posizione nell'ordine topologico.
+// Lo stato è del thread: un batch ricalcola solo ciò che ha sporcato, e
+// un batch concorrente non pubblica derivate da ingressi scritti a metà.
+static _Thread_local uint64_t dirty_ranks[DIRTY_WORDS];
+static _Thread_local int first_dirty = EXPR_MAX_DERIVED;
+static _Thread_local bool any_dirty = false;
+
+static Node* parse_expression(Parser* p);
+
+static Node* new_node(Parser* p, NodeType type, Node* left, Node* right) {
+    Node* node = calloc(1, sizeof(Node));
+    if (!node) {
+        p->error = "memoria esaurita";
+        return NULL;
+    }
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+static void free_node(Node* node) {
+    if (node) {
+        free_node(node->left);
+        free_node(node->right);
+        free(node);
+    }
+}
+
+static void skip_spaces(Parser* p) {
+    while (isspace((unsigned char)*p->pos)) p->pos++;
+}
+
+static bool accept(Parser* p, char c) {
+    skip_spaces(p);
+    if (*p->pos == c) {
+        p->pos++;
+        return true;
+    }
+    return false;
+}
+
+// Aggiunge una dipendenza alla metrica derivata in costruzione
+static bool add_input(Parser* p, metric_id_t id) {
+    Derived* d = p->target;
+    for (int i = 0; i < d->num_inputs; i++) {
+        if (d->inputs[i] == id) return true;
+    }
+    metric_id_t* inputs = realloc(d->inputs, (d->num_inputs + 1) * sizeof(metric_id_t));
+    if (!inputs) {
+        p->error = "memoria esaurita";
+        return false;
+    }
+    d->inputs = inputs;
+    d->inputs[d->num_inputs++] = id;
+    return true;
+}
+
+static Node* parse_metric(Parser* p, const char* name) {
+    metric_id_t id = metrics_register(name, NULL);
+    if (id == METRIC_ID_INVALID || !add_input(p, id)) {
+        if (!p->error) p->error = "impossibile registrare la metrica";
+        return NULL;
+    }
+    Node* node = new_node(p, NODE_METRIC, NULL, NULL);
+    if (node) node->id = id;
+    return node;
+}
+
+// Copia in name il nome tra virgolette che inizia in p->pos; dentro il
+// nome \" sta per una virgoletta e \\ per una barra
+static bool parse_quoted_name(Parser* p, char* name, size_t size) {
+    size_t length = 0;
+    const char* c = p->pos + 1;
+    while (*c && *c != '"') {
+        if (*c == '\\' && (c[1] == '"' || c[1] == '\\')) {
+            c++;
+        }
+        if (length + 1 >= size) {
+            return false;
+        }
+        name[length++] = *c++;
+    }
+    if (*c != '"' || length == 0) {
+        return false;
+    }
+    name[length] = '\0';
+    p->pos = c + 1;
+    return true;
+}
+
+// Fine delle etichette {k="v",...} che iniziano in start; NULL se non
+// sono chiuse. I valori tra virgolette possono contenere } e \".
+static const char* skip_labels(const char* start) {
+    bool quoted = false;
+    for (const char* c = start + 1; *c; c++) {
+        if (quoted && *c == '\\' && c[1]) {
+            c++;
+        } else if (*c == '"') {
+            quoted = !quoted;
+        } else if (!quoted && *c == '}') {
+            return c + 1;
+        }
+    }
+    return NULL;
+}
+
+// primario := numero | nome[{etichette}] | "nome" | funzione(argomenti) | ( espressione )
+static Node* parse_primary(Parser* p) {
+    skip_spaces(p);
+    char name[256];
+
+    if (accept(p, '(')) {
+        Node* node = parse_expression(p);
+        if (node && !accept(p, ')')) {
+            p->error = "manca ')'";
+            free_node(node);
+            return NULL;
+        }
+        return node;
+    }
+
+    if (*p->pos == '"') {
+        if (!parse_quoted_name(p, name, sizeof(name))) {
+            p->error = "nome tra virgolette non valido";
+            return NULL;
+        }
+        return parse_metric(p, name);
+    }
+
+    if (isdigit((unsigned char)*p->pos) || *p->pos == '.') {
+        char* end;
+        double number = strtod(p->pos, &end);
+        if (end == p->pos) {
+            p->error = "numero non valido";
+            return NULL;
+        }
+        p->pos = end;
+        Node* node = new_node(p, NODE_NUMBER, NULL, NULL);
+        if (node) node->number = number;
+        return node;
+    }
+
+    if (isalpha((unsigned char)*p->pos) || *p->pos == '_') {
+        const char* start = p->pos;
+        while (isalnum((unsigned char)*p->pos) || *p->pos == '_' || *p->pos == '.') p->pos++;
+
+        // Serie con etichette: disk_used{host="n12"}
+        if (*p->pos == '{') {
+            const char* end = skip_labels(p->pos);
+            if (!end) {
+                p->error = "manca '}'";
+                return NULL;
+            }
+            p->pos = end;
+        }
+        size_t length = p->pos - start;
+        if (length >= sizeof(name)) {
+            p->error = "nome troppo lungo";
+            return NULL;
+        }
+        memcpy(name, start, length);
+        name[length] = '\0';
+
+        // Un nome seguito da '(' è una funzione
+        if (!accept(p, '(')) {
+            return parse_metric(p, name);
+        }
+
+        NodeType type;
+        int arity = 2;
+        if (strcmp(name, "min") == 0) {
+            type = NODE_MIN;
+        } else if (strcmp(name, "max") == 0) {
+            type = NODE_MAX;
+        } else if (strcmp(name, "abs") == 0) {
+            type = NODE_ABS;
+            arity = 1;
+        } else {
+            p->error = "funzione sconosciuta";
+            return NULL;
+        }
+
+        Node* left = parse_expression(p);
+        Node* right = NULL;
+        if (left && arity == 2) {
+            if (!accept(p, ',')) {
+                p->error = "la funzione richiede due argomenti";
+            } else {
+                right = parse_expression(p);
+            }
+        }
+        if (!p->error && !accept(p, ')')) {
+            p->error = "manca ')'";
+        }
+        if (p->error) {
+            free_node(left);
+            free_node(right);
+            return NULL;
+        }
+        return new_node(p, type, left, right);
+    }
+
+    p->error = *p->pos ? "carattere inatteso" : "espressione incompleta";
+    return NULL;
+}
+
+// unario := - unario | primario
+static Node* parse_unary(Parser* p) {
+    if (accept(p, '-')) {
+        Node* operand = parse_unary(p);
+        return operand ? new_node(p, NODE_NEG, operand, NULL) : NULL;
+    }
+    return parse_primary(p);
+}
+
+// termine := unario (( * | / ) unario)*
+static Node* parse_term(Parser* p) {
+    Node* node = parse_unary(p);
+    while (node) {
+        NodeType type;
+        if (accept(p, '*')) type = NODE_MUL;
+        else if (accept(p, '/')) type = NODE_DIV;
+        else break;
+
+        Node* right = parse_unary(p);
+        Node* parent = right ? new_node(p, type, node, right) : NULL;
+        if (!parent) {
+            free_node(node);
+            free_node(right);
+            return NULL;
+        }
+        node = parent;
+    }
+    return node;
+}
+
+// espressione := termine (( + | - ) termine)*
+static Node* parse_expression(Parser* p) {
+    Node* node = parse_term(p);
+    while (node) {
+        NodeType type;
+        if (accept(p, '+')) type = NODE_ADD;
+        else if (accept(p, '-')) type = NODE_SUB;
+        else break;
+
+        Node* right = parse_term(p);
+        Node* parent = right ? new_node(p, type, node, right) : NULL;
+        if (!parent) {
+            free_node(node);
+            free_node(right);
+            return NULL;
+        }
+        node = parent;
+    }
+    return node;
+}
+
+// Linearizza l'albero in notazione postfissa; restituisce la profondità di pila
+static int compile(const Node* node, Op* program, int* length) {
+    int depth = 0;
+    if (node->left) {
+        depth = compile(node->left, program, length);
+    }
+    if (node->right) {
+        int right = compile(node->right, program, length) + 1;
+        if (right > depth) depth = right;
+    }
+    program[(*length)++] = (Op){ .type = node->type, .number = node->number, .id = node->id };
+    return depth > 0 ? depth : 1;
+}
+
+static int count_nodes(const Node* node) {
+    return node ? 1 + count_nodes(node->left) + count_nodes(node->right) : 0;
+}
+
+bool expr_define(const char* definition) {
+    const char* equals = strchr(definition, '=');
+    if (!equals || equals == definition) {
+        fprintf(stderr, "Metrica derivata non valida (atteso nome=espressione): %s\n", definition);
+        return false;
+    }
+
+    // Nome con unità facoltativa tra parentesi quadre, come nei file di metriche
+    char name[256], unit[64] = "";
+    size_t length = equals - definition;
+    if (length >= sizeof(name)) {
+        fprintf(stderr, "Nome della metrica derivata troppo lungo: %s\n", definition);
+        return false;
+    }
+    memcpy(name, definition, length);
+    name[length] = '\0';
+
+    char* unit_start = strchr(name, '[');
+    if (unit_start) {
+        *unit_start++ = '\0';
+        char* unit_end = strchr(unit_start, ']');
+        if (unit_end) *unit_end = '\0';
+        snprintf(unit, sizeof(unit), "%s", unit_start);
+    }
+
+    if (num_derived == EXPR_MAX_DERIVED) {
+        fprintf(stderr, "Troppe metriche derivate (massimo %d)\n", EXPR_MAX_DERIVED);
+        return false;
+    }
+
+    Derived* grown = realloc(derived, (num_derived + 1) * sizeof(Derived));
+    if (!grown) {
+        return false;
+    }
+    derived = grown;
+    Derived* d = &derived[num_derived];
+    memset(d, 0, sizeof(*d));
+
+    d->output = metrics_register(name, unit);
+    for (int i = 0; i < num_derived; i++) {
+        if (derived[i].output == d->output) {
+            fprintf(stderr, "Metrica derivata %s definita più volte\n", name);
+            return false;
+        }
+    }
+
+    Parser p = { .text = equals + 1, .pos = equals + 1, .target = d };
+    Node* root = d->output != METRIC_ID_INVALID ? parse_expression(&p) : NULL;
+    if (root) {
+        skip_spaces(&p);
+        if (*p.pos) {
+            p.error = "carattere inatteso";
+        }
+    } else if (!p.error) {
+        p.error = "impossibile registrare la metrica";
+    }
+
+    if (!p.error) {
+        d->program = malloc(count_nodes(root) * sizeof(Op));
+        if (!d->program) {
+            p.error = "memoria esaurita";
+        } else if (compile(root, d->program, &d->length) > EXPR_MAX_STACK) {
+            p.error = "espressione troppo annidata";
+        }
+    }
+    free_node(root);
+
+    if (p.error) {
+        fprintf(stderr, "Espressione non valida per %s: %s (posizione %d: \"%s\")\n",
+                name, p.error, (int)(p.pos - p.text), p.pos);
+        free(d->program);
+        free(d->inputs);
+        return false;
+    }
+
+    num_derived++;
+    return true;
+}
+
+// Registra la metrica derivata node tra quelle che dipendono da id
+static bool add_dependent(metric_id_t id, int node) {
+    uint32_t chunk = id / METRICS_CHUNK_SIZE;
+    if (!dependent_chunks[chunk]) {
+        dependent_chunks[chunk] = calloc(METRICS_CHUNK_SIZE, sizeof(Dependents));
+        if (!dependent_chunks[chunk]) return false;
+    }
+
+    Dependents* deps = &dependent_chunks[chunk][id % METRICS_CHUNK_SIZE];
+    int* nodes = realloc(deps->nodes, (deps->count + 1) * sizeof(int));
+    if (!nodes) return false;
+    deps->nodes = nodes;
+    deps->nodes[deps->count++] = node;
+    return true;
+}
+
+bool expr_finalize(void) {
+    if (num_derived == 0) {
+        return true;
+    }
+
+    // Grafo delle dipendenze e numero di ingressi derivati di ogni nodo
+    int* pending = calloc(num_derived, sizeof(int));
+    order = malloc(num_derived * sizeof(int));
+    if (!pending || !order) {
+        free(pending);
+        return false;
+    }
+
+    for (int n = 0; n < num_derived; n++) {
+        for (int i = 0; i < derived[n].num_inputs; i++) {
+            if (!add_dependent(derived[n].inputs[i], n)) {
+                free(pending);
+                return false;
+            }
+            for (int m = 0; m < num_derived; m++) {
+                if (derived[m].output == derived[n].inputs[i]) {
+                    pending[n]++;
+                }
+            }
+        }
+    }
+
+    // Ordinamento topologico (Kahn): un nodo viene dopo tutti i suoi ingressi
+    int count = 0;
+    for (int n = 0; n < num_derived; n++) {
+        if (pending[n] == 0) order[count++] = n;
+    }
+    for (int i = 0; i < count; i++) {
+        metric_id_t output = derived[order[i]].output;
+        Dependents* deps = dependent_chunks[output / METRICS_CHUNK_SIZE]
+                         ? &dependent_chunks[output / METRICS_CHUNK_SIZE][output % METRICS_CHUNK_SIZE]
+                         : NULL;
+        for (int j = 0; deps && j < deps->count; j++) {
+            if (--pending[deps->nodes[j]] == 0) {
+                order[count++] = deps->nodes[j];
+            }
+        }
+    }
+    free(pending);
+
+    if (count < num_derived) {
+        fprintf(stderr, "Dipendenza circolare tra le metriche derivate:");
+        for (int n = 0; n < num_derived; n++) {
+            bool ordered = false;
+            for (int i = 0; i < count; i++) {
+                if (order[i] == n) ordered = true;
+            }
+            if (!ordered) fprintf(stderr, " %s", metrics_name(derived[n].output));
+        }
+        fprintf(stderr, "\n");
+        return false;
+    }
+
+    for (int i = 0; i < num_derived; i++) {
+        derived[order[i]].rank = i;
+    }
+    return true;
+}
+
+int expr_count(void) {
+    return num_derived;
+}
+
+void expr_mark_dirty(metric_id_t id) {
+    Dependents* chunk = dependent_chunks[id / METRICS_CHUNK_SIZE];
+    if (!chunk || !order) {
+        return;
+    }
+
+    Dependents* deps = &chunk[id % METRICS_CHUNK_SIZE];
+    for (int i = 0; i < deps->count; i++) {
+        int rank = derived[deps->nodes[i]].rank;
+        dirty_ranks[rank / 64] |= 1ULL << (rank % 64);
+        if (rank < first_dirty) first_dirty = rank;
+    }
+    if (deps->count > 0) {
+        any_dirty = true;
+    }
+}
+
+bool expr_pending(void) {
+    return any_dirty;
+}
+
+// Valuta il programma di una metrica derivata; false se manca un ingresso
+static bool evaluate(const Derived* d, double* result) {
+    double stack[EXPR_MAX_STACK];
+    int top = 0;
+
+    for (int i = 0; i < d->length; i++) {
+        const Op* op = &d->program[i];
+        switch (op->type) {
+            case NODE_NUMBER:
+                stack[top++] = op->number;
+                break;
+            case NODE_METRIC:
+                if (!metrics_read(op->id, &stack[top++], NULL)) {
+                    return false;  // Ingresso mai aggiornato
+                }
+                break;
+            case NODE_NEG:
+                stack[top - 1] = -stack[top - 1];
+                break;
+            case NODE_ABS:
+                stack[top - 1] = fabs(stack[top - 1]);
+                break;
+            default: {
+                double b = stack[--top];
+                double a = stack[top - 1];
+                switch (op->type) {
+                    case NODE_ADD: a += b; break;
+                    case NODE_SUB: a -= b; break;
+                    case NODE_MUL: a *= b; break;
+                    case NODE_DIV: a /= b; break;
+                    case NODE_MIN: a = b < a ? b : a; break;
+                    case NODE_MAX: a = b > a ? b : a; break;
+                    default: break;
+                }
+                stack[top - 1] = a;
+            }
+        }
+    }
+
+    *result = stack[0];
+    return isfinite(*result);
+}
+
+void expr_recompute(expr_store_t store) {
+    if (!any_dirty) {
+        return;
+    }
+
+    // Scrivere un nodo può sporcare solo nodi successivi nell'ordine,
+    // quindi basta una passata dal primo nodo da ricalcolare
+    int start = first_dirty;
+    for (int rank = start; rank < num_derived; rank++) {
+        uint64_t* word = &dirty_ranks[rank / 64];
+        if (*word == 0) {
+            rank |= 63;  // Nessun nodo sporco in questa parola
+            continue;
+        }
+        uint64_t bit = 1ULL << (rank % 64);
+        if (!(*word & bit)) {
+            continue;
+        }
+        *word &= ~bit;
+
+        double value;
+        const Derived* d = &derived[order[rank]];
+        if (evaluate(d, &value)) {
+            store(d->output, value);
+        }
+    }
+
+    // I nodi sporcati dalle scritture sono già stati ricalcolati in questa passata
+    first_dirty = EXPR_MAX_DERIVED;
+    any_dirty = false;
+}
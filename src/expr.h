@@ -0,0 +1,38 @@
+// expr.h
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdbool.h>
+#include "metrics.h"
+
+#define EXPR_MAX_STACK 64      // Profondità massima di valutazione di un'espressione
+#define EXPR_MAX_DERIVED 1024  // Metriche derivate definibili (multiplo di 64)
+
+// Funzione con cui il registro scrive il valore di una metrica derivata
+typedef void (*expr_store_t)(metric_id_t id, double value);
+
+// Definisce una metrica derivata: "nome[unità]=espressione".
+// Le espressioni usano + - * / , parentesi, numeri, nomi di metriche
+// (anche con etichette, disk_used{host="n12"}; tra virgolette, con \" e
+// \\ per virgolette e barre, se contengono altri caratteri) e min(),
+// max(), abs().
+bool expr_define(const char* definition);
+
+// Ordina le metriche derivate per dipendenze; false se c'è un ciclo
+bool expr_finalize(void);
+
+int expr_count(void);
+
+// Segnala che una metrica è cambiata (scrittore del registro). Le metriche
+// derivate da ricalcolare sono tenute per thread, fino alla chiusura del
+// suo batch.
+void expr_mark_dirty(metric_id_t id);
+
+// Indica se il batch del thread corrente ha metriche derivate da ricalcolare
+bool expr_pending(void);
+
+// Ricalcola in ordine topologico solo le metriche derivate sporcate dal
+// thread corrente (scrittore del registro, con il lock preso)
+void expr_recompute(expr_store_t store);
+
+#endif
@@ -0,0 +1,645 @@
+// history.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+#include "utils.h"
+
+#define HISTORY_MAGIC 0x53574831  // "SWH1"
+#define HISTORY_VERSION 1
+
+// Campione grezzo
+typedef struct {
+    int64_t ts_ms;
+    double value;
+} RawRecord;
+
+// Aggregato di un intervallo (minuto o ora)
+typedef struct {
+    int64_t ts_ms;   // Inizio dell'intervallo
+    double min;
+    double max;
+    double avg;
+} RollupRecord;
+
+// Intestazione di un buffer circolare di record a dimensione fissa.
+// È anche il formato su disco dei file di storico. Il checksum copre solo
+// la parte statica: head e record non sono validati. Se il processo
+// termina, le pagine restano nella cache del kernel e arrivano comunque
+// su disco; una mancanza di corrente tra due sincronizzazioni può invece
+// lasciare su disco head e record di momenti diversi.
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t tier;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint32_t checksum;        // Checksum dei campi precedenti
+    uint32_t reserved;
+    uint64_t head;            // Record scritti in totale: il prossimo va in head % capacity
+    RollupRecord pending;     // Aggregato in corso; avg contiene la somma parziale
+    uint64_t pending_count;   // Campioni nell'aggregato in corso
+} RingHeader;
+
+typedef struct {
+    RingHeader header;
+    unsigned char records[];
+} Ring;
+
+// Storico di una metrica
+typedef struct {
+    pthread_mutex_t lock;     // Protegge i buffer dai lettori HTTP
+    Ring* rings[HISTORY_TIER_COUNT];
+} Series;
+
+static const int64_t tier_interval_ms[HISTORY_TIER_COUNT] = { 0, 60 * 1000, 3600 * 1000 };
+static const char* tier_names[HISTORY_TIER_COUNT] = { "raw", "1m", "1h" };
+
+static HistoryConfig history_config;
+static bool history_enabled = false;
+
+// Metriche con storico (history_config.metrics già suddivisa)
+static char** tracked_names = NULL;
+static int num_tracked_names = 0;
+static bool track_all = false;
+
+// File mappati (uno per metrica, con tutti i livelli), sincronizzati
+// periodicamente dal thread di flush
+typedef struct {
+    void* base;
+    size_t bytes;
+} MappedFile;
+
+static MappedFile* mapped_files = NULL;
+static int num_mapped_files = 0;
+static int mapped_capacity = 0;
+static pthread_mutex_t mapped_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t flush_thread;
+static bool flush_running = false;
+
+// Serie indicizzate per id con la stessa suddivisione in blocchi del registro
+typedef _Atomic(Series*) SeriesSlot;
+static _Atomic(SeriesSlot*) series_chunks[METRICS_MAX_CHUNKS];
+
+static size_t record_size(HistoryTier tier) {
+    return tier == HISTORY_TIER_RAW ? sizeof(RawRecord) : sizeof(RollupRecord);
+}
+
+static size_t ring_bytes(HistoryTier tier) {
+    return sizeof(Ring) + (size_t)history_config.capacity[tier] * record_size(tier);
+}
+
+// Sincronizza su disco tutti i file mappati
+static void sync_mapped_files(int flags) {
+    pthread_mutex_lock(&mapped_mutex);
+    for (int i = 0; i < num_mapped_files; i++) {
+        msync(mapped_files[i].base, mapped_files[i].bytes, flags);
+    }
+    pthread_mutex_unlock(&mapped_mutex);
+}
+
+// Thread di flush: le scritture normali sono semplici store in memoria,
+// le pagine modificate vengono consegnate al disco solo a intervalli
+static void* flush_thread_main(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&flush_mutex);
+    while (flush_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += history_config.sync_interval;
+        pthread_cond_timedwait(&flush_cond, &flush_mutex, &deadline);
+
+        if (flush_running) {
+            pthread_mutex_unlock(&flush_mutex);
+            sync_mapped_files(MS_ASYNC);
+            pthread_mutex_lock(&flush_mutex);
+        }
+    }
+    pthread_mutex_unlock(&flush_mutex);
+
+    return NULL;
+}
+
+// Inizializza lo storico
+bool history_init(const HistoryConfig* config) {
+    history_config = *config;
+    history_enabled = false;
+
+    for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+        if (history_config.capacity[t] > 0) {
+            history_enabled = true;
+        }
+    }
+
+    char* list = strdup(history_config.metrics);
+    if (!list) {
+        return false;
+    }
+    char* saveptr = NULL;
+    for (char* item = strtok_r(list, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(item, "*") == 0) {
+            track_all = true;
+            continue;
+        }
+        char** names = realloc(tracked_names, (num_tracked_names + 1) * sizeof(char*));
+        if (!names || !(names[num_tracked_names] = strdup(item))) {
+            free(names ? names : tracked_names);
+            tracked_names = NULL;
+            num_tracked_names = 0;
+            free(list);
+            return false;
+        }
+        tracked_names = names;
+        num_tracked_names++;
+    }
+    free(list);
+    if (!track_all && num_tracked_names == 0) {
+        history_enabled = false;
+    }
+
+    if (history_enabled && history_config.data_dir[0]) {
+        if (mkdir(history_config.data_dir, 0755) != 0 && errno != EEXIST) {
+            perror("Errore nella creazione della directory dello storico");
+            return false;
+        }
+
+        if (history_config.sync_interval > 0) {
+            flush_running = true;
+            if (pthread_create(&flush_thread, NULL, flush_thread_main, NULL) != 0) {
+                flush_running = false;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Ferma il thread di flush e porta su disco lo storico
+void history_shutdown(void) {
+    if (flush_running) {
+        pthread_mutex_lock(&flush_mutex);
+        flush_running = false;
+        pthread_cond_signal(&flush_cond);
+        pthread_mutex_unlock(&flush_mutex);
+        pthread_join(flush_thread, NULL);
+    }
+
+    sync_mapped_files(MS_SYNC);
+}
+
+// Byte dei livelli abilitati, consecutivi nello stesso blocco o file.
+// Intestazioni e record sono multipli di 8 byte: ogni livello resta allineato.
+static size_t series_bytes(void) {
+    size_t bytes = 0;
+    for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+        if (history_config.capacity[t] > 0) {
+            bytes += ring_bytes(t);
+        }
+    }
+    return bytes;
+}
+
+// Memoria occupata dallo storico di ogni metrica
+size_t history_bytes_per_metric(void) {
+    return sizeof(Series) + series_bytes();
+}
+
+// Checksum FNV-1a della parte statica dell'intestazione
+static uint32_t header_checksum(const RingHeader* h) {
+    const unsigned char* p = (const unsigned char*)h;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(RingHeader, checksum); i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void header_init(RingHeader* h, HistoryTier tier) {
+    memset(h, 0, sizeof(RingHeader));
+    h->magic = HISTORY_MAGIC;
+    h->version = HISTORY_VERSION;
+    h->tier = tier;
+    h->record_size = record_size(tier);
+    h->capacity = history_config.capacity[tier];
+    h->checksum = header_checksum(h);
+}
+
+// Verifica che un file esistente corrisponda alla configurazione attuale
+static bool header_valid(const RingHeader* h, HistoryTier tier) {
+    return h->magic == HISTORY_MAGIC &&
+           h->version == HISTORY_VERSION &&
+           h->tier == tier &&
+           h->record_size == record_size(tier) &&
+           h->capacity == history_config.capacity[tier] &&
+           h->checksum == header_checksum(h);
+}
+
+// Costruisce il nome del file di una metrica: nome ripulito più l'hash
+// del nome completo, così nomi diversi non collidono mai
+static void series_path(const char* name, char* path, size_t size) {
+    char safe[96];
+    size_t j = 0;
+
+    for (const char* p = name; *p && j < sizeof(safe) - 1; p++) {
+        char c = *p;
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                  (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.';
+        safe[j++] = ok ? c : '_';
+    }
+    safe[j] = '\0';
+
+    snprintf(path, size, "%s/%s-%016llx.hist", history_config.data_dir, safe,
+             (unsigned long long)hash_string(name));
+}
+
+// Mappa il file di una metrica: una sola mappatura per tutti i livelli,
+// così le metriche seguite restano ben sotto vm.max_map_count.
+// Restituisce l'inizio del blocco, con existing vero se il file aveva
+// già la dimensione attesa e va quindi ripreso.
+static void* series_map(const char* name, size_t bytes, bool* existing) {
+    char path[512];
+    series_path(name, path, sizeof(path));
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+
+    struct stat st;
+    *existing = fstat(fd, &st) == 0 && (size_t)st.st_size == bytes;
+    if (!*existing && ftruncate(fd, bytes) != 0) {
+        perror(path);
+        close(fd);
+        return NULL;
+    }
+
+    void* base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&mapped_mutex);
+    if (num_mapped_files == mapped_capacity) {
+        int capacity = mapped_capacity ? mapped_capacity * 2 : 64;
+        MappedFile* files = realloc(mapped_files, capacity * sizeof(MappedFile));
+        if (!files) {
+            pthread_mutex_unlock(&mapped_mutex);
+            munmap(base, bytes);
+            return NULL;
+        }
+        mapped_files = files;
+        mapped_capacity = capacity;
+    }
+    mapped_files[num_mapped_files++] = (MappedFile){ base, bytes };
+    pthread_mutex_unlock(&mapped_mutex);
+
+    return base;
+}
+
+// Crea i livelli di una metrica in un unico blocco, mappato da file con
+// --data-dir; un livello di formato o dimensione diversi riparte da zero
+static bool series_create(Series* series, const char* name) {
+    size_t bytes = series_bytes();
+    bool existing = false;
+    unsigned char* base = history_config.data_dir[0] ? series_map(name, bytes, &existing) : malloc(bytes);
+    if (!base) {
+        return false;
+    }
+
+    for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+        if (history_config.capacity[t] == 0) continue;
+        Ring* ring = (Ring*)base;
+        if (!existing || !header_valid(&ring->header, t)) {
+            header_init(&ring->header, t);
+        }
+        series->rings[t] = ring;
+        base += ring_bytes(t);
+    }
+    return true;
+}
+
+static Series* get_series(metric_id_t id) {
+    SeriesSlot* slots = atomic_load_explicit(&series_chunks[id / METRICS_CHUNK_SIZE], memory_order_acquire);
+    return slots ? atomic_load_explicit(&slots[id % METRICS_CHUNK_SIZE], memory_order_acquire) : NULL;
+}
+
+// Nome esatto o famiglia (il nome prima delle etichette) nell'elenco
+static bool should_track(const char* name) {
+    if (track_all) {
+        return true;
+    }
+    const char* brace = strchr(name, '{');
+    size_t family = brace ? (size_t)(brace - name) : strlen(name);
+    for (int i = 0; i < num_tracked_names; i++) {
+        if (strcmp(tracked_names[i], name) == 0 ||
+            (strlen(tracked_names[i]) == family && strncmp(tracked_names[i], name, family) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void history_attach(metric_id_t id, const char* name) {
+    if (!history_enabled || !should_track(name)) {
+        return;
+    }
+
+    // Più fonti possono registrare metriche insieme: il blocco di slot
+    // viene pubblicato una volta sola
+    uint32_t chunk = id / METRICS_CHUNK_SIZE;
+    SeriesSlot* slots = atomic_load_explicit(&series_chunks[chunk], memory_order_acquire);
+    if (!slots) {
+        SeriesSlot* fresh = calloc(METRICS_CHUNK_SIZE, sizeof(SeriesSlot));
+        if (!fresh) return;
+        if (atomic_compare_exchange_strong(&series_chunks[chunk], &slots, fresh)) {
+            slots = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+
+    Series* series = calloc(1, sizeof(Series));
+    if (!series) {
+        return;
+    }
+    pthread_mutex_init(&series->lock, NULL);
+    if (!series_create(series, name)) {
+        pthread_mutex_destroy(&series->lock);
+        free(series);
+        return;
+    }
+
+    // Da qui i campioni della metrica entrano nello storico
+    atomic_store_explicit(&slots[id % METRICS_CHUNK_SIZE], series, memory_order_release);
+}
+
+bool history_tracked(metric_id_t id) {
+    return get_series(id) != NULL;
+}
+
+static inline void* ring_record(Ring* ring, uint64_t index) {
+    return ring->records + (index % ring->header.capacity) * ring->header.record_size;
+}
+
+static void ring_push(Ring* ring, const void* record) {
+    memcpy(ring_record(ring, ring->header.head), record, ring->header.record_size);
+    ring->header.head++;
+}
+
+// Indice logico del record più vecchio ancora presente
+static inline uint64_t ring_tail(const Ring* ring) {
+    return ring->header.head > ring->header.capacity ? ring->header.head - ring->header.capacity : 0;
+}
+
+// Converte il record logico index in un punto
+static void read_point(Ring* ring, uint64_t index, HistoryPoint* point) {
+    void* record = ring_record(ring, index);
+
+    if (ring->header.tier == HISTORY_TIER_RAW) {
+        RawRecord* raw = record;
+        point->ts_ms = raw->ts_ms;
+        point->min = point->max = point->avg = raw->value;
+    } else {
+        RollupRecord* rollup = record;
+        point->ts_ms = rollup->ts_ms;
+        point->min = rollup->min;
+        point->max = rollup->max;
+        point->avg = rollup->avg;
+    }
+}
+
+// Timestamp più recente di un livello, aggregato in corso compreso;
+// INT64_MIN se vuoto
+static int64_t ring_newest(Ring* ring) {
+    const RingHeader* h = &ring->header;
+    if (h->tier != HISTORY_TIER_RAW && h->pending_count > 0) {
+        return h->pending.ts_ms;
+    }
+    if (h->head == 0) {
+        return INT64_MIN;
+    }
+    HistoryPoint point;
+    read_point(ring, h->head - 1, &point);
+    return point.ts_ms;
+}
+
+// Accumula un campione nell'aggregato in corso, chiudendo quello precedente
+// se il campione appartiene a un nuovo intervallo. Un intervallo anteriore
+// all'ultimo viene accorpato all'ultimo.
+static void ring_accumulate(Ring* ring, int64_t interval_ms, int64_t ts_ms, double value) {
+    RingHeader* h = &ring->header;
+    int64_t bucket = ts_ms - ts_ms % interval_ms;
+    int64_t newest = ring_newest(ring);
+    if (bucket < newest) {
+        bucket = newest;
+    }
+
+    if (h->pending_count > 0 && h->pending.ts_ms != bucket) {
+        RollupRecord done = h->pending;
+        done.avg /= (double)h->pending_count;
+        ring_push(ring, &done);
+        h->pending_count = 0;
+    }
+
+    if (h->pending_count == 0) {
+        h->pending.ts_ms = bucket;
+        h->pending.min = value;
+        h->pending.max = value;
+        h->pending.avg = value;
+    } else {
+        if (value < h->pending.min) h->pending.min = value;
+        if (value > h->pending.max) h->pending.max = value;
+        h->pending.avg += value;
+    }
+    h->pending_count++;
+}
+
+// Registra un campione in tutti i livelli abilitati
+void history_record(metric_id_t id, int64_t ts_ms, double value) {
+    Series* series = get_series(id);
+    if (!series) {
+        return;
+    }
+
+    pthread_mutex_lock(&series->lock);
+
+    for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+        Ring* ring = series->rings[t];
+        if (!ring) continue;
+
+        if (t == HISTORY_TIER_RAW) {
+            // ring_lower_bound richiede record in ordine di tempo: un
+            // campione anteriore all'ultimo (orologio tornato indietro,
+            // timestamp di un produttore) prende il timestamp dell'ultimo
+            int64_t newest = ring_newest(ring);
+            RawRecord record = { .ts_ms = ts_ms < newest ? newest : ts_ms, .value = value };
+            ring_push(ring, &record);
+        } else {
+            ring_accumulate(ring, tier_interval_ms[t], ts_ms, value);
+        }
+    }
+
+    pthread_mutex_unlock(&series->lock);
+}
+
+// Primo indice logico con timestamp >= from_ms (i record sono in ordine di tempo)
+static uint64_t ring_lower_bound(Ring* ring, int64_t from_ms) {
+    uint64_t lo = ring_tail(ring), hi = ring->header.head;
+
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        HistoryPoint point;
+        read_point(ring, mid, &point);
+        if (point.ts_ms < from_ms) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Timestamp del dato più vecchio disponibile in un livello, -1 se vuoto
+static int64_t ring_oldest(Ring* ring) {
+    if (ring->header.head > 0) {
+        HistoryPoint point;
+        read_point(ring, ring_tail(ring), &point);
+        return point.ts_ms;
+    }
+    return ring->header.pending_count > 0 ? ring->header.pending.ts_ms : -1;
+}
+
+// Riduce n punti a max_points mantenendo per ogni gruppo il minimo e il massimo
+static int downsample_minmax(const HistoryPoint* in, int n, HistoryPoint* out, int max_points) {
+    if (n <= max_points) {
+        memcpy(out, in, n * sizeof(HistoryPoint));
+        return n;
+    }
+
+    int buckets = max_points / 2;
+    if (buckets < 1) buckets = 1;
+    int written = 0;
+
+    for (int b = 0; b < buckets; b++) {
+        int start = (int)((int64_t)b * n / buckets);
+        int end = (int)((int64_t)(b + 1) * n / buckets);
+        int imin = start, imax = start;
+
+        for (int i = start + 1; i < end; i++) {
+            if (in[i].min < in[imin].min) imin = i;
+            if (in[i].max > in[imax].max) imax = i;
+        }
+
+        // I due estremi vengono emessi in ordine di tempo
+        int first = imin < imax ? imin : imax;
+        int second = imin < imax ? imax : imin;
+        out[written++] = in[first];
+        if (second != first && written < max_points) {
+            out[written++] = in[second];
+        }
+    }
+
+    return written;
+}
+
+// Estrae i punti di una metrica ridotti alla risoluzione richiesta
+int history_query(metric_id_t id, int64_t from_ms, int64_t to_ms, HistoryTier tier,
+                  HistoryPoint* out, int max_points, HistoryTier* used_tier) {
+    Series* series = get_series(id);
+    if (!series || max_points <= 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&series->lock);
+
+    // Senza un livello esplicito usa il più fine che copre l'inizio
+    // dell'intervallo (o che non ha ancora sovrascritto nulla, e quindi
+    // contiene tutto lo storico), altrimenti il più ampio disponibile
+    if (tier >= HISTORY_TIER_COUNT || !series->rings[tier]) {
+        tier = HISTORY_TIER_COUNT;
+        for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+            Ring* ring = series->rings[t];
+            if (!ring) continue;
+            int64_t oldest = ring_oldest(ring);
+            if (oldest < 0) continue;
+            tier = t;
+            if (oldest <= from_ms || ring->header.head <= ring->header.capacity) break;
+        }
+    }
+
+    if (tier == HISTORY_TIER_COUNT) {
+        pthread_mutex_unlock(&series->lock);
+        return 0;
+    }
+
+    Ring* ring = series->rings[tier];
+    uint64_t first = ring_lower_bound(ring, from_ms);
+    uint64_t available = ring->header.head - first + 1;  // +1 per l'aggregato in corso
+
+    HistoryPoint* points = malloc(available * sizeof(HistoryPoint));
+    if (!points) {
+        pthread_mutex_unlock(&series->lock);
+        return 0;
+    }
+
+    int n = 0;
+    for (uint64_t i = first; i < ring->header.head; i++) {
+        read_point(ring, i, &points[n]);
+        if (points[n].ts_ms > to_ms) break;
+        n++;
+    }
+
+    // L'intervallo non ancora chiuso rende visibile anche il dato più recente
+    if (tier != HISTORY_TIER_RAW && ring->header.pending_count > 0 &&
+        ring->header.pending.ts_ms >= from_ms && ring->header.pending.ts_ms <= to_ms) {
+        points[n] = (HistoryPoint){
+            .ts_ms = ring->header.pending.ts_ms,
+            .min = ring->header.pending.min,
+            .max = ring->header.pending.max,
+            .avg = ring->header.pending.avg / (double)ring->header.pending_count
+        };
+        n++;
+    }
+
+    pthread_mutex_unlock(&series->lock);
+
+    int written = downsample_minmax(points, n, out, max_points);
+    free(points);
+
+    if (used_tier) {
+        *used_tier = tier;
+    }
+    return written;
+}
+
+const char* history_tier_name(HistoryTier tier) {
+    return tier < HISTORY_TIER_COUNT ? tier_names[tier] : "?";
+}
+
+bool history_parse_tier(const char* name, HistoryTier* tier) {
+    for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+        if (strcasecmp(name, tier_names[t]) == 0) {
+            *tier = t;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,74 @@
+// history.h
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "metrics.h"
+
+// Dimensioni predefinite dei livelli di storico (numero di record per metrica)
+#define HISTORY_DEFAULT_RAW 600      // 10 minuti di campioni a 1 Hz
+#define HISTORY_DEFAULT_MINUTE 1440  // 24 ore di aggregati al minuto
+#define HISTORY_DEFAULT_HOUR 720     // 30 giorni di aggregati orari
+
+#define HISTORY_MAX_POINTS 10000     // Punti massimi restituiti da una query
+#define HISTORY_DEFAULT_SYNC 60      // Secondi tra due msync dei file di storico
+
+// Livelli di risoluzione dello storico
+typedef enum {
+    HISTORY_TIER_RAW,
+    HISTORY_TIER_MINUTE,
+    HISTORY_TIER_HOUR,
+    HISTORY_TIER_COUNT
+} HistoryTier;
+
+// Configurazione: capacità di ogni livello (0 = livello disabilitato).
+// Lo storico è tenuto solo per le metriche elencate in metrics (nomi o
+// famiglie separati da virgole, * per tutte): ogni serie costa
+// history_bytes_per_metric() byte. Con data_dir non vuota i livelli di
+// ogni metrica stanno in un file mappato in memoria, ripreso così com'è al
+// riavvio.
+typedef struct {
+    uint32_t capacity[HISTORY_TIER_COUNT];
+    char metrics[1024];
+    char data_dir[256];
+    uint32_t sync_interval;  // Secondi tra due msync (0 = solo alla chiusura)
+} HistoryConfig;
+
+// Punto restituito da una query; per i campioni grezzi min = max = avg
+typedef struct {
+    int64_t ts_ms;
+    double min;
+    double max;
+    double avg;
+} HistoryPoint;
+
+// Inizializza lo storico; la memoria per metrica è fissa e nota in anticipo
+bool history_init(const HistoryConfig* config);
+void history_shutdown(void);
+size_t history_bytes_per_metric(void);
+
+// Crea lo storico di una metrica appena registrata, se è tra quelle
+// richieste. Alloca o mappa i buffer: va chiamata fuori dalla sezione di
+// scrittura del registro, mai mentre i lettori attendono.
+void history_attach(metric_id_t id, const char* name);
+
+// Vero se la metrica ha uno storico
+bool history_tracked(metric_id_t id);
+
+// Registra un campione (chiamata dal registro delle metriche dopo ogni
+// scrittura, fuori dalla sezione letta senza lock); senza storico creato
+// con history_attach non fa nulla
+void history_record(metric_id_t id, int64_t ts_ms, double value);
+
+// Estrae i punti nell'intervallo [from_ms, to_ms] ridotti a max_points.
+// Se tier è HISTORY_TIER_COUNT sceglie il livello più fine che copre l'intervallo.
+// Restituisce il numero di punti scritti in out e il livello usato in used_tier.
+int history_query(metric_id_t id, int64_t from_ms, int64_t to_ms, HistoryTier tier,
+                  HistoryPoint* out, int max_points, HistoryTier* used_tier);
+
+const char* history_tier_name(HistoryTier tier);
+bool history_parse_tier(const char* name, HistoryTier* tier);
+
+#endif
@@ -2,17 +2,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/socket.h>     // Per send()
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include "http_handler.h"
 #include "server.h"
+#include "api.h"
+#include "prometheus.h"
+#include "tokens.h"
+#include "alerts.h"
 #include "utils.h"
 
 extern ServerConfig server_config;
 #define MAX_PATH 1024
+#define MAX_BODY (8 * 1024 * 1024)  // Corpo massimo di una richiesta POST
+#define BODY_RECV_TIMEOUT_MS 10000  // Silenzio massimo durante la lettura del corpo
+#define BODY_TIMEOUT_MS 60000       // Durata massima della lettura del corpo
 
 // Mappa delle estensioni MIME
 static struct {
@@ -57,6 +67,135 @@ void send_http_error(int client_socket, int status_code, const char* status_text
     send(client_socket, response, strlen(response), 0);
 }
 
+// Invia una risposta HTTP completa con il corpo e le intestazioni indicate
+void send_http_response_headers(int client_socket, int status_code, const char* status_text,
+                                const char* content_type, const char* headers,
+                                const char* body, size_t length) {
+    char header[512];
+    int header_length = snprintf(header, sizeof(header),
+             "HTTP/1.1 %d %s\r\n"
+             "Content-Type: %s\r\n"
+             "Content-Length: %zu\r\n"
+             "%s"
+             "Cache-Control: no-cache\r\n"
+             "Connection: close\r\n"
+             "\r\n",
+             status_code, status_text, content_type, length, headers ? headers : "");
+    
+    if (send(client_socket, header, header_length, MSG_NOSIGNAL) < 0) {
+        return;
+    }
+    
+    while (length > 0) {
+        ssize_t sent = send(client_socket, body, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return;
+        }
+        body += sent;
+        length -= sent;
+    }
+}
+
+void send_http_response(int client_socket, int status_code, const char* status_text,
+                        const char* content_type, const char* body, size_t length) {
+    send_http_response_headers(client_socket, status_code, status_text, content_type, NULL, body, length);
+}
+
+// Vero se l'intestazione Accept-Encoding della richiesta ammette gzip
+// (escluso "gzip;q=0")
+static bool accepts_gzip(const char* request) {
+    const char* header_end = strstr(request, "\r\n\r\n");
+    for (const char* line = strstr(request, "\r\n"); line && line < header_end; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Accept-Encoding:", 16) != 0) {
+            continue;
+        }
+        const char* end = strstr(line + 2, "\r\n");
+        for (const char* p = line + 18; p + 4 <= end; p++) {
+            if (strncasecmp(p, "gzip", 4) != 0) {
+                continue;
+            }
+            const char* q = p + 4;
+            while (q < end && *q == ' ') q++;
+            if (end - q >= 4 && strncmp(q, ";q=0", 4) == 0 &&
+                (q + 4 == end || q[4] != '.' || strspn(q + 5, "0") >= (size_t)(end - q - 5))) {
+                return false;
+            }
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+void http_request_credential(const char* request, char* credential, size_t size) {
+    credential[0] = '\0';
+    const char* header_end = strstr(request, "\r\n\r\n");
+    for (const char* line = strstr(request, "\r\n"); line && line < header_end; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Authorization:", 14) != 0) {
+            continue;
+        }
+        const char* p = line + 16;
+        while (*p == ' ') p++;
+        if (strncasecmp(p, "Bearer ", 7) != 0) {
+            return;
+        }
+        p += 7;
+        while (*p == ' ') p++;
+        size_t length = strcspn(p, " \r\n");
+        if (length < size) {
+            memcpy(credential, p, length);
+            credential[length] = '\0';
+        }
+        return;
+    }
+}
+
+bool http_request_token(const char* query, const char* credential, char** allowed) {
+    char token[TOKEN_MAX];
+    if (!http_query_param(query, "token", token, sizeof(token)) || token[0] == '\0') {
+        snprintf(token, sizeof(token), "%s", credential);
+    }
+    return token_verify(token, allowed);
+}
+
+// Decodifica una stringa URL (%XX e '+') nel buffer di destinazione
+static void url_decode(const char* src, size_t length, char* dst, size_t size) {
+    size_t j = 0;
+    
+    for (size_t i = 0; i < length && j + 1 < size; i++) {
+        if (src[i] == '%' && i + 2 < length && isxdigit((unsigned char)src[i + 1]) &&
+            isxdigit((unsigned char)src[i + 2])) {
+            char hex[3] = { src[i + 1], src[i + 2], '\0' };
+            dst[j++] = (char)strtol(hex, NULL, 16);
+            i += 2;
+        } else if (src[i] == '+') {
+            dst[j++] = ' ';
+        } else {
+            dst[j++] = src[i];
+        }
+    }
+    dst[j] = '\0';
+}
+
+// Estrae il valore decodificato di un parametro dalla query string
+bool http_query_param(const char* query, const char* name, char* value, size_t size) {
+    size_t name_length = strlen(name);
+    const char* p = query;
+    
+    while (p && *p) {
+        const char* end = strchr(p, '&');
+        size_t length = end ? (size_t)(end - p) : strlen(p);
+        
+        if (length > name_length && strncmp(p, name, name_length) == 0 && p[name_length] == '=') {
+            url_decode(p + name_length + 1, length - name_length - 1, value, size);
+            return true;
+        }
+        
+        p = end ? end + 1 : NULL;
+    }
+    return false;
+}
+
 static void send_file(int client_socket, const char* filepath) {
     FILE* file = fopen(filepath, "rb");
     if (!file) {
@@ -91,7 +230,7 @@ static void send_file(int client_socket, const char* filepath) {
 }
 
 // Funzione per estrarre il contenuto di un meta tag
-static char* extract_meta_content(const char* html, const char* meta_name) {
+char* extract_meta_content(const char* html, const char* meta_name) {
     char search_string[128];
     snprintf(search_string, sizeof(search_string), "<meta name=\"%s\" content=\"", meta_name);
     
@@ -118,9 +257,82 @@ static char* extract_meta_content(const char* html, const char* meta_name) {
     return content;
 }
 
-void handle_http_request(int client_socket, char* buffer) {
-    // Verifica se la richiesta è valida
-    if (!strstr(buffer, "GET ") && !strstr(buffer, "HEAD ")) {
+// Legge il corpo di una richiesta POST: la parte già ricevuta con
+// l'intestazione più il resto, fino a Content-Length. Restituisce il
+// corpo (da liberare, terminato da '\0') o NULL dopo aver inviato l'errore.
+static char* read_request_body(int client_socket, const char* buffer, size_t length, size_t* body_length) {
+    const char* header_end = strstr(buffer, "\r\n\r\n");
+    const char* content_length = NULL;
+    bool expect_continue = false;
+    for (const char* line = strstr(buffer, "\r\n"); line && line < header_end; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+            content_length = line + 2 + 15;
+        } else if (strncasecmp(line + 2, "Expect: 100-continue", 20) == 0) {
+            expect_continue = true;
+        }
+    }
+    if (!content_length) {
+        send_http_error(client_socket, 411, "Length Required");
+        return NULL;
+    }
+    
+    long long expected = strtoll(content_length, NULL, 10);
+    if (expected < 0 || expected > MAX_BODY) {
+        send_http_error(client_socket, 413, "Payload Too Large");
+        return NULL;
+    }
+    
+    char* body = malloc(expected + 1);
+    if (!body) {
+        send_http_error(client_socket, 500, "Internal Server Error");
+        return NULL;
+    }
+    
+    size_t received = length - (header_end + 4 - buffer);
+    if (received > (size_t)expected) {
+        received = expected;
+    }
+    memcpy(body, header_end + 4, received);
+    
+    // I client che attendono conferma prima di inviare corpi grandi
+    if (received < (size_t)expected && expect_continue) {
+        static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        send(client_socket, continue_response, sizeof(continue_response) - 1, MSG_NOSIGNAL);
+    }
+    
+    // Un client che annuncia un corpo e poi tace, o lo invia a gocce, non
+    // trattiene il thread oltre i limiti
+    struct timeval timeout = {
+        .tv_sec = BODY_RECV_TIMEOUT_MS / 1000,
+        .tv_usec = (BODY_RECV_TIMEOUT_MS % 1000) * 1000
+    };
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    uint64_t deadline = now_ns() + (uint64_t)BODY_TIMEOUT_MS * 1000000;
+    
+    while (received < (size_t)expected) {
+        ssize_t n = recv(client_socket, body + received, expected - received, 0);
+        if (n <= 0 || now_ns() > deadline) {
+            free(body);
+            bool timed_out = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            if (timed_out || n > 0) {
+                send_http_error(client_socket, 408, "Request Timeout");
+            } else {
+                send_http_error(client_socket, 400, "Bad Request");
+            }
+            return NULL;
+        }
+        received += n;
+    }
+    
+    body[expected] = '\0';
+    *body_length = expected;
+    return body;
+}
+
+void handle_http_request(int client_socket, char* buffer, size_t length) {
+    // Verifica se la richiesta è valida; POST è ammesso solo per l'API
+    bool post = strncmp(buffer, "POST ", 5) == 0;
+    if (!post && strncmp(buffer, "GET ", 4) != 0 && strncmp(buffer, "HEAD ", 5) != 0) {
         send_http_error(client_socket, 400, "Bad Request");
         return;
     }
@@ -141,24 +353,76 @@ void handle_http_request(int client_socket, char* buffer) {
     
     size_t path_length = path_end - path_start;
     
+    // Separa la query string dal percorso
+    char* query_start = memchr(path_start, '?', path_length);
+    char query[MAX_PATH] = "";
+    if (query_start) {
+        size_t query_length = path_end - query_start - 1;
+        if (query_length >= sizeof(query)) {
+            send_http_error(client_socket, 414, "URI Too Long");
+            return;
+        }
+        memcpy(query, query_start + 1, query_length);
+        query[query_length] = '\0';
+        path_length = query_start - path_start;
+    }
+    
     // Verifica se il percorso è troppo lungo
     if (path_length >= MAX_PATH - strlen(server_config.www_root) - 1) {
         send_http_error(client_socket, 414, "URI Too Long");
         return;
     }
     
-    // Verifica se il percorso contiene sequenze di escape per directory traversal
-    if (strstr(path_start, "..")) {
+    char path[MAX_PATH];
+    memcpy(path, path_start, path_length);
+    path[path_length] = '\0';
+    
+    // Verifica se il percorso contiene sequenze di escape per directory
+    // traversal; la query no: i token per tutte le metriche contengono ".."
+    if (strstr(path, "..")) {
         send_http_error(client_socket, 403, "Forbidden");
         return;
     }
     
+    // Credenziale delle richieste all'API, dall'intestazione Authorization
+    char credential[TOKEN_MAX];
+    http_request_credential(buffer, credential, sizeof(credential));
+    
+    // Gli endpoint dell'API non corrispondono a file
+    if (post) {
+        if (strncmp(path, "/api/", 5) != 0) {
+            send_http_error(client_socket, 405, "Method Not Allowed");
+            return;
+        }
+        size_t body_length;
+        char* body = read_request_body(client_socket, buffer, length, &body_length);
+        if (body) {
+            api_handle_request(client_socket, "POST", path, query, credential, body, body_length);
+            free(body);
+        }
+        return;
+    }
+    if (strcmp(path, "/metrics") == 0) {
+        // Come le connessioni WebSocket, solo le metriche autorizzate dal token
+        char* allowed = NULL;
+        if (!http_request_token(query, credential, &allowed)) {
+            send_http_error(client_socket, 403, "Forbidden");
+            return;
+        }
+        prometheus_handle_request(client_socket, accepts_gzip(buffer), allowed);
+        free(allowed);
+        return;
+    }
+    if (api_handle_request(client_socket, "GET", path, query, credential, NULL, 0)) {
+        return;
+    }
+    
     char filepath[MAX_PATH];
     strncpy(filepath, server_config.www_root, sizeof(filepath));
     strncat(filepath, path_start, path_length);
     
     // Se la richiesta è per la root, serve index.html
-    if (strcmp(path_start, "/") == 0 || strcmp(path_start, "/index.html") == 0) {
+    if (strcmp(path, "/") == 0 || strcmp(path, "/index.html") == 0) {
         snprintf(filepath, sizeof(filepath), "%s/index.html", server_config.www_root);
     }
     
@@ -274,19 +538,37 @@ void handle_http_request(int client_socket, char* buffer) {
             }
         }
         
-        // Genera un token di sicurezza unico per questa richiesta
-        char token[64];
-        generate_random_token(token, sizeof(token));
+        // Token firmato con le metriche autorizzate e la scadenza: qualunque
+        // istanza con la stessa chiave lo verifica senza stato
+        char token[TOKEN_MAX];
+        int64_t expires;
+        if (!token_issue(metrics_list, TOKEN_TTL, token, sizeof(token), &expires)) {
+            send_http_error(client_socket, 500, "Internal Server Error");
+            free(content);
+            free(metrics_list);
+            goto cleanup;
+        }
+        
+        // Nome della pagina se il server ne valuta le soglie: il client lo
+        // ripresenta e riceve lo stato di allarme calcolato con quelle
+        const char* page = filepath + strlen(server_config.www_root);
+        while (*page == '/') page++;
+        StrBuf page_json;
+        strbuf_init(&page_json);
+        strbuf_append_json(&page_json, alerts_page(page) > 0 ? page : "");
         
         // Crea il tag script con il token di sicurezza
-        char script_tag[512];
+        char script_tag[TOKEN_MAX + 1024];
         snprintf(script_tag, sizeof(script_tag),
                  "<script>\n"
                  "window.SWSWS_CONFIG = {\n"
-                 "  securityToken: \"%s\"\n"
+                 "  securityToken: \"%s\",\n"
+                 "  tokenExpires: %lld,\n"
+                 "  page: %s\n"
                  "};\n"
                  "</script>",
-                 token);
+                 token, (long long)expires * 1000, page_json.data);
+        strbuf_free(&page_json);
         
         // Cerca il tag </head> per inserire lo script
         char* head_end = strstr(content, "</head>");
@@ -332,9 +614,6 @@ void handle_http_request(int client_socket, char* buffer) {
             send_file(client_socket, filepath);
         }
         
-        // Memorizza l'associazione tra token e metriche autorizzate
-        store_token_metrics(token, metrics_list);
-        
         free(content);
         free(metrics_list);
     } else {
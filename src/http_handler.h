@@ -2,9 +2,31 @@
 #ifndef HTTP_HANDLER_H
 #define HTTP_HANDLER_H
 
-void handle_http_request(int client_socket, char* buffer);
+#include <stdbool.h>
+#include <stddef.h>
+
+void handle_http_request(int client_socket, char* buffer, size_t length);
 const char* get_mime_type(const char* filename);
 void send_http_error(int client_socket, int status_code, const char* status_text);
+void send_http_response(int client_socket, int status_code, const char* status_text,
+                        const char* content_type, const char* body, size_t length);
+// Come send_http_response, con intestazioni aggiuntive ("Nome: valore\r\n"...)
+void send_http_response_headers(int client_socket, int status_code, const char* status_text,
+                                const char* content_type, const char* headers,
+                                const char* body, size_t length);
+bool http_query_param(const char* query, const char* name, char* value, size_t size);
+
+// Copia in credential il valore di "Authorization: Bearer ..." della
+// richiesta; stringa vuota se manca o non entra in size
+void http_request_credential(const char* request, char* credential, size_t size);
+
+// Verifica il token di una richiesta di lettura: il parametro token della
+// query o, in sua assenza, credential. allowed riceve l'elenco autorizzato
+// (da liberare). false se il token manca, non è valido o è scaduto.
+bool http_request_token(const char* query, const char* credential, char** allowed);
+
+// Contenuto del meta tag meta_name di una pagina HTML (da liberare), o NULL
+char* extract_meta_content(const char* html, const char* meta_name);
 
 
 #endif // HTTP_HANDLER_H
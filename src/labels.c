@@ -0,0 +1,401 @@
+// labels.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "labels.h"
+#include "utils.h"
+
+#define FAMILY_KEY "__name__"  // Chiave della lista degli id per famiglia
+
+// Voce di una tabella a concatenamento
+typedef struct Entry {
+    struct Entry* next;
+    uint64_t hash;
+} Entry;
+
+// Tabella a concatenamento, raddoppiata quando le voci superano i bucket
+typedef struct {
+    Entry** buckets;
+    uint32_t mask;
+    uint32_t count;
+} Table;
+
+// Coppia chiave="valore" internata, con la lista ordinata degli id che la portano
+typedef struct {
+    Entry entry;
+    char* key;
+    char* value;
+    metric_id_t* postings;
+    uint32_t count;
+    uint32_t capacity;
+} Pair;
+
+// Insieme di etichette internato: serie con le stesse etichette lo condividono
+typedef struct {
+    Entry entry;
+    int count;
+    Pair* pairs[];
+} LabelSet;
+
+// Etichetta letta da un nome o da un selettore
+typedef struct {
+    char key[64];
+    char value[256];
+} ParsedLabel;
+
+typedef struct {
+    char family[256];
+    ParsedLabel labels[LABELS_MAX];
+    int count;
+} ParsedName;
+
+static Table pairs_table;
+static Table sets_table;
+
+// Insieme di etichette di ogni serie, allocato a blocchi come il registro
+static LabelSet** set_chunks[METRICS_MAX_CHUNKS];
+
+// Le scritture avvengono solo alla registrazione di nuove serie
+static pthread_rwlock_t labels_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void skip_spaces(const char** p) {
+    while (isspace((unsigned char)**p)) (*p)++;
+}
+
+static int compare_labels(const void* a, const void* b) {
+    return strcmp(((const ParsedLabel*)a)->key, ((const ParsedLabel*)b)->key);
+}
+
+// Legge "famiglia{k="v",...}"; la famiglia può mancare solo nei selettori
+static bool parse_name(const char* text, ParsedName* parsed) {
+    const char* p = text;
+    skip_spaces(&p);
+    const char* brace = strchr(p, '{');
+    size_t family_length = brace ? (size_t)(brace - p) : strlen(p);
+
+    while (family_length > 0 && isspace((unsigned char)p[family_length - 1])) family_length--;
+    if (family_length >= sizeof(parsed->family)) {
+        return false;
+    }
+    memcpy(parsed->family, p, family_length);
+    parsed->family[family_length] = '\0';
+    parsed->count = 0;
+
+    if (!brace) {
+        return true;
+    }
+
+    p = brace + 1;
+    skip_spaces(&p);
+    while (*p != '}') {
+        if (parsed->count == LABELS_MAX) {
+            return false;
+        }
+        ParsedLabel* label = &parsed->labels[parsed->count];
+
+        // Chiave: lettere, cifre e '_', non inizia con una cifra
+        size_t k = 0;
+        if (!isalpha((unsigned char)*p) && *p != '_') {
+            return false;
+        }
+        while (isalnum((unsigned char)*p) || *p == '_') {
+            if (k + 1 >= sizeof(label->key)) return false;
+            label->key[k++] = *p++;
+        }
+        label->key[k] = '\0';
+
+        skip_spaces(&p);
+        if (*p++ != '=') return false;
+        skip_spaces(&p);
+        if (*p++ != '"') return false;
+
+        // Valore tra virgolette, con \" e \\ come sequenze di escape
+        size_t v = 0;
+        while (*p != '"') {
+            if (*p == '\0') return false;
+            if (*p == '\\' && (p[1] == '"' || p[1] == '\\')) p++;
+            if (v + 1 >= sizeof(label->value)) return false;
+            label->value[v++] = *p++;
+        }
+        label->value[v] = '\0';
+        p++;
+        parsed->count++;
+
+        skip_spaces(&p);
+        if (*p == ',') {
+            p++;
+            skip_spaces(&p);
+        } else if (*p != '}') {
+            return false;
+        }
+    }
+    p++;
+    skip_spaces(&p);
+    if (*p != '\0') {
+        return false;
+    }
+
+    // Ordine canonico per chiave; una chiave non può ripetersi
+    qsort(parsed->labels, parsed->count, sizeof(ParsedLabel), compare_labels);
+    for (int i = 1; i < parsed->count; i++) {
+        if (strcmp(parsed->labels[i - 1].key, parsed->labels[i].key) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool labels_canonicalize(const char* name, char* out, size_t size) {
+    ParsedName parsed;
+    if (!parse_name(name, &parsed) || parsed.family[0] == '\0') {
+        return false;
+    }
+
+    StrBuf canonical;
+    strbuf_init(&canonical);
+    strbuf_append(&canonical, parsed.family, strlen(parsed.family));
+    for (int i = 0; i < parsed.count; i++) {
+        strbuf_appendf(&canonical, "%c%s=\"", i ? ',' : '{', parsed.labels[i].key);
+        for (const char* c = parsed.labels[i].value; *c; c++) {
+            if (*c == '"' || *c == '\\') strbuf_append(&canonical, "\\", 1);
+            strbuf_append(&canonical, c, 1);
+        }
+        strbuf_append(&canonical, i + 1 < parsed.count ? "\"" : "\"}", i + 1 < parsed.count ? 1 : 2);
+    }
+
+    bool fits = canonical.length < size;
+    if (fits) {
+        memcpy(out, canonical.data, canonical.length + 1);
+    }
+    strbuf_free(&canonical);
+    return fits;
+}
+
+static uint64_t pair_hash(const char* key, const char* value) {
+    uint64_t hash = hash_string(key);
+    return (hash ^ 0x3d) * 1099511628211ULL ^ hash_string(value);
+}
+
+static Entry* table_first(const Table* table, uint64_t hash) {
+    return table->buckets ? table->buckets[hash & table->mask] : NULL;
+}
+
+static bool table_insert(Table* table, Entry* entry) {
+    if (!table->buckets || table->count > table->mask) {
+        uint32_t size = table->buckets ? (table->mask + 1) * 2 : 1024;
+        Entry** buckets = calloc(size, sizeof(Entry*));
+        if (!buckets) {
+            return false;
+        }
+        for (uint32_t b = 0; table->buckets && b <= table->mask; b++) {
+            Entry* e = table->buckets[b];
+            while (e) {
+                Entry* next = e->next;
+                e->next = buckets[e->hash & (size - 1)];
+                buckets[e->hash & (size - 1)] = e;
+                e = next;
+            }
+        }
+        free(table->buckets);
+        table->buckets = buckets;
+        table->mask = size - 1;
+    }
+
+    entry->next = table->buckets[entry->hash & table->mask];
+    table->buckets[entry->hash & table->mask] = entry;
+    table->count++;
+    return true;
+}
+
+static Pair* find_pair(const char* key, const char* value) {
+    uint64_t hash = pair_hash(key, value);
+    for (Entry* e = table_first(&pairs_table, hash); e; e = e->next) {
+        Pair* pair = (Pair*)e;
+        if (e->hash == hash && strcmp(pair->key, key) == 0 && strcmp(pair->value, value) == 0) {
+            return pair;
+        }
+    }
+    return NULL;
+}
+
+static Pair* intern_pair(const char* key, const char* value) {
+    Pair* pair = find_pair(key, value);
+    if (pair) {
+        return pair;
+    }
+
+    pair = calloc(1, sizeof(Pair));
+    if (!pair) {
+        return NULL;
+    }
+    pair->key = strdup(key);
+    pair->value = strdup(value);
+    pair->entry.hash = pair_hash(key, value);
+    if (!pair->key || !pair->value || !table_insert(&pairs_table, &pair->entry)) {
+        free(pair->key);
+        free(pair->value);
+        free(pair);
+        return NULL;
+    }
+    return pair;
+}
+
+static LabelSet* intern_set(Pair** pairs, int count) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < count; i++) {
+        hash = (hash ^ (uintptr_t)pairs[i]) * 1099511628211ULL;
+    }
+
+    for (Entry* e = table_first(&sets_table, hash); e; e = e->next) {
+        LabelSet* set = (LabelSet*)e;
+        if (e->hash == hash && set->count == count &&
+            memcmp(set->pairs, pairs, count * sizeof(Pair*)) == 0) {
+            return set;
+        }
+    }
+
+    LabelSet* set = malloc(sizeof(LabelSet) + count * sizeof(Pair*));
+    if (!set) {
+        return NULL;
+    }
+    set->entry.hash = hash;
+    set->count = count;
+    memcpy(set->pairs, pairs, count * sizeof(Pair*));
+    if (!table_insert(&sets_table, &set->entry)) {
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+// Gli id sono assegnati in ordine crescente, quindi le liste restano ordinate
+static bool add_posting(Pair* pair, metric_id_t id) {
+    if (pair->count == pair->capacity) {
+        uint32_t capacity = pair->capacity ? pair->capacity * 2 : 4;
+        metric_id_t* postings = realloc(pair->postings, capacity * sizeof(metric_id_t));
+        if (!postings) return false;
+        pair->postings = postings;
+        pair->capacity = capacity;
+    }
+    pair->postings[pair->count++] = id;
+    return true;
+}
+
+void labels_index(metric_id_t id, const char* canonical_name) {
+    ParsedName parsed;
+    if (strchr(canonical_name, '{')) {
+        if (!parse_name(canonical_name, &parsed)) return;
+    } else {
+        // Nome semplice: indicizzato solo per famiglia
+        snprintf(parsed.family, sizeof(parsed.family), "%s", canonical_name);
+        parsed.count = 0;
+    }
+
+    pthread_rwlock_wrlock(&labels_lock);
+
+    Pair* family = intern_pair(FAMILY_KEY, parsed.family);
+    if (family) {
+        add_posting(family, id);
+    }
+
+    Pair* pairs[LABELS_MAX];
+    int count = 0;
+    for (int i = 0; i < parsed.count; i++) {
+        Pair* pair = intern_pair(parsed.labels[i].key, parsed.labels[i].value);
+        if (pair && add_posting(pair, id)) {
+            pairs[count++] = pair;
+        }
+    }
+
+    if (count > 0) {
+        uint32_t chunk = id / METRICS_CHUNK_SIZE;
+        if (!set_chunks[chunk]) {
+            set_chunks[chunk] = calloc(METRICS_CHUNK_SIZE, sizeof(LabelSet*));
+        }
+        if (set_chunks[chunk]) {
+            set_chunks[chunk][id % METRICS_CHUNK_SIZE] = intern_set(pairs, count);
+        }
+    }
+
+    pthread_rwlock_unlock(&labels_lock);
+}
+
+static int compare_by_count(const void* a, const void* b) {
+    uint32_t ca = (*(Pair* const*)a)->count, cb = (*(Pair* const*)b)->count;
+    return ca < cb ? -1 : ca > cb;
+}
+
+// Primo indice in [from, count) con postings[i] >= id
+static uint32_t lower_bound(const Pair* pair, uint32_t from, metric_id_t id) {
+    uint32_t low = from, high = pair->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (pair->postings[mid] < id) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+int labels_select(const char* selector, metric_id_t** ids) {
+    ParsedName parsed;
+    *ids = NULL;
+    if (!parse_name(selector, &parsed) || (parsed.family[0] == '\0' && parsed.count == 0)) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&labels_lock);
+
+    Pair* lists[LABELS_MAX + 1];
+    int num_lists = 0;
+    bool empty = false;
+    if (parsed.family[0]) {
+        lists[num_lists] = find_pair(FAMILY_KEY, parsed.family);
+        empty |= !lists[num_lists++];
+    }
+    for (int i = 0; i < parsed.count; i++) {
+        lists[num_lists] = find_pair(parsed.labels[i].key, parsed.labels[i].value);
+        empty |= !lists[num_lists++];
+    }
+
+    int count = 0;
+    if (!empty) {
+        // Si parte dalla lista più corta e la si filtra con le altre
+        qsort(lists, num_lists, sizeof(Pair*), compare_by_count);
+        *ids = malloc((lists[0]->count ? lists[0]->count : 1) * sizeof(metric_id_t));
+        if (*ids) {
+            uint32_t cursor[LABELS_MAX + 1] = {0};
+            for (uint32_t i = 0; i < lists[0]->count; i++) {
+                metric_id_t id = lists[0]->postings[i];
+                bool match = true;
+                for (int l = 1; l < num_lists && match; l++) {
+                    cursor[l] = lower_bound(lists[l], cursor[l], id);
+                    match = cursor[l] < lists[l]->count && lists[l]->postings[cursor[l]] == id;
+                }
+                if (match) {
+                    (*ids)[count++] = id;
+                }
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&labels_lock);
+    return count;
+}
+
+int labels_get(metric_id_t id, Label* out, int max) {
+    int count = 0;
+    pthread_rwlock_rdlock(&labels_lock);
+
+    LabelSet** sets = set_chunks[id / METRICS_CHUNK_SIZE];
+    LabelSet* set = sets ? sets[id % METRICS_CHUNK_SIZE] : NULL;
+    for (int i = 0; set && i < set->count && count < max; i++) {
+        out[count].key = set->pairs[i]->key;
+        out[count].value = set->pairs[i]->value;
+        count++;
+    }
+
+    pthread_rwlock_unlock(&labels_lock);
+    return count;
+}
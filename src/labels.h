@@ -0,0 +1,35 @@
+// labels.h
+#ifndef LABELS_H
+#define LABELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "metrics.h"
+
+#define LABELS_MAX 16          // Etichette massime per serie
+#define LABELS_NAME_MAX 512    // Lunghezza massima di un nome canonico
+
+// Etichetta chiave="valore" di una serie
+typedef struct {
+    const char* key;
+    const char* value;
+} Label;
+
+// Riscrive "famiglia{k="v",...}" in forma canonica: etichette ordinate per
+// chiave, senza spazi. Un nome senza etichette resta invariato.
+bool labels_canonicalize(const char* name, char* out, size_t size);
+
+// Indicizza una serie appena registrata (scrittore del registro)
+void labels_index(metric_id_t id, const char* canonical_name);
+
+// Seleziona le serie che corrispondono a "famiglia", "famiglia{k="v"}" o
+// "{k="v",...}" intersecando le liste degli id per etichetta.
+// Restituisce il numero di id (ordinati, da liberare) o -1 se il selettore
+// non è valido.
+int labels_select(const char* selector, metric_id_t** ids);
+
+// Etichette di una serie (stringhe internate, valide per sempre);
+// restituisce il numero di etichette scritte in out
+int labels_get(metric_id_t id, Label* out, int max);
+
+#endif
@@ -0,0 +1,398 @@
+// lineproto.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "lineproto.h"
+#include "labels.h"
+#include "metrics.h"
+
+// Righe interpretate da tutte le fonti, per la diagnostica
+static _Atomic uint64_t lines_accepted = 0;
+static _Atomic uint64_t lines_rejected = 0;
+
+// Metriche create da righe ricevute dalla rete (POST /api/write)
+static _Atomic int remote_created = 0;
+
+// Potenze di 10 rappresentabili esattamente in un double
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define IS_DIGIT(c) ((unsigned)((c) - '0') < 10)
+#define IS_BLANK(c) ((c) == ' ' || (c) == '\t')
+
+// Numero decimale [+-]cifre[.cifre][e[+-]cifre] letto in una sola passata.
+// Restituisce il primo carattere dopo il numero, NULL se il testo non
+// inizia con un numero valido. Con al più 19 cifre significative e un
+// esponente entro ±22 il risultato è esatto senza strtod, che resta per
+// i casi rari.
+static const char* parse_number(const char* text, double* value) {
+    const char* p = text;
+    bool negative = false;
+    if (*p == '+' || *p == '-') {
+        negative = *p++ == '-';
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;      // Cifre significative accumulate
+    int exponent = 0;
+    bool truncated = false;
+    bool any = false;
+
+    for (; IS_DIGIT(*p); p++, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            digits += mantissa != 0;
+        } else {
+            exponent++;
+            truncated |= *p != '0';
+        }
+    }
+    if (*p == '.') {
+        for (p++; IS_DIGIT(*p); p++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            } else {
+                truncated |= *p != '0';
+            }
+        }
+    }
+    if (!any) {
+        return NULL;
+    }
+
+    if (*p == 'e' || *p == 'E') {
+        const char* e = p + 1;
+        bool exp_negative = false;
+        if (*e == '+' || *e == '-') {
+            exp_negative = *e++ == '-';
+        }
+        if (!IS_DIGIT(*e)) {
+            return NULL;
+        }
+        int exp_value = 0;
+        for (; IS_DIGIT(*e); e++) {
+            if (exp_value < 10000) {
+                exp_value = exp_value * 10 + (*e - '0');
+            }
+        }
+        exponent += exp_negative ? -exp_value : exp_value;
+        p = e;
+    }
+
+    if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double result = (double)mantissa;
+        result = exponent < 0 ? result / exact_powers_of_ten[-exponent]
+                              : result * exact_powers_of_ten[exponent];
+        *value = negative ? -result : result;
+        return p;
+    }
+
+    // Molte cifre o esponenti grandi: la conversione corretta la fa strtod,
+    // che consuma esattamente lo stesso testo già validato
+    char* end;
+    *value = strtod(text, &end);
+    return end == p ? p : NULL;
+}
+
+// Trova il '=' che separa nome e valore, saltando quelli tra le etichette
+// di nomi come disk_used{dev="sda"}
+static char* find_separator(char* line) {
+    // Caso comune, senza etichette prima del primo '=': basta strchr
+    char* equals = strchr(line, '=');
+    if (!equals || !memchr(line, '{', equals - line)) {
+        return equals;
+    }
+
+    bool in_labels = false, in_quotes = false;
+    for (char* p = line; *p; p++) {
+        if (in_quotes) {
+            if (*p == '\\' && p[1]) p++;
+            else if (*p == '"') in_quotes = false;
+        } else if (*p == '"' && in_labels) {
+            in_quotes = true;
+        } else if (*p == '{') {
+            in_labels = true;
+        } else if (*p == '}') {
+            in_labels = false;
+        } else if (*p == '=' && !in_labels) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Primo carattere c non preceduto da '\' e fuori da etichette e virgolette
+static char* find_unescaped(char* p, char c) {
+    bool in_labels = false, in_quotes = false;
+    for (; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        } else if (*p == '"') {
+            in_quotes = !in_quotes;
+        } else if (in_quotes) {
+            continue;
+        } else if (*p == '{') {
+            in_labels = true;
+        } else if (*p == '}') {
+            in_labels = false;
+        } else if (*p == c && !in_labels) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Formato nativo: nome=valore[unità]. Dopo il '=' la riga viene letta una
+// sola volta; valori come "15G" o "2,66" sono rifiutati, non troncati.
+// Scrive un valore. Le righe remote possono creare al più
+// LINEPROTO_REMOTE_MAX_METRICS metriche: oltre, una metrica nuova viene
+// rifiutata e restituisce false.
+static bool store_value(const char* name, double value, const char* unit, bool remote) {
+    if (remote && metrics_find(name) == METRIC_ID_INVALID) {
+        if (atomic_fetch_add_explicit(&remote_created, 1, memory_order_relaxed) >= LINEPROTO_REMOTE_MAX_METRICS) {
+            atomic_fetch_sub_explicit(&remote_created, 1, memory_order_relaxed);
+            static _Atomic bool warned = false;
+            if (!atomic_exchange(&warned, true)) {
+                fprintf(stderr, "Scrittura remota: raggiunto il limite di %d metriche, le nuove vengono rifiutate\n",
+                        LINEPROTO_REMOTE_MAX_METRICS);
+            }
+            return false;
+        }
+    }
+    metrics_set_with_unit(name, value, unit);
+    return true;
+}
+
+static int parse_native(char* line, bool remote) {
+    // Cerca il separatore '=' (fuori dalle etichette)
+    char* separator = find_separator(line);
+    if (!separator || separator == line) return -1;
+
+    const char* p = separator + 1;
+    while (IS_BLANK(*p)) p++;
+
+    double value;
+    p = parse_number(p, &value);
+    if (!p) return -1;
+    while (IS_BLANK(*p)) p++;
+
+    // Unità di misura facoltativa tra parentesi quadre
+    const char* unit = "";
+    if (*p == '[') {
+        char* unit_end = strchr(p + 1, ']');
+        if (!unit_end) return -1;
+        *unit_end = '\0';
+        unit = p + 1;
+        p = unit_end + 1;
+        while (IS_BLANK(*p)) p++;
+    }
+    if (*p != '\0') return -1;
+
+    *separator = '\0';
+    return store_value(line, value, unit, remote) ? 1 : -1;
+}
+
+// Copia togliendo gli escape del line protocol ("\," "\ " "\=");
+// con quote true protegge '"' e '\' come nei valori delle etichette
+static size_t copy_unescaped(char* out, size_t size, size_t length, const char* text, bool quote) {
+    for (; *text && length + 2 < size; text++) {
+        if (*text == '\\' && text[1]) {
+            text++;
+        }
+        if (quote && (*text == '"' || *text == '\\')) {
+            out[length++] = '\\';
+        }
+        out[length++] = *text;
+    }
+    out[length] = '\0';
+    return length;
+}
+
+// Valore di un campo: numeri (anche interi con suffisso i/u) e booleani;
+// le stringhe non sono metriche
+static bool parse_field_value(const char* text, double* value) {
+    if (*text == '"' || *text == '\0') {
+        return false;
+    }
+    if (strcmp(text, "t") == 0 || strcmp(text, "T") == 0 || strcmp(text, "true") == 0 ||
+        strcmp(text, "True") == 0 || strcmp(text, "TRUE") == 0) {
+        *value = 1;
+        return true;
+    }
+    if (strcmp(text, "f") == 0 || strcmp(text, "F") == 0 || strcmp(text, "false") == 0 ||
+        strcmp(text, "False") == 0 || strcmp(text, "FALSE") == 0) {
+        *value = 0;
+        return true;
+    }
+
+    const char* end = parse_number(text, value);
+    return end && (*end == '\0' || ((*end == 'i' || *end == 'u') && end[1] == '\0'));
+}
+
+// Line protocol: misura[,tag=v...] campo=valore[,...] [timestamp].
+// I tag diventano etichette; il campo "value" dà il nome della misura, gli
+// altri "misura.campo". Il timestamp viene ignorato: vale l'ora di arrivo.
+// Una riga senza campi numerici non scrive nulla ed è quindi non valida.
+static int parse_influx(char* line, char* space, bool remote) {
+    *space = '\0';
+    char* fields = space + 1;
+    char* timestamp = find_unescaped(fields, ' ');
+    if (timestamp) {
+        *timestamp = '\0';
+    }
+
+    // Misura ed etichette
+    char* tags = find_unescaped(line, ',');
+    if (tags) {
+        *tags++ = '\0';
+    }
+    char measurement[LABELS_NAME_MAX];
+    copy_unescaped(measurement, sizeof(measurement), 0, line, false);
+    if (measurement[0] == '\0') {
+        return -1;
+    }
+
+    char labels[LABELS_NAME_MAX] = "";
+    size_t labels_length = 0;
+    while (tags && *tags) {
+        char* next = find_unescaped(tags, ',');
+        if (next) {
+            *next++ = '\0';
+        }
+        char* equals = find_unescaped(tags, '=');
+        if (!equals) {
+            return -1;
+        }
+        *equals = '\0';
+
+        if (labels_length + 2 >= sizeof(labels)) {
+            return -1;
+        }
+        labels[labels_length] = labels_length == 0 ? '{' : ',';
+        labels_length++;
+        labels_length = copy_unescaped(labels, sizeof(labels), labels_length, tags, false);
+        labels_length = copy_unescaped(labels, sizeof(labels), labels_length, "=\"", false);
+        labels_length = copy_unescaped(labels, sizeof(labels), labels_length, equals + 1, true);
+        labels_length = copy_unescaped(labels, sizeof(labels), labels_length, "\"", false);
+        tags = next;
+    }
+    if (labels_length > 0) {
+        copy_unescaped(labels, sizeof(labels), labels_length, "}", false);
+    }
+
+    // Campi
+    int stored = 0;
+    while (fields && *fields) {
+        char* next = find_unescaped(fields, ',');
+        if (next) {
+            *next++ = '\0';
+        }
+        char* equals = find_unescaped(fields, '=');
+        if (!equals) {
+            return -1;
+        }
+        *equals = '\0';
+
+        double value;
+        if (parse_field_value(equals + 1, &value)) {
+            char key[LABELS_NAME_MAX];
+            copy_unescaped(key, sizeof(key), 0, fields, false);
+
+            // Un nome troncato potrebbe coincidere con quello di un'altra serie
+            char name[LABELS_NAME_MAX];
+            int length = strcmp(key, "value") == 0
+                ? snprintf(name, sizeof(name), "%s%s", measurement, labels)
+                : snprintf(name, sizeof(name), "%s.%s%s", measurement, key, labels);
+            if (length < 0 || (size_t)length >= sizeof(name)) {
+                return -1;
+            }
+            if (!store_value(name, value, "", remote)) {
+                return -1;
+            }
+            stored++;
+        }
+        fields = next;
+    }
+
+    return stored > 0 ? stored : -1;
+}
+
+// length è la lunghezza di line, già nota a chi divide il blocco
+static int parse_line(char* line, size_t length, bool remote) {
+    // Salta linee vuote e commenti
+    if (line[0] == '\0' || line[0] == '\r' || line[0] == '#') {
+        return 0;
+    }
+
+    // Toglie il ritorno a capo delle righe CRLF
+    if (line[length - 1] == '\r') {
+        line[--length] = '\0';
+    }
+
+    // Le righe native di solito non hanno spazi: memchr evita la scansione
+    // carattere per carattere
+    char* space = memchr(line, ' ', length) ? find_unescaped(line, ' ') : NULL;
+    if (space && strchr(space + 1, '=')) {
+        return parse_influx(line, space, remote);
+    }
+    return parse_native(line, remote);
+}
+
+int lineproto_parse_line(char* line) {
+    int result = parse_line(line, strlen(line), false);
+    if (result > 0) {
+        atomic_fetch_add_explicit(&lines_accepted, 1, memory_order_relaxed);
+    } else if (result < 0) {
+        atomic_fetch_add_explicit(&lines_rejected, 1, memory_order_relaxed);
+    }
+    return result;
+}
+
+static int parse_block(char* data, size_t length, int* rejected, bool remote) {
+    int accepted = 0;
+    int invalid = 0;
+
+    // memchr trova i fine riga con le istruzioni vettoriali della libc
+    metrics_batch_begin();
+    char* end = data + length;
+    while (data < end) {
+        char* newline = memchr(data, '\n', end - data);
+        char* line_end = newline ? newline : end;
+        *line_end = '\0';
+
+        int result = parse_line(data, line_end - data, remote);
+        if (result > 0) {
+            accepted++;
+        } else if (result < 0) {
+            invalid++;
+        }
+        data = line_end + 1;
+    }
+    metrics_batch_end();
+
+    atomic_fetch_add_explicit(&lines_accepted, (uint64_t)accepted, memory_order_relaxed);
+    atomic_fetch_add_explicit(&lines_rejected, (uint64_t)invalid, memory_order_relaxed);
+    if (rejected) {
+        *rejected = invalid;
+    }
+    return accepted;
+}
+
+int lineproto_parse_block(char* data, size_t length, int* rejected) {
+    return parse_block(data, length, rejected, false);
+}
+
+int lineproto_parse_remote(char* data, size_t length, int* rejected) {
+    return parse_block(data, length, rejected, true);
+}
+
+void lineproto_get_stats(uint64_t* accepted, uint64_t* rejected) {
+    *accepted = atomic_load_explicit(&lines_accepted, memory_order_relaxed);
+    *rejected = atomic_load_explicit(&lines_rejected, memory_order_relaxed);
+}
@@ -0,0 +1,31 @@
+// lineproto.h
+#ifndef LINEPROTO_H
+#define LINEPROTO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LINEPROTO_REMOTE_MAX_METRICS 4096  // Metriche che le scritture remote possono creare
+
+// Interpreta una riga e aggiorna le metriche. Sono accettati due formati:
+//   nome=valore[unità]                           (anche con etichette: nome{k="v"}=1)
+//   misura[,tag=v...] campo=valore[,...] [ts]    (line protocol di InfluxDB)
+// Una riga è in formato Influx se dopo il primo spazio (fuori dalle
+// etichette) c'è un campo chiave=valore. La riga viene modificata.
+// Restituisce il numero di valori scritti, 0 per righe vuote e commenti,
+// -1 per righe non valide.
+int lineproto_parse_line(char* line);
+
+// Interpreta tutte le righe di un blocco in un unico batch; restituisce
+// il numero di righe accettate e, se rejected non è NULL, quelle scartate
+int lineproto_parse_block(char* data, size_t length, int* rejected);
+
+// Come lineproto_parse_block, per righe ricevute dalla rete: quelle che
+// creerebbero una metrica oltre LINEPROTO_REMOTE_MAX_METRICS sono scartate
+int lineproto_parse_remote(char* data, size_t length, int* rejected);
+
+// Totale delle righe accettate e scartate da tutte le fonti
+void lineproto_get_stats(uint64_t* accepted, uint64_t* rejected);
+
+#endif
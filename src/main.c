@@ -8,6 +8,16 @@
 #include <getopt.h>
 #include "server.h"
 #include "metrics.h"
+#include "publisher.h"
+#include "history.h"
+#include "stats.h"
+#include "alerts.h"
+#include "expr.h"
+#include "sources.h"
+#include "statsd.h"
+#include "shmexport.h"
+#include "lineproto.h"
+#include "tokens.h"
 
 static volatile int running = 1;
 
@@ -17,8 +27,44 @@ void signal_handler(int signum) {
     }
 }
 
-// Variabile per la fonte delle metriche
-static char metrics_source[256] = "sim:1:100";  // Default: simulazione
+// Fonti delle metriche (--metrics-source, ripetibile); senza fonti si usa la simulazione
+#define DEFAULT_METRICS_SOURCE "sim:1:100"
+static char** metrics_sources = NULL;
+static int num_metrics_sources = 0;
+
+// Capacità dei livelli di storico
+static HistoryConfig history_config = {
+    .capacity = { HISTORY_DEFAULT_RAW, HISTORY_DEFAULT_MINUTE, HISTORY_DEFAULT_HOUR },
+    .data_dir = "",
+    .sync_interval = HISTORY_DEFAULT_SYNC,
+    .metrics = ""
+};
+
+// Metriche di cui calcolare le statistiche e ampiezza della finestra
+static char stats_metrics[1024] = "";
+static int stats_window_seconds = STATS_DEFAULT_WINDOW;
+
+// Definizioni delle metriche derivate (--derive, ripetibile)
+static char** derive_definitions = NULL;
+static int num_derive_definitions = 0;
+
+// Listener StatsD (--statsd-port, 0 = disabilitato) e intervallo di aggregazione
+static int statsd_port = 0;
+static int statsd_flush_ms = STATSD_DEFAULT_FLUSH_MS;
+
+// File in cui esportare la tabella delle metriche per i lettori locali
+static char export_path[256] = "";
+
+// File con la chiave di firma dei token, condivisa tra le istanze
+static char token_key_path[256] = "";
+
+// File con la chiave che autorizza POST /api/write ("" = scritture disabilitate)
+static char write_key_path[256] = "";
+
+// --issue-token: metriche del token da stampare per un client senza pagina
+// (NULL = avvia il server) e sua validità in secondi
+static const char* issue_token_metrics = NULL;
+static long long issue_token_ttl = TOKEN_TTL;
 
 // Funzione per il parsing dei parametri da riga di comando
 void parse_command_line(int argc, char* argv[]) {
@@ -29,12 +75,28 @@ void parse_command_line(int argc, char* argv[]) {
         {"buffer-size", required_argument, 0, 'b'},
         {"www-root", required_argument, 0, 'w'},
         {"metrics-source", required_argument, 0, 'm'},
+        {"fanout-threads", required_argument, 0, 't'},
+        {"history", required_argument, 0, 'H'},
+        {"history-metrics", required_argument, 0, 'M'},
+        {"data-dir", required_argument, 0, 'd'},
+        {"history-sync", required_argument, 0, 'S'},
+        {"stats", required_argument, 0, 's'},
+        {"stats-window", required_argument, 0, 'W'},
+        {"thresholds", required_argument, 0, 'T'},
+        {"derive", required_argument, 0, 'D'},
+        {"statsd-port", required_argument, 0, 'u'},
+        {"statsd-flush", required_argument, 0, 'F'},
+        {"export-shm", required_argument, 0, 'e'},
+        {"token-key", required_argument, 0, 'k'},
+        {"write-key", required_argument, 0, 'K'},
+        {"issue-token", required_argument, 0, 'i'},
+        {"token-ttl", required_argument, 0, 'l'},
         {"verbose", no_argument, 0, 'v'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "p:c:b:w:m:vh", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "p:c:b:w:m:t:H:M:d:S:s:W:T:D:u:F:e:k:K:i:l:vh", long_options, NULL)) != -1) {
         switch (opt) {
             case 'p':
                 server_config.port = atoi(optarg);
@@ -49,9 +111,85 @@ void parse_command_line(int argc, char* argv[]) {
                 strncpy(server_config.www_root, optarg, sizeof(server_config.www_root) - 1);
                 server_config.www_root[sizeof(server_config.www_root) - 1] = '\0';
                 break;
-            case 'm':
-                strncpy(metrics_source, optarg, sizeof(metrics_source) - 1);
-                metrics_source[sizeof(metrics_source) - 1] = '\0';
+            case 'm': {
+                char** sources = realloc(metrics_sources, (num_metrics_sources + 1) * sizeof(char*));
+                if (!sources) {
+                    perror("Errore nell'allocazione delle fonti delle metriche");
+                    exit(1);
+                }
+                metrics_sources = sources;
+                metrics_sources[num_metrics_sources++] = optarg;
+                break;
+            }
+            case 't':
+                server_config.fanout_threads = atoi(optarg);
+                break;
+            case 'H':
+                if (sscanf(optarg, "%u:%u:%u", &history_config.capacity[HISTORY_TIER_RAW],
+                           &history_config.capacity[HISTORY_TIER_MINUTE],
+                           &history_config.capacity[HISTORY_TIER_HOUR]) != 3) {
+                    fprintf(stderr, "Formato dello storico non valido: %s (atteso RAW:MIN:ORE)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'M':
+                strncpy(history_config.metrics, optarg, sizeof(history_config.metrics) - 1);
+                history_config.metrics[sizeof(history_config.metrics) - 1] = '\0';
+                break;
+            case 'd':
+                strncpy(history_config.data_dir, optarg, sizeof(history_config.data_dir) - 1);
+                history_config.data_dir[sizeof(history_config.data_dir) - 1] = '\0';
+                break;
+            case 'S':
+                history_config.sync_interval = atoi(optarg);
+                break;
+            case 's':
+                strncpy(stats_metrics, optarg, sizeof(stats_metrics) - 1);
+                stats_metrics[sizeof(stats_metrics) - 1] = '\0';
+                break;
+            case 'W':
+                stats_window_seconds = atoi(optarg);
+                break;
+            case 'T':
+                // Soglie globali: valgono per le pagine che non ne definiscono di proprie
+                if (!alerts_parse_thresholds(optarg, "--thresholds")) {
+                    exit(1);
+                }
+                break;
+            case 'D': {
+                char** definitions = realloc(derive_definitions, (num_derive_definitions + 1) * sizeof(char*));
+                if (!definitions) {
+                    perror("Errore nell'allocazione delle metriche derivate");
+                    exit(1);
+                }
+                derive_definitions = definitions;
+                derive_definitions[num_derive_definitions++] = optarg;
+                break;
+            }
+            case 'u':
+                statsd_port = atoi(optarg);
+                break;
+            case 'F':
+                statsd_flush_ms = atoi(optarg);
+                break;
+            case 'e':
+                strncpy(export_path, optarg, sizeof(export_path) - 1);
+                export_path[sizeof(export_path) - 1] = '\0';
+                break;
+            case 'k':
+                strncpy(token_key_path, optarg, sizeof(token_key_path) - 1);
+                token_key_path[sizeof(token_key_path) - 1] = '\0';
+                break;
+            case 'K':
+                strncpy(write_key_path, optarg, sizeof(write_key_path) - 1);
+                write_key_path[sizeof(write_key_path) - 1] = '\0';
+                break;
+            case 'i':
+                // "*" come in --stats e --history-metrics: tutte le metriche
+                issue_token_metrics = strcmp(optarg, "*") == 0 ? "" : optarg;
+                break;
+            case 'l':
+                issue_token_ttl = atoll(optarg);
                 break;
             case 'v':
                 server_config.verbose = true;
@@ -63,8 +201,41 @@ void parse_command_line(int argc, char* argv[]) {
                 printf("  -c, --max-clients=NUM      Numero massimo di client (default: %d)\n", DEFAULT_MAX_CLIENTS);
                 printf("  -b, --buffer-size=SIZE     Dimensione del buffer (default: %d)\n", DEFAULT_BUFFER_SIZE);
                 printf("  -w, --www-root=PATH        Directory radice per i file statici (default: %s)\n", DEFAULT_WWW_ROOT);
-                printf("  -m, --metrics-source=SRC   Fonte delle metriche (default: sim:1:100)\n");
-                printf("                             Formati: sim:inc:base, file:path, cmd:command\n");
+                printf("  -m, --metrics-source=SRC   Fonte delle metriche (default: %s), ripetibile\n", DEFAULT_METRICS_SOURCE);
+                printf("                             Formati: sim:inc:base, file:path, tail:path, cmd:command,\n");
+                printf("                             stream:command, proc:[cpu,memory,...], shm:/nome,\n");
+                printf("                             upstream:ws://host:porta/[#prefisso];\n");
+                printf("                             @intervallo in ms, s o m (es. cmd:x@10s)\n");
+                printf("  -t, --fanout-threads=NUM   Thread di invio ai client (default: uno per CPU)\n");
+                printf("  -H, --history=RAW:MIN:ORE  Punti di storico per metrica: campioni, minuti, ore\n");
+                printf("                             (default: %d:%d:%d, 0 disabilita il livello)\n",
+                       HISTORY_DEFAULT_RAW, HISTORY_DEFAULT_MINUTE, HISTORY_DEFAULT_HOUR);
+                printf("  -M, --history-metrics=LISTA  Metriche di cui tenere lo storico (nomi o\n");
+                printf("                             famiglie separate da virgole, * per tutte;\n");
+                printf("                             default: nessuna)\n");
+                printf("  -d, --data-dir=PATH        Directory in cui rendere persistente lo storico\n");
+                printf("  -S, --history-sync=SEC     Secondi tra due sincronizzazioni su disco (default: %d)\n",
+                       HISTORY_DEFAULT_SYNC);
+                printf("  -s, --stats=LISTA          Metriche di cui calcolare media, min, max, velocità\n");
+                printf("                             e percentili (separate da virgole, * per tutte)\n");
+                printf("  -W, --stats-window=SEC     Finestra delle statistiche in secondi (default: %d)\n",
+                       STATS_DEFAULT_WINDOW);
+                printf("  -T, --thresholds=SOGLIE    Soglie di allarme metrica:warning:critical[:isteresi],...\n");
+                printf("                             (per le pagine HTML senza soglie proprie)\n");
+                printf("  -D, --derive=NOME=ESPR     Metrica derivata, es. \"mem_pct[%%]=memory/mem_total*100\"\n");
+                printf("                             (ripetibile; operatori + - * / e min, max, abs)\n");
+                printf("  -u, --statsd-port=PORTA    Porta UDP su cui ricevere pacchetti StatsD\n");
+                printf("  -F, --statsd-flush=MS      Intervallo di aggregazione StatsD (default: %d)\n",
+                       STATSD_DEFAULT_FLUSH_MS);
+                printf("  -e, --export-shm=PATH      Esporta la tabella delle metriche in un file mappato\n");
+                printf("                             (es. /dev/shm/swsws.metrics) per i lettori locali\n");
+                printf("  -k, --token-key=FILE       Chiave di firma dei token, la stessa per tutte le istanze\n");
+                printf("                             (default: chiave casuale valida solo per questo processo)\n");
+                printf("  -K, --write-key=FILE       Chiave richiesta da POST /api/write in\n");
+                printf("                             \"Authorization: Bearer\" (default: scritture disabilitate)\n");
+                printf("  -i, --issue-token=LISTA    Stampa un token per le metriche indicate (* per tutte),\n");
+                printf("                             firmato con --token-key, ed esce: per i client senza pagina\n");
+                printf("  -l, --token-ttl=SEC        Validità del token di --issue-token (default: %d)\n", TOKEN_TTL);
                 printf("  -v, --verbose              Abilita i messaggi di log dettagliati\n");
                 printf("  -h, --help                 Mostra questo messaggio di aiuto\n");
                 exit(0);
@@ -76,6 +247,56 @@ void parse_command_line(int argc, char* argv[]) {
     }
 }
 
+// Stampa un token per un client senza pagina (--issue-token) ed esce. Il
+// token vale solo per le istanze con la stessa chiave, che va quindi letta
+// da file: una chiave casuale morirebbe con questo processo.
+static void print_token(void) {
+    if (!token_key_path[0]) {
+        fprintf(stderr, "--issue-token richiede --token-key, la chiave delle istanze\n");
+        exit(1);
+    }
+    if (issue_token_ttl <= 0) {
+        fprintf(stderr, "Validità del token non valida: %lld\n", issue_token_ttl);
+        exit(1);
+    }
+    if (!tokens_init(token_key_path)) {
+        exit(1);
+    }
+    
+    char token[TOKEN_MAX];
+    int64_t expires;
+    if (!token_issue(issue_token_metrics, issue_token_ttl, token, sizeof(token), &expires)) {
+        fprintf(stderr, "Elenco di metriche troppo lungo per un token\n");
+        exit(1);
+    }
+    printf("%s\n", token);
+    exit(0);
+}
+
+// Stampa le statistiche di latenza delle fasi di pubblicazione
+static void print_publisher_stats(void) {
+    PublisherStats stats;
+    publisher_get_stats(&stats);
+    
+    printf("Pubblicazione: %llu eventi, %llu accorpati, %llu invii\n",
+           (unsigned long long)stats.events,
+           (unsigned long long)stats.dropped,
+           (unsigned long long)stats.publications);
+    
+    uint64_t accepted, rejected;
+    lineproto_get_stats(&accepted, &rejected);
+    printf("Righe di metriche: %llu accettate, %llu scartate\n",
+           (unsigned long long)accepted, (unsigned long long)rejected);
+    
+    for (int i = 0; i < PUB_STAGE_COUNT; i++) {
+        printf("  %-10s media %8.3f ms  max %8.3f ms  (%llu campioni)\n",
+               publisher_stage_name(i),
+               stats.stages[i].avg_ns / 1e6,
+               stats.stages[i].max_ns / 1e6,
+               (unsigned long long)stats.stages[i].count);
+    }
+}
+
 int main(int argc, char* argv[]) {
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
@@ -83,10 +304,72 @@ int main(int argc, char* argv[]) {
     // Parsing dei parametri da riga di comando
     parse_command_line(argc, argv);
     
+    if (issue_token_metrics) {
+        print_token();
+    }
+    
     printf("Starting SWSWS (Simple Embedded Web Server)\n");
     
-    // Inizializza il sistema di metriche
+    // Inizializza il sistema di metriche e lo storico
     metrics_init();
+    if (!history_init(&history_config)) {
+        fprintf(stderr, "Errore nell'inizializzazione dello storico\n");
+        exit(1);
+    }
+    
+    if (stats_metrics[0] && !stats_init(stats_metrics, stats_window_seconds)) {
+        fprintf(stderr, "Errore nell'inizializzazione delle statistiche\n");
+        exit(1);
+    }
+    
+    // Le soglie vengono lette una volta dalle pagine e valutate dal server
+    int pages = alerts_load_from_www(server_config.www_root);
+    
+    // Le metriche derivate vengono compilate una volta e ricalcolate a ogni batch;
+    // vanno registrate dopo soglie e statistiche, che si associano alla registrazione
+    for (int i = 0; i < num_derive_definitions; i++) {
+        if (!expr_define(derive_definitions[i])) {
+            exit(1);
+        }
+    }
+    if (!expr_finalize()) {
+        exit(1);
+    }
+    
+    // Le fonti vengono controllate prima di avviare il server
+    if (num_metrics_sources == 0 && !sources_add(DEFAULT_METRICS_SOURCE)) {
+        exit(1);
+    }
+    for (int i = 0; i < num_metrics_sources; i++) {
+        if (!sources_add(metrics_sources[i])) {
+            exit(1);
+        }
+    }
+    
+    if (server_config.verbose) {
+        printf("Soglie di allarme lette da %d pagine\n", pages);
+        printf("Storico: %zu byte per metrica\n", history_bytes_per_metric());
+    }
+    
+    // I token delle pagine sono firmati: senza chiave condivisa valgono
+    // solo per questa istanza
+    if (!tokens_init(token_key_path[0] ? token_key_path : NULL)) {
+        exit(1);
+    }
+    if (write_key_path[0] && !tokens_init_write_key(write_key_path)) {
+        exit(1);
+    }
+    
+    // La tabella esportata viene scritta dal thread di pubblicazione
+    if (export_path[0] && !shmexport_open(export_path)) {
+        exit(1);
+    }
+    
+    // Avvia il thread che serializza e invia gli aggiornamenti ai client
+    if (!publisher_start()) {
+        fprintf(stderr, "Errore nell'avvio del thread di pubblicazione\n");
+        exit(1);
+    }
     
     // Avvia il server in un thread separato
     pthread_t server_thread;
@@ -98,21 +381,44 @@ int main(int argc, char* argv[]) {
     // Attendi un momento per permettere al server di avviarsi
     sleep(1);
     
-    // Avvia l'acquisizione delle metriche
-    if (!metrics_start_collection(metrics_source)) {
+    // Avvia l'acquisizione delle metriche: un solo thread per tutte le fonti
+    if (!sources_start()) {
         fprintf(stderr, "Errore nell'avvio dell'acquisizione delle metriche\n");
         exit(1);
     }
     
-    printf("Acquisizione metriche avviata da: %s\n", metrics_source);
+    if (statsd_port > 0) {
+        if (!statsd_start(statsd_port, statsd_flush_ms)) {
+            fprintf(stderr, "Errore nell'avvio del listener StatsD\n");
+            exit(1);
+        }
+        printf("Listener StatsD in ascolto sulla porta UDP %d\n", statsd_port);
+    }
+    
+    for (int i = 0; i < num_metrics_sources; i++) {
+        printf("Acquisizione metriche avviata da: %s\n", metrics_sources[i]);
+    }
+    if (num_metrics_sources == 0) {
+        printf("Acquisizione metriche avviata da: %s\n", DEFAULT_METRICS_SOURCE);
+    }
     
     // Loop principale
+    int ticks = 0;
     while (running) {
         sleep(1);
+        
+        // In modalità verbose mostra periodicamente le latenze della pipeline
+        if (server_config.verbose && ++ticks % 10 == 0) {
+            print_publisher_stats();
+        }
     }
     
     // Pulizia
-    metrics_stop_collection();
+    statsd_stop();
+    sources_stop();
+    publisher_stop();
+    shmexport_close();
+    history_shutdown();
     
     printf("\nShutting down...\n");
     return 0;
@@ -4,373 +4,648 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include "metrics.h"
+#include "publisher.h"
+#include "history.h"
+#include "stats.h"
+#include "alerts.h"
+#include "expr.h"
+#include "labels.h"
+#include "utils.h"
 
-// Dati delle metriche
-static Metrics current_metrics = {.count = 0};  // Inizializza con count = 0
+#define STRING_ARENA_BLOCK 65536  // Dimensione dei blocchi dell'arena delle stringhe
+#define SNAPSHOT_RETRIES 8        // Tentativi senza lock prima di copiare con il lock degli scrittori
+#define HISTORY_QUEUE 256         // Campioni dello storico rinviati alla fine di una scrittura
 
+// Valori e versioni (dati caldi), contigui e mai spostati dopo l'allocazione
+typedef struct {
+    _Atomic double values[METRICS_CHUNK_SIZE];
+    _Atomic uint64_t versions[METRICS_CHUNK_SIZE];  // 0 = registrata ma mai aggiornata
+} HotChunk;
+
+// Nomi e unità (dati freddi), letti solo da serializzatori e ricerche
+typedef struct {
+    const char* names[METRICS_CHUNK_SIZE];
+    uint64_t hashes[METRICS_CHUNK_SIZE];
+    _Atomic(const char*) units[METRICS_CHUNK_SIZE];
+} ColdChunk;
+
+// Indice per nome a indirizzamento aperto: ogni slot contiene id + 1 (0 = vuoto)
+typedef struct HashIndex {
+    uint32_t mask;
+    struct HashIndex* retired;  // Tabella precedente, ancora leggibile da lettori in corso
+    _Atomic uint32_t slots[];
+} HashIndex;
+
+// Blocco dell'arena in cui vengono internate le stringhe
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;
+    char data[STRING_ARENA_BLOCK];
+} ArenaBlock;
+
+// Dati delle metriche: i blocchi vengono allocati una volta e mai liberati,
+// quindi gli id restano stabili e i lettori non vedono mai memoria spostata
+static _Atomic(HotChunk*) hot_chunks[METRICS_MAX_CHUNKS];
+static _Atomic(ColdChunk*) cold_chunks[METRICS_MAX_CHUNKS];
+static _Atomic uint32_t metric_count = 0;
+static _Atomic(HashIndex*) name_index = NULL;
+
+// Arena delle stringhe internate e unità già note
+static ArenaBlock* arena = NULL;
+static const char** known_units = NULL;
+static int num_known_units = 0;
+
+// Il mutex serializza solo gli scrittori tra loro. I lettori non prendono
+// lock: usano il contatore di sequenza (seqlock), dispari durante una
+// scrittura, e ripetono la copia se è cambiato nel frattempo.
+// Ogni scrittura completata incrementa la sequenza di 2: la metà è la
+// generazione delle metriche.
 static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic uint64_t metrics_seq = 0;
 
-// Callback per le notifiche di aggiornamento
-static metrics_callback_t update_callback = NULL;
+// Stato del batch di aggiornamento del thread corrente
+static _Thread_local int batch_depth = 0;
+static _Thread_local bool batch_dirty = false;
+static _Thread_local uint64_t batch_start_ns = 0;
 
-// Thread di acquisizione
-static pthread_t collection_thread;
-static volatile bool collection_running = false;
-static char collection_source[256] = "";
+// Campioni dello storico raccolti nella sezione di scrittura del thread
+// corrente: si registrano dopo write_end, così un lettore HTTP che tiene
+// il lock di una serie non trattiene la sequenza dispari
+typedef struct {
+    metric_id_t id;
+    int64_t ts_ms;
+    double value;
+} HistorySample;
 
-// Inizializza il sistema di metriche
-void metrics_init(void) {
-    pthread_mutex_lock(&metrics_mutex);
-    current_metrics.count = 0;  // Inizializza il contatore delle metriche a zero
-    pthread_mutex_unlock(&metrics_mutex);
+static _Thread_local HistorySample history_queue[HISTORY_QUEUE];
+static _Thread_local int history_queued = 0;
+
+// Copia una stringa nell'arena (chiamata con il lock degli scrittori)
+static const char* intern_string(const char* str) {
+    size_t length = strlen(str) + 1;
+    if (length > STRING_ARENA_BLOCK) {
+        return NULL;
+    }
+    
+    if (!arena || arena->used + length > STRING_ARENA_BLOCK) {
+        ArenaBlock* block = malloc(sizeof(ArenaBlock));
+        if (!block) {
+            return NULL;
+        }
+        block->next = arena;
+        block->used = 0;
+        arena = block;
+    }
+    
+    char* copy = arena->data + arena->used;
+    memcpy(copy, str, length);
+    arena->used += length;
+    return copy;
 }
 
-// Registra un callback per l'aggiornamento delle metriche
-void metrics_register_callback(metrics_callback_t callback) {
-    update_callback = callback;
+// Restituisce l'unità internata, creandola se è nuova (con il lock degli scrittori)
+static const char* intern_unit(const char* unit) {
+    for (int i = 0; i < num_known_units; i++) {
+        if (strcmp(known_units[i], unit) == 0) {
+            return known_units[i];
+        }
+    }
+    
+    const char** units = realloc(known_units, (num_known_units + 1) * sizeof(const char*));
+    if (!units) {
+        return NULL;
+    }
+    known_units = units;
+    
+    const char* copy = intern_string(unit);
+    if (copy) {
+        known_units[num_known_units++] = copy;
+    }
+    return copy;
 }
 
-// Aggiorna le metriche con nuovi valori (per compatibilità con il vecchio codice)
-void metrics_update(int value1, int value2) {
-    // Aggiorna le metriche usando i nuovi nomi
-    metrics_set("value1", value1);
-    metrics_set("value2", value2);
+static inline HotChunk* hot_chunk(metric_id_t id) {
+    return atomic_load_explicit(&hot_chunks[id / METRICS_CHUNK_SIZE], memory_order_acquire);
 }
 
-// Ottieni i valori correnti delle metriche
-void metrics_get(Metrics* metrics) {
-    pthread_mutex_lock(&metrics_mutex);
-    *metrics = current_metrics;
-    pthread_mutex_unlock(&metrics_mutex);
+static inline ColdChunk* cold_chunk(metric_id_t id) {
+    return atomic_load_explicit(&cold_chunks[id / METRICS_CHUNK_SIZE], memory_order_acquire);
 }
 
-// Aggiorna una metrica specifica con unità di misura
-void metrics_set_with_unit(const char* name, double value, const char* unit) {
-    pthread_mutex_lock(&metrics_mutex);
+// Inserisce un id nell'indice senza controllarne la capacità
+static void index_insert(HashIndex* index, metric_id_t id, uint64_t hash) {
+    uint32_t slot = (uint32_t)hash & index->mask;
+    while (atomic_load_explicit(&index->slots[slot], memory_order_relaxed) != 0) {
+        slot = (slot + 1) & index->mask;
+    }
+    atomic_store_explicit(&index->slots[slot], id + 1, memory_order_release);
+}
+
+// Raddoppia l'indice quando supera il 50% di riempimento.
+// La tabella precedente non viene liberata, perché un lettore potrebbe
+// ancora scorrerla: la memoria trattenuta resta inferiore a quella attiva.
+static bool index_grow(uint32_t count) {
+    HashIndex* old = atomic_load_explicit(&name_index, memory_order_relaxed);
+    uint32_t size = old ? old->mask + 1 : 1024;
     
-    // Cerca se la metrica esiste già
-    for (int i = 0; i < current_metrics.count; i++) {
-        if (strcmp(current_metrics.metrics[i].name, name) == 0) {
-            current_metrics.metrics[i].value = value;
-            
-            // Aggiorna l'unità di misura se specificata
-            if (unit && *unit) {
-                strncpy(current_metrics.metrics[i].unit, unit, sizeof(current_metrics.metrics[i].unit) - 1);
-                current_metrics.metrics[i].unit[sizeof(current_metrics.metrics[i].unit) - 1] = '\0';
-            }
-            
-            // Notifica tramite callback se registrato
-            if (update_callback) {
-                update_callback(&current_metrics);
-            }
-            
-            pthread_mutex_unlock(&metrics_mutex);
-            return;
-        }
+    if (old && (count + 1) * 2 <= size) {
+        return true;
+    }
+    while ((count + 1) * 2 > size) {
+        size *= 2;
     }
     
-    // Se non esiste e c'è spazio, aggiungila
-    if (current_metrics.count < MAX_METRICS) {
-        strncpy(current_metrics.metrics[current_metrics.count].name, name, sizeof(current_metrics.metrics[0].name) - 1);
-        current_metrics.metrics[current_metrics.count].name[sizeof(current_metrics.metrics[0].name) - 1] = '\0';
-        current_metrics.metrics[current_metrics.count].value = value;
-        
-        // Imposta l'unità di misura se specificata
-        if (unit && *unit) {
-            strncpy(current_metrics.metrics[current_metrics.count].unit, unit, sizeof(current_metrics.metrics[0].unit) - 1);
-            current_metrics.metrics[current_metrics.count].unit[sizeof(current_metrics.metrics[0].unit) - 1] = '\0';
-        } else {
-            current_metrics.metrics[current_metrics.count].unit[0] = '\0';  // Unità vuota
+    HashIndex* index = calloc(1, sizeof(HashIndex) + size * sizeof(_Atomic uint32_t));
+    if (!index) {
+        return false;
+    }
+    index->mask = size - 1;
+    index->retired = old;
+    
+    for (metric_id_t id = 0; id < count; id++) {
+        index_insert(index, id, cold_chunk(id)->hashes[id % METRICS_CHUNK_SIZE]);
+    }
+    
+    atomic_store_explicit(&name_index, index, memory_order_release);
+    return true;
+}
+
+// Cerca un nome esatto nell'indice senza prendere lock
+static metric_id_t find_exact(const char* name) {
+    HashIndex* index = atomic_load_explicit(&name_index, memory_order_acquire);
+    if (!index) {
+        return METRIC_ID_INVALID;
+    }
+    
+    uint64_t hash = hash_string(name);
+    uint32_t slot = (uint32_t)hash & index->mask;
+    
+    for (;;) {
+        uint32_t entry = atomic_load_explicit(&index->slots[slot], memory_order_acquire);
+        if (entry == 0) {
+            return METRIC_ID_INVALID;
         }
         
-        current_metrics.count++;
+        metric_id_t id = entry - 1;
+        ColdChunk* cold = cold_chunk(id);
+        if (cold->hashes[id % METRICS_CHUNK_SIZE] == hash &&
+            strcmp(cold->names[id % METRICS_CHUNK_SIZE], name) == 0) {
+            return id;
+        }
         
-        // Notifica tramite callback se registrato
-        if (update_callback) {
-            update_callback(&current_metrics);
+        slot = (slot + 1) & index->mask;
+    }
+}
+
+// Cerca una metrica per nome senza prendere lock; i nomi con etichette
+// scritti in forma non canonica vengono normalizzati solo se non trovati
+metric_id_t metrics_find(const char* name) {
+    metric_id_t id = find_exact(name);
+    if (id == METRIC_ID_INVALID && strchr(name, '{')) {
+        char canonical[LABELS_NAME_MAX];
+        if (labels_canonicalize(name, canonical, sizeof(canonical)) && strcmp(canonical, name) != 0) {
+            id = find_exact(canonical);
         }
     }
+    return id;
+}
+
+// Registra una nuova metrica (chiamata con il lock degli scrittori)
+static metric_id_t register_metric_locked(const char* name) {
+    metric_id_t id = metrics_find(name);
+    if (id != METRIC_ID_INVALID) {
+        return id;
+    }
     
-    pthread_mutex_unlock(&metrics_mutex);
+    uint32_t count = atomic_load_explicit(&metric_count, memory_order_relaxed);
+    if (count >= METRICS_CHUNK_SIZE * METRICS_MAX_CHUNKS) {
+        return METRIC_ID_INVALID;
+    }
+    
+    // Alloca il blocco quando si entra in un nuovo intervallo di id
+    uint32_t chunk = count / METRICS_CHUNK_SIZE;
+    if (!atomic_load_explicit(&hot_chunks[chunk], memory_order_relaxed)) {
+        HotChunk* hot = calloc(1, sizeof(HotChunk));
+        ColdChunk* cold = calloc(1, sizeof(ColdChunk));
+        if (!hot || !cold) {
+            free(hot);
+            free(cold);
+            return METRIC_ID_INVALID;
+        }
+        atomic_store_explicit(&cold_chunks[chunk], cold, memory_order_release);
+        atomic_store_explicit(&hot_chunks[chunk], hot, memory_order_release);
+    }
+    
+    const char* interned = intern_string(name);
+    if (!interned || !index_grow(count)) {
+        return METRIC_ID_INVALID;
+    }
+    
+    id = count;
+    ColdChunk* cold = cold_chunk(id);
+    uint64_t hash = hash_string(name);
+    cold->names[id % METRICS_CHUNK_SIZE] = interned;
+    cold->hashes[id % METRICS_CHUNK_SIZE] = hash;
+    atomic_store_explicit(&cold->units[id % METRICS_CHUNK_SIZE], "", memory_order_relaxed);
+    
+    alerts_attach(id, name);
+    labels_index(id, name);
+    
+    // Prima si rende visibile l'id, poi lo si inserisce nell'indice
+    atomic_store_explicit(&metric_count, count + 1, memory_order_release);
+    index_insert(atomic_load_explicit(&name_index, memory_order_relaxed), id, hash);
+    return id;
 }
 
-// Aggiorna una metrica specifica
-void metrics_set(const char* name, int value) {
-    pthread_mutex_lock(&metrics_mutex);
+// Registra le metriche derivate "<nome>.<campo>" delle statistiche di una metrica
+static void register_stats_locked(metric_id_t id, const char* name) {
+    metric_id_t derived[STATS_FIELD_COUNT];
+    char derived_name[LABELS_NAME_MAX];
     
-    // Cerca se la metrica esiste già
-    for (int i = 0; i < current_metrics.count; i++) {
-        if (strcmp(current_metrics.metrics[i].name, name) == 0) {
-            current_metrics.metrics[i].value = value;
-            
-            // Notifica tramite callback se registrato
-            if (update_callback) {
-                update_callback(&current_metrics);
-            }
-            
-            pthread_mutex_unlock(&metrics_mutex);
+    for (int f = 0; f < STATS_FIELD_COUNT; f++) {
+        stats_metric_name(name, f, derived_name, sizeof(derived_name));
+        derived[f] = register_metric_locked(derived_name);
+        if (derived[f] == METRIC_ID_INVALID) {
             return;
         }
     }
     
-    // Se non esiste e c'è spazio, aggiungila
-    if (current_metrics.count < MAX_METRICS) {
-        strncpy(current_metrics.metrics[current_metrics.count].name, name, sizeof(current_metrics.metrics[0].name) - 1);
-        current_metrics.metrics[current_metrics.count].name[sizeof(current_metrics.metrics[0].name) - 1] = '\0';
-        current_metrics.metrics[current_metrics.count].value = value;
-        current_metrics.count++;
-        
-        // Notifica tramite callback se registrato
-        if (update_callback) {
-            update_callback(&current_metrics);
+    if (!stats_track(id, derived)) {
+        fprintf(stderr, "Impossibile allocare le statistiche della metrica %s\n", name);
+    }
+}
+
+// Registra una metrica e, se richiesto, le sue statistiche (con il lock degli scrittori).
+// Le etichette vengono riscritte in forma canonica, così ogni serie ha un solo nome.
+static metric_id_t register_locked(const char* name) {
+    char canonical[LABELS_NAME_MAX];
+    if (strchr(name, '{')) {
+        metric_id_t id = find_exact(name);
+        if (id != METRIC_ID_INVALID) {
+            return id;
+        }
+        if (!labels_canonicalize(name, canonical, sizeof(canonical))) {
+            return METRIC_ID_INVALID;
         }
+        name = canonical;
     }
     
-    pthread_mutex_unlock(&metrics_mutex);
+    uint32_t count = atomic_load_explicit(&metric_count, memory_order_relaxed);
+    metric_id_t id = register_metric_locked(name);
+    
+    if (id == count && stats_should_track(name)) {
+        register_stats_locked(id, name);
+    }
+    return id;
 }
-// Funzione per leggere le metriche da un file
-static bool read_metrics_from_file(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        return false;
+
+// Aggiorna l'unità di una metrica (chiamata con il lock degli scrittori)
+static void set_unit_locked(metric_id_t id, const char* unit) {
+    ColdChunk* cold = cold_chunk(id);
+    const char* current = atomic_load_explicit(&cold->units[id % METRICS_CHUNK_SIZE], memory_order_relaxed);
+    
+    if (strcmp(current, unit) == 0) {
+        return;
     }
     
-    char line[256];
-    bool success = false;
+    const char* interned = intern_unit(unit);
+    if (interned) {
+        atomic_store_explicit(&cold->units[id % METRICS_CHUNK_SIZE], interned, memory_order_release);
+    }
     
-    while (fgets(line, sizeof(line), file)) {
-        // Rimuovi newline
-        char* newline = strchr(line, '\n');
-        if (newline) *newline = '\0';
-        
-        // Salta linee vuote e commenti
-        if (line[0] == '\0' || line[0] == '#') continue;
-        
-        // Cerca il separatore '='
-        char* separator = strchr(line, '=');
-        if (!separator) continue;
-        
-        // Dividi nome e valore
-        *separator = '\0';
-        char* name = line;
-        char* value_str = separator + 1;
-        
-        // Cerca l'unità di misura tra parentesi quadre
-        char* unit = NULL;
-        char* unit_start = strchr(value_str, '[');
-        if (unit_start) {
-            *unit_start = '\0';  // Termina il valore prima dell'unità
-            unit_start++;  // Salta la parentesi quadra
-            
-            char* unit_end = strchr(unit_start, ']');
-            if (unit_end) {
-                *unit_end = '\0';  // Termina l'unità
-                unit = unit_start;
-            }
+    // Le statistiche hanno la stessa unità; la velocità è per secondo
+    metric_id_t derived[STATS_FIELD_COUNT];
+    if (stats_derived(id, derived)) {
+        char rate_unit[128];
+        snprintf(rate_unit, sizeof(rate_unit), "%s/s", unit);
+        for (int f = 0; f < STATS_FIELD_COUNT; f++) {
+            set_unit_locked(derived[f], f == STATS_RATE && *unit ? rate_unit : unit);
         }
-        
-        // Converti il valore in double
-        double value = atof(value_str);
-        
-        // Aggiorna la metrica con l'unità di misura
-        metrics_set_with_unit(name, value, unit ? unit : "");
-        success = true;
     }
-    
-    fclose(file);
-    return success;
 }
 
-// Funzione per leggere le metriche da una pipe
-static bool read_metrics_from_pipe(const char* command) {
-    FILE* pipe = popen(command, "r");
-    if (!pipe) {
-        return false;
+// Apre una scrittura: da qui i lettori vedono una sequenza dispari
+static void write_begin(void) {
+    pthread_mutex_lock(&metrics_mutex);
+    uint64_t seq = atomic_load_explicit(&metrics_seq, memory_order_relaxed);
+    atomic_store_explicit(&metrics_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+// Pubblica la scrittura con una nuova generazione, poi registra nello
+// storico i campioni raccolti durante la scrittura
+static void write_end(void) {
+    uint64_t seq = atomic_load_explicit(&metrics_seq, memory_order_relaxed);
+    atomic_store_explicit(&metrics_seq, seq + 1, memory_order_release);
+    pthread_mutex_unlock(&metrics_mutex);
+    
+    for (int i = 0; i < history_queued; i++) {
+        history_record(history_queue[i].id, history_queue[i].ts_ms, history_queue[i].value);
     }
+    history_queued = 0;
+}
+
+// Scrive un campione nel registro (tra write_begin e write_end) e lo
+// accoda per lo storico
+static void store_sample_locked(metric_id_t id, double value, int64_t ts_ms) {
+    HotChunk* hot = hot_chunk(id);
+    uint64_t generation = (atomic_load_explicit(&metrics_seq, memory_order_relaxed) + 1) >> 1;
     
-    char line[256];
-    bool success = false;
+    atomic_store_explicit(&hot->values[id % METRICS_CHUNK_SIZE], value, memory_order_relaxed);
+    atomic_store_explicit(&hot->versions[id % METRICS_CHUNK_SIZE], generation, memory_order_release);
+    batch_dirty = true;
     
-    while (fgets(line, sizeof(line), pipe)) {
-        // Rimuovi newline
-        char* newline = strchr(line, '\n');
-        if (newline) *newline = '\0';
-        
-        // Salta linee vuote e commenti
-        if (line[0] == '\0' || line[0] == '#') continue;
-        
-        // Cerca il separatore '='
-        char* separator = strchr(line, '=');
-        if (!separator) continue;
-        
-        // Dividi nome e valore
-        *separator = '\0';
-        char* name = line;
-        char* value_str = separator + 1;
-        
-        // Cerca l'unità di misura tra parentesi quadre
-        char* unit = NULL;
-        char* unit_start = strchr(value_str, '[');
-        if (unit_start) {
-            *unit_start = '\0';  // Termina il valore prima dell'unità
-            unit_start++;  // Salta la parentesi quadra
-            
-            char* unit_end = strchr(unit_start, ']');
-            if (unit_end) {
-                *unit_end = '\0';  // Termina l'unità
-                unit = unit_start;
-            }
+    if (history_tracked(id)) {
+        if (history_queued < HISTORY_QUEUE) {
+            history_queue[history_queued++] = (HistorySample){ id, ts_ms, value };
+        } else {
+            // Coda piena, solo con ricalcoli di centinaia di derivate: si
+            // registra subito piuttosto che perdere il campione
+            history_record(id, ts_ms, value);
         }
-        
-        // Converti il valore in double
-        double value = atof(value_str);
-        
-        // Aggiorna la metrica con l'unità di misura
-        metrics_set_with_unit(name, value, unit ? unit : "");
-        success = true;
     }
-    
-    pclose(pipe);
-    return success;
+    alerts_evaluate(id, ts_ms, value);
+    expr_mark_dirty(id);
 }
 
-// Thread di acquisizione delle metriche
-static void* metrics_collection_thread(void* arg) {
-    const char* source = (const char*)arg;
+// Scrive il valore di una metrica con il suo istante e ne aggiorna le
+// statistiche (tra write_begin e write_end)
+static void store_value_at_locked(metric_id_t id, double value, int64_t ts_ms) {
+    store_sample_locked(id, value, ts_ms);
     
-    while (collection_running) {
-        bool success = false;
-        
-        // Determina il tipo di fonte
-        if (strncmp(source, "file:", 5) == 0) {
-            // Leggi da file
-            success = read_metrics_from_file(source + 5);
-        } else if (strncmp(source, "cmd:", 4) == 0) {
-            // Leggi da comando
-            success = read_metrics_from_pipe(source + 4);
-        } else if (strncmp(source, "sim:", 4) == 0) {
-            // Simulazione
-            static int counter = 0;
-            counter = (counter + 1) % 1000;
-            
-            metrics_set("cpu", counter);
-            metrics_set("memory", 100 + (counter % 50));
-            metrics_set("disk", 200 + (counter % 30));
-            metrics_set("network", 300 + (counter % 70));
-            
-            success = true;
+    // Le statistiche sono calcolate una volta qui, non da ogni client
+    StatsOutput stats;
+    if (stats_update(id, ts_ms, value, &stats)) {
+        for (int f = 0; f < STATS_FIELD_COUNT; f++) {
+            store_sample_locked(stats.ids[f], stats.values[f], ts_ms);
         }
-        
-        // Attendi prima del prossimo aggiornamento
-        sleep(1);
     }
-    
-    return NULL;
 }
 
-// Avvia il thread di acquisizione delle metriche
-bool metrics_start_collection(const char* source) {
-    if (collection_running) {
-        return false;  // Già in esecuzione
+// Scrive il valore di una metrica all'istante corrente
+static void store_value_locked(metric_id_t id, double value) {
+    store_value_at_locked(id, value, wall_clock_ms());
+}
+
+// Inizializza il sistema di metriche
+void metrics_init(void) {
+    pthread_mutex_lock(&metrics_mutex);
+    index_grow(0);
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+// Registra un callback per l'aggiornamento delle metriche.
+// Il callback viene invocato dal thread di pubblicazione, mai dai collector.
+void metrics_register_callback(metrics_callback_t callback) {
+    publisher_set_callback(callback);
+}
+
+// Aggiorna le metriche con nuovi valori (per compatibilità con il vecchio codice)
+void metrics_update(int value1, int value2) {
+    // Aggiorna le metriche usando i nuovi nomi
+    metrics_batch_begin();
+    metrics_set("value1", value1);
+    metrics_set("value2", value2);
+    metrics_batch_end();
+}
+
+// Registra una metrica senza valore; compare nelle copie solo dopo il primo aggiornamento.
+// La registrazione avviene fuori dalla sezione di scrittura: i lettori
+// senza lock non attendono mai allocazioni o file.
+metric_id_t metrics_register(const char* name, const char* unit) {
+    metric_id_t id = metrics_find(name);
+    if (id != METRIC_ID_INVALID && !(unit && *unit)) {
+        return id;
     }
     
-    strncpy(collection_source, source, sizeof(collection_source) - 1);
-    collection_source[sizeof(collection_source) - 1] = '\0';
+    pthread_mutex_lock(&metrics_mutex);
+    uint32_t first = atomic_load_explicit(&metric_count, memory_order_relaxed);
+    id = register_locked(name);
+    if (id != METRIC_ID_INVALID && unit && *unit) {
+        set_unit_locked(id, unit);
+    }
+    uint32_t last = atomic_load_explicit(&metric_count, memory_order_relaxed);
+    pthread_mutex_unlock(&metrics_mutex);
     
-    collection_running = true;
+    // Lo storico delle metriche nuove (comprese le loro statistiche) può
+    // mappare file: lo si crea anche fuori dal lock degli scrittori
+    for (metric_id_t created = first; created < last; created++) {
+        history_attach(created, metrics_name(created));
+    }
     
-    if (pthread_create(&collection_thread, NULL, metrics_collection_thread, collection_source) != 0) {
-        collection_running = false;
+    return id;
+}
+
+// Numero di metriche registrate (gli id vanno da 0 a count - 1)
+uint32_t metrics_count(void) {
+    return atomic_load_explicit(&metric_count, memory_order_acquire);
+}
+
+// Nome internato di una metrica
+const char* metrics_name(metric_id_t id) {
+    if (id >= metrics_count()) {
+        return NULL;
+    }
+    return cold_chunk(id)->names[id % METRICS_CHUNK_SIZE];
+}
+
+// Unità internata di una metrica
+const char* metrics_unit(metric_id_t id) {
+    if (id >= metrics_count()) {
+        return NULL;
+    }
+    return atomic_load_explicit(&cold_chunk(id)->units[id % METRICS_CHUNK_SIZE], memory_order_acquire);
+}
+
+// Legge il valore di una metrica senza lock; false se mai aggiornata
+bool metrics_read(metric_id_t id, double* value, uint64_t* version) {
+    if (id >= metrics_count()) {
+        return false;
+    }
+    
+    HotChunk* hot = hot_chunk(id);
+    uint64_t v = atomic_load_explicit(&hot->versions[id % METRICS_CHUNK_SIZE], memory_order_acquire);
+    if (v == 0) {
         return false;
     }
     
+    *value = atomic_load_explicit(&hot->values[id % METRICS_CHUNK_SIZE], memory_order_relaxed);
+    if (version) {
+        *version = v;
+    }
     return true;
 }
 
-// Ferma il thread di acquisizione delle metriche
-void metrics_stop_collection(void) {
-    if (!collection_running) {
-        return;
-    }
+// Copia le metriche aggiornate almeno una volta nel buffer della copia
+static void copy_metrics(Metrics* metrics, uint32_t count) {
+    metrics->count = 0;
     
-    collection_running = false;
-    pthread_join(collection_thread, NULL);
+    for (metric_id_t id = 0; id < count; id++) {
+        Metric* m = &metrics->metrics[metrics->count];
+        if (!metrics_read(id, &m->value, &m->version)) {
+            continue;
+        }
+        ColdChunk* cold = cold_chunk(id);
+        m->id = id;
+        m->name = cold->names[id % METRICS_CHUNK_SIZE];
+        m->unit = atomic_load_explicit(&cold->units[id % METRICS_CHUNK_SIZE], memory_order_acquire);
+        metrics->count++;
+    }
 }
 
-static TokenMetrics* tokens = NULL;
-static int num_tokens = 0;
-static pthread_mutex_t tokens_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Porta il buffer della copia ad almeno count metriche
+static bool reserve_snapshot(Metrics* metrics, uint32_t count) {
+    if ((uint32_t)metrics->capacity < count) {
+        Metric* buffer = realloc(metrics->metrics, count * sizeof(Metric));
+        if (!buffer) {
+            metrics->count = 0;
+            return false;
+        }
+        metrics->metrics = buffer;
+        metrics->capacity = count;
+    }
+    return true;
+}
 
-// Genera un token casuale
-void generate_random_token(char* token, size_t length) {
-    static const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+// Ottieni i valori correnti delle metriche senza prendere lock.
+// Il buffer di metrics viene riutilizzato e ingrandito se necessario:
+// va inizializzato a zero e liberato con metrics_free().
+void metrics_get(Metrics* metrics) {
+    for (int attempt = 0; attempt < SNAPSHOT_RETRIES; attempt++) {
+        uint64_t before = atomic_load_explicit(&metrics_seq, memory_order_acquire);
+        if (before & 1) {
+            // Scrittura in corso: le sezioni critiche sono brevi
+            sched_yield();
+            continue;
+        }
+        
+        uint32_t count = metrics_count();
+        if (!reserve_snapshot(metrics, count)) {
+            return;
+        }
+        
+        copy_metrics(metrics, count);
+        
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t after = atomic_load_explicit(&metrics_seq, memory_order_relaxed);
+        if (before == after) {
+            metrics->generation = before >> 1;
+            return;
+        }
+    }
     
-    for (size_t i = 0; i < length - 1; i++) {
-        int index = rand() % (sizeof(charset) - 1);
-        token[i] = charset[index];
+    // Con aggiornamenti continui la copia senza lock può non riuscire mai:
+    // si copia escludendo gli scrittori, così la generazione corrisponde
+    // davvero ai valori copiati
+    pthread_mutex_lock(&metrics_mutex);
+    uint32_t count = metrics_count();
+    if (reserve_snapshot(metrics, count)) {
+        copy_metrics(metrics, count);
+        metrics->generation = atomic_load_explicit(&metrics_seq, memory_order_relaxed) >> 1;
     }
-    token[length - 1] = '\0';
+    pthread_mutex_unlock(&metrics_mutex);
 }
 
-// Memorizza l'associazione tra token e metriche
-void store_token_metrics(const char* token, const char* metrics) {
-    pthread_mutex_lock(&tokens_mutex);
-    
-    // Aggiungi un nuovo token
-    tokens = realloc(tokens, (num_tokens + 1) * sizeof(TokenMetrics));
-    strcpy(tokens[num_tokens].token, token);
-    tokens[num_tokens].metrics = strdup(metrics);
-    tokens[num_tokens].expiry = time(NULL) + 3600; // Scade dopo 1 ora
-    num_tokens++;
-    
-    pthread_mutex_unlock(&tokens_mutex);
+// Libera il buffer di una copia delle metriche
+void metrics_free(Metrics* metrics) {
+    free(metrics->metrics);
+    metrics->metrics = NULL;
+    metrics->count = 0;
+    metrics->capacity = 0;
 }
 
-// Ottieni le metriche associate a un token
-bool get_token_metrics(const char* token, char** metrics) {
-    pthread_mutex_lock(&tokens_mutex);
-    
-    bool found = false;
-    time_t now = time(NULL);
+// Generazione corrente: cambia a ogni aggiornamento delle metriche
+uint64_t metrics_generation(void) {
+    return atomic_load_explicit(&metrics_seq, memory_order_acquire) >> 1;
+}
+
+// Inizia un batch di aggiornamenti
+void metrics_batch_begin(void) {
+    if (batch_depth++ == 0) {
+        batch_dirty = false;
+        batch_start_ns = now_ns();
+    }
+}
+
+// Chiude un batch: se qualcosa è cambiato notifica il publisher una sola volta
+void metrics_batch_end(void) {
+    if (batch_depth == 0) {
+        return;
+    }
+
+    if (--batch_depth > 0) {
+        return;
+    }
     
-    for (int i = 0; i < num_tokens; i++) {
-        if (strcmp(tokens[i].token, token) == 0) {
-            if (tokens[i].expiry > now) {
-                // Token valido
-                *metrics = strdup(tokens[i].metrics);
-                found = true;
-            }
-            break;
-        }
+    // Le metriche derivate si aggiornano nello stesso batch, prima della pubblicazione
+    if (expr_pending()) {
+        write_begin();
+        expr_recompute(store_value_locked);
+        write_end();
     }
     
-    pthread_mutex_unlock(&tokens_mutex);
-    return found;
+    if (batch_dirty) {
+        batch_dirty = false;
+        publisher_notify(now_ns() - batch_start_ns);
+    }
 }
 
-// Pulizia periodica dei token scaduti
-void cleanup_expired_tokens() {
-    pthread_mutex_lock(&tokens_mutex);
+// Aggiorna una metrica già registrata tramite il suo id
+void metrics_set_id(metric_id_t id, double value) {
+    if (id >= metrics_count()) {
+        return;
+    }
     
-    time_t now = time(NULL);
-    int i = 0;
+    metrics_batch_begin();
+    write_begin();
+    store_value_locked(id, value);
+    write_end();
+    metrics_batch_end();
+}
+
+// Come metrics_set_id, con l'istante del campione fornito dalla fonte
+void metrics_set_id_at(metric_id_t id, double value, int64_t ts_ms) {
+    if (id >= metrics_count()) {
+        return;
+    }
     
-    while (i < num_tokens) {
-        if (tokens[i].expiry <= now) {
-            // Token scaduto, rimuovilo
-            free(tokens[i].metrics);
-            
-            // Sposta l'ultimo token in questa posizione
-            if (i < num_tokens - 1) {
-                tokens[i] = tokens[num_tokens - 1];
-            }
-            
-            num_tokens--;
-        } else {
-            i++;
+    metrics_batch_begin();
+    write_begin();
+    store_value_at_locked(id, value, ts_ms);
+    write_end();
+    metrics_batch_end();
+}
+
+// Aggiorna una metrica specifica con unità di misura
+void metrics_set_with_unit(const char* name, double value, const char* unit) {
+    // Cerca la metrica tramite l'indice; se non esiste (o cambia unità) la
+    // registra prima di aprire la scrittura
+    metric_id_t id = metrics_find(name);
+    if (id == METRIC_ID_INVALID || (unit && *unit && strcmp(metrics_unit(id), unit) != 0)) {
+        id = metrics_register(name, unit);
+    }
+    if (id == METRIC_ID_INVALID) {
+        static bool warned = false;
+        if (!warned) {
+            fprintf(stderr, "Impossibile registrare la metrica %s: memoria esaurita o limite raggiunto\n", name);
+            warned = true;
         }
+        return;
     }
     
-    pthread_mutex_unlock(&tokens_mutex);
+    metrics_batch_begin();
+    write_begin();
+    store_value_locked(id, value);
+    write_end();
+    
+    // La notifica avviene fuori dal lock, alla chiusura del batch
+    metrics_batch_end();
+}
+
+// Aggiorna una metrica specifica
+void metrics_set(const char* name, int value) {
+    metrics_set_with_unit(name, value, NULL);
 }
@@ -4,30 +4,33 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 
-#define MAX_METRICS 20  // Numero massimo di metriche supportate
+#define METRICS_CHUNK_SIZE 1024  // Metriche per blocco del registro
+#define METRICS_MAX_CHUNKS 1024  // Blocchi massimi (oltre un milione di metriche)
 
+// Identificatore stabile di una metrica nel registro
+typedef uint32_t metric_id_t;
+#define METRIC_ID_INVALID UINT32_MAX
 
 // Struttura per una singola metrica
 typedef struct {
-    char name[64];
+    metric_id_t id;
+    const char* name;   // Stringa internata, valida per tutta la durata del processo
+    const char* unit;   // Unità di misura (%, MB, GB, KB/s, ecc.), internata
     double value;
-    char unit[16];  // Unità di misura (%, MB, GB, KB/s, ecc.)
+    uint64_t version;   // Generazione dell'ultimo aggiornamento
 } Metric;
 
-// Struttura per le metriche
+// Copia delle metriche (il buffer cresce con il registro)
 typedef struct {
-    Metric metrics[MAX_METRICS];
+    Metric* metrics;
     int count;
+    int capacity;
+    uint64_t generation;  // Generazione a cui si riferisce la copia
 } Metrics;
 
-// Struttura per memorizzare i token e le metriche associate
-typedef struct {
-    char token[64];
-    char* metrics;
-    time_t expiry;
-} TokenMetrics;
-
 // Inizializza il sistema di metriche
 void metrics_init(void);
 
@@ -38,23 +41,32 @@ void metrics_register_callback(metrics_callback_t callback);
 // Aggiorna le metriche con nuovi valori
 void metrics_update(int value1, int value2);
 
-// Ottieni i valori correnti delle metriche
+// Ottieni i valori correnti delle metriche (senza lock, copia coerente).
+// metrics va inizializzata a zero e liberata con metrics_free().
 void metrics_get(Metrics* metrics);
+void metrics_free(Metrics* metrics);
 
-// Avvia il thread di acquisizione delle metriche
-bool metrics_start_collection(const char* source);
-
-// Ferma il thread di acquisizione delle metriche
-void metrics_stop_collection(void);
+// Generazione corrente delle metriche: permette di saltare il lavoro
+// quando nulla è cambiato dall'ultima lettura
+uint64_t metrics_generation(void);
 
 void metrics_updated_callback(const Metrics* metrics);
 void metrics_set(const char* name, int value);
 void metrics_set_with_unit(const char* name, double value, const char* unit);
 
-// Token metrics functions
-void generate_random_token(char* token, size_t length);
-void store_token_metrics(const char* token, const char* metrics);
-bool get_token_metrics(const char* token, char** metrics);
-void cleanup_expired_tokens();
+// Accesso al registro tramite id stabili (ricerca per nome in O(1), senza lock)
+metric_id_t metrics_register(const char* name, const char* unit);
+metric_id_t metrics_find(const char* name);
+void metrics_set_id(metric_id_t id, double value);
+void metrics_set_id_at(metric_id_t id, double value, int64_t ts_ms);  // ts_ms: ms dall'epoca Unix
+bool metrics_read(metric_id_t id, double* value, uint64_t* version);
+const char* metrics_name(metric_id_t id);
+const char* metrics_unit(metric_id_t id);
+uint32_t metrics_count(void);
+
+// Raggruppa più aggiornamenti in un'unica notifica al publisher.
+// I batch sono per thread e possono essere annidati.
+void metrics_batch_begin(void);
+void metrics_batch_end(void);
 
 #endif
\ No newline at end of file
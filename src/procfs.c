@@ -0,0 +1,333 @@
+// procfs.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include "procfs.h"
+#include "metrics.h"
+#include "utils.h"
+
+#define PROCFS_MAX_DISKS 8
+#define PROCFS_BUFFER_SIZE 16384  // Basta per /proc/net/dev con molte interfacce
+
+enum {
+    PROC_CPU = 1 << 0,
+    PROC_MEMORY = 1 << 1,
+    PROC_LOAD = 1 << 2,
+    PROC_PROCESSES = 1 << 3,
+    PROC_NETWORK = 1 << 4,
+    PROC_DISK = 1 << 5,
+    PROC_ALL = (1 << 6) - 1
+};
+
+typedef struct {
+    char path[256];
+    metric_id_t id;
+} ProcDisk;
+
+// I descrittori restano aperti e vengono riletti con pread dall'inizio:
+// per i file di /proc ogni lettura dall'offset 0 rigenera il contenuto
+struct ProcFs {
+    unsigned enabled;
+    int stat_fd;
+    int meminfo_fd;
+    int loadavg_fd;
+    int netdev_fd;
+    int proc_dir_fd;
+
+    // Contatori del campione precedente, per le differenze
+    bool has_cpu;
+    uint64_t cpu_total;
+    uint64_t cpu_idle;
+    bool has_network;
+    uint64_t net_rx;
+    uint64_t net_tx;
+    uint64_t net_ns;
+
+    metric_id_t cpu_id, memory_id, mem_total_id, load_id, processes_id;
+    metric_id_t network_id, rx_id, tx_id;
+    ProcDisk disks[PROCFS_MAX_DISKS];
+    int num_disks;
+
+    char buffer[PROCFS_BUFFER_SIZE];
+};
+
+// Voce di una directory restituita da getdents64
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Apre un file di /proc; se manca il gruppo di metriche viene disattivato
+static int open_proc(ProcFs* procfs, const char* path, unsigned group) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Fonte proc: impossibile aprire %s, metriche disattivate\n", path);
+        procfs->enabled &= ~group;
+    }
+    return fd;
+}
+
+// Rilegge un file dall'inizio nel buffer; restituisce la lunghezza letta
+static size_t read_proc(ProcFs* procfs, int fd) {
+    ssize_t length = pread(fd, procfs->buffer, sizeof(procfs->buffer) - 1, 0);
+    if (length <= 0) {
+        return 0;
+    }
+    procfs->buffer[length] = '\0';
+    return length;
+}
+
+// Valore di una riga "Chiave: valore" di /proc/meminfo
+static bool find_field(const char* text, const char* key, uint64_t* value) {
+    size_t key_length = strlen(key);
+    for (const char* line = text; line; line = strchr(line, '\n')) {
+        if (*line == '\n') line++;
+        if (strncmp(line, key, key_length) == 0) {
+            *value = strtoull(line + key_length, NULL, 10);
+            return true;
+        }
+    }
+    return false;
+}
+
+ProcFs* procfs_open(const char* spec) {
+    ProcFs* procfs = calloc(1, sizeof(ProcFs));
+    if (!procfs) {
+        return NULL;
+    }
+    procfs->stat_fd = procfs->meminfo_fd = procfs->loadavg_fd = -1;
+    procfs->netdev_fd = procfs->proc_dir_fd = -1;
+
+    char list[256];
+    snprintf(list, sizeof(list), "%s", spec);
+    char* saveptr = NULL;
+    for (char* item = strtok_r(list, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(item, "cpu") == 0) {
+            procfs->enabled |= PROC_CPU;
+        } else if (strcmp(item, "memory") == 0) {
+            procfs->enabled |= PROC_MEMORY;
+        } else if (strcmp(item, "load") == 0) {
+            procfs->enabled |= PROC_LOAD;
+        } else if (strcmp(item, "processes") == 0) {
+            procfs->enabled |= PROC_PROCESSES;
+        } else if (strcmp(item, "network") == 0) {
+            procfs->enabled |= PROC_NETWORK;
+        } else if (strcmp(item, "disk") == 0 || strncmp(item, "disk=", 5) == 0) {
+            if (procfs->num_disks == PROCFS_MAX_DISKS) {
+                fprintf(stderr, "Fonte proc: troppi dischi (massimo %d)\n", PROCFS_MAX_DISKS);
+                procfs_close(procfs);
+                return NULL;
+            }
+            ProcDisk* disk = &procfs->disks[procfs->num_disks++];
+            snprintf(disk->path, sizeof(disk->path), "%s", item[4] == '=' ? item + 5 : "/");
+            procfs->enabled |= PROC_DISK;
+        } else {
+            fprintf(stderr, "Fonte proc: metrica sconosciuta: %s\n", item);
+            procfs_close(procfs);
+            return NULL;
+        }
+    }
+
+    if (procfs->enabled == 0) {
+        procfs->enabled = PROC_ALL;
+        strcpy(procfs->disks[0].path, "/");
+        procfs->num_disks = 1;
+    }
+
+    if (procfs->enabled & PROC_CPU) {
+        procfs->stat_fd = open_proc(procfs, "/proc/stat", PROC_CPU);
+        procfs->cpu_id = metrics_register("cpu", "%");
+    }
+    if (procfs->enabled & PROC_MEMORY) {
+        procfs->meminfo_fd = open_proc(procfs, "/proc/meminfo", PROC_MEMORY);
+        procfs->memory_id = metrics_register("memory", "MB");
+        procfs->mem_total_id = metrics_register("mem_total", "MB");
+    }
+    if (procfs->enabled & PROC_LOAD) {
+        procfs->loadavg_fd = open_proc(procfs, "/proc/loadavg", PROC_LOAD);
+        procfs->load_id = metrics_register("load", NULL);
+    }
+    if (procfs->enabled & PROC_PROCESSES) {
+        procfs->proc_dir_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (procfs->proc_dir_fd < 0) {
+            fprintf(stderr, "Fonte proc: impossibile aprire /proc, metriche disattivate\n");
+            procfs->enabled &= ~PROC_PROCESSES;
+        }
+        procfs->processes_id = metrics_register("processes", NULL);
+    }
+    if (procfs->enabled & PROC_NETWORK) {
+        procfs->netdev_fd = open_proc(procfs, "/proc/net/dev", PROC_NETWORK);
+        procfs->network_id = metrics_register("network", "KB/s");
+        procfs->rx_id = metrics_register("network.rx", "KB/s");
+        procfs->tx_id = metrics_register("network.tx", "KB/s");
+    }
+
+    // Il disco radice si chiama "disk", gli altri hanno il punto di montaggio come etichetta
+    for (int i = 0; i < procfs->num_disks; i++) {
+        ProcDisk* disk = &procfs->disks[i];
+        char name[300];
+        if (strcmp(disk->path, "/") == 0) {
+            strcpy(name, "disk");
+        } else {
+            snprintf(name, sizeof(name), "disk{mount=\"%s\"}", disk->path);
+        }
+        disk->id = metrics_register(name, "GB");
+    }
+
+    return procfs;
+}
+
+// Utilizzo della CPU dalla differenza dei contatori della riga "cpu" di /proc/stat
+static void collect_cpu(ProcFs* procfs) {
+    if (read_proc(procfs, procfs->stat_fd) == 0 || strncmp(procfs->buffer, "cpu ", 4) != 0) {
+        return;
+    }
+
+    // user nice system idle iowait irq softirq steal
+    uint64_t fields[8] = {0};
+    char* p = procfs->buffer + 4;
+    for (int i = 0; i < 8; i++) {
+        fields[i] = strtoull(p, &p, 10);
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < 8; i++) {
+        total += fields[i];
+    }
+    uint64_t idle = fields[3] + fields[4];
+
+    if (procfs->has_cpu && total > procfs->cpu_total) {
+        uint64_t total_delta = total - procfs->cpu_total;
+        uint64_t idle_delta = idle - procfs->cpu_idle;
+        metrics_set_id(procfs->cpu_id, 100.0 * (total_delta - idle_delta) / total_delta);
+    }
+    procfs->cpu_total = total;
+    procfs->cpu_idle = idle;
+    procfs->has_cpu = true;
+}
+
+// Memoria usata: MemTotal - MemAvailable, in MB
+static void collect_memory(ProcFs* procfs) {
+    uint64_t total, available;
+    if (read_proc(procfs, procfs->meminfo_fd) == 0 ||
+        !find_field(procfs->buffer, "MemTotal:", &total) ||
+        !find_field(procfs->buffer, "MemAvailable:", &available)) {
+        return;
+    }
+    metrics_set_id(procfs->memory_id, (total - available) / 1024.0);
+    metrics_set_id(procfs->mem_total_id, total / 1024.0);
+}
+
+static void collect_load(ProcFs* procfs) {
+    if (read_proc(procfs, procfs->loadavg_fd) > 0) {
+        metrics_set_id(procfs->load_id, strtod(procfs->buffer, NULL));
+    }
+}
+
+// Processi: le voci numeriche di /proc, lette con getdents64 sul
+// descrittore già aperto (readdir allocherebbe a ogni lettura)
+static void collect_processes(ProcFs* procfs) {
+    if (lseek(procfs->proc_dir_fd, 0, SEEK_SET) < 0) {
+        return;
+    }
+
+    int count = 0;
+    long length;
+    while ((length = syscall(SYS_getdents64, procfs->proc_dir_fd, procfs->buffer, sizeof(procfs->buffer))) > 0) {
+        for (long offset = 0; offset < length; ) {
+            const struct linux_dirent64* entry = (const struct linux_dirent64*)(procfs->buffer + offset);
+            if (entry->d_name[0] >= '1' && entry->d_name[0] <= '9') {
+                count++;
+            }
+            offset += entry->d_reclen;
+        }
+    }
+    metrics_set_id(procfs->processes_id, count);
+}
+
+// Traffico di rete: byte ricevuti e inviati da tutte le interfacce
+// tranne lo, come velocità tra due campioni
+static void collect_network(ProcFs* procfs) {
+    if (read_proc(procfs, procfs->netdev_fd) == 0) {
+        return;
+    }
+    uint64_t now = now_ns();
+
+    uint64_t rx = 0, tx = 0;
+    char* line = strchr(procfs->buffer, '\n');
+    line = line ? strchr(line + 1, '\n') : NULL;  // Salta le due righe di intestazione
+    while (line && *++line) {
+        char* colon = strchr(line, ':');
+        if (!colon) {
+            break;
+        }
+        char* name = line;
+        while (*name == ' ') name++;
+
+        // rx: byte, pacchetti, errori, drop, fifo, frame, compressed, multicast; poi tx
+        char* p = colon + 1;
+        uint64_t fields[9];
+        for (int i = 0; i < 9; i++) {
+            fields[i] = strtoull(p, &p, 10);
+        }
+        if (!(colon - name == 2 && strncmp(name, "lo", 2) == 0)) {
+            rx += fields[0];
+            tx += fields[8];
+        }
+        line = strchr(p, '\n');
+    }
+
+    if (procfs->has_network && now > procfs->net_ns && rx >= procfs->net_rx && tx >= procfs->net_tx) {
+        double seconds = (now - procfs->net_ns) / 1e9;
+        double rx_rate = (rx - procfs->net_rx) / 1024.0 / seconds;
+        double tx_rate = (tx - procfs->net_tx) / 1024.0 / seconds;
+        metrics_set_id(procfs->rx_id, rx_rate);
+        metrics_set_id(procfs->tx_id, tx_rate);
+        metrics_set_id(procfs->network_id, rx_rate + tx_rate);
+    }
+    procfs->net_rx = rx;
+    procfs->net_tx = tx;
+    procfs->net_ns = now;
+    procfs->has_network = true;
+}
+
+// Spazio usato sul filesystem, in GB
+static void collect_disks(ProcFs* procfs) {
+    for (int i = 0; i < procfs->num_disks; i++) {
+        struct statvfs st;
+        if (statvfs(procfs->disks[i].path, &st) == 0) {
+            double used = (double)(st.f_blocks - st.f_bfree) * st.f_frsize;
+            metrics_set_id(procfs->disks[i].id, used / (1024.0 * 1024.0 * 1024.0));
+        }
+    }
+}
+
+void procfs_collect(ProcFs* procfs) {
+    metrics_batch_begin();
+    if (procfs->enabled & PROC_CPU) collect_cpu(procfs);
+    if (procfs->enabled & PROC_MEMORY) collect_memory(procfs);
+    if (procfs->enabled & PROC_LOAD) collect_load(procfs);
+    if (procfs->enabled & PROC_PROCESSES) collect_processes(procfs);
+    if (procfs->enabled & PROC_NETWORK) collect_network(procfs);
+    if (procfs->enabled & PROC_DISK) collect_disks(procfs);
+    metrics_batch_end();
+}
+
+void procfs_close(ProcFs* procfs) {
+    if (!procfs) {
+        return;
+    }
+    if (procfs->stat_fd >= 0) close(procfs->stat_fd);
+    if (procfs->meminfo_fd >= 0) close(procfs->meminfo_fd);
+    if (procfs->loadavg_fd >= 0) close(procfs->loadavg_fd);
+    if (procfs->netdev_fd >= 0) close(procfs->netdev_fd);
+    if (procfs->proc_dir_fd >= 0) close(procfs->proc_dir_fd);
+    free(procfs);
+}
@@ -0,0 +1,19 @@
+// procfs.h
+#ifndef PROCFS_H
+#define PROCFS_H
+
+#include <stdbool.h>
+
+// Collettore delle metriche dell'host da /proc e statvfs
+typedef struct ProcFs ProcFs;
+
+// Apre una volta i file richiesti da spec: elenco separato da virgole di
+// cpu, memory, load, processes, network e disk[=percorso] (vuoto = tutti)
+ProcFs* procfs_open(const char* spec);
+
+// Rilegge i contatori e aggiorna le metriche in un unico batch
+void procfs_collect(ProcFs* procfs);
+
+void procfs_close(ProcFs* procfs);
+
+#endif
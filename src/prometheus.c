@@ -0,0 +1,311 @@
+// prometheus.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "prometheus.h"
+#include "http_handler.h"
+#include "labels.h"
+#include "metrics.h"
+#include "tokens.h"
+#include "utils.h"
+
+#define PROMETHEUS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+// Unità riconosciute: suffisso del nome e fattore verso l'unità di base,
+// secondo le convenzioni di Prometheus. Le altre unità diventano
+// l'etichetta unit="...".
+static const struct {
+    const char* unit;
+    const char* suffix;
+    double scale;
+} unit_map[] = {
+    {"%",    "_percent",          1},
+    {"s",    "_seconds",          1},
+    {"ms",   "_seconds",          1e-3},
+    {"us",   "_seconds",          1e-6},
+    {"B",    "_bytes",            1},
+    {"KB",   "_bytes",            1024.0},
+    {"MB",   "_bytes",            1024.0 * 1024},
+    {"GB",   "_bytes",            1024.0 * 1024 * 1024},
+    {"B/s",  "_bytes_per_second", 1},
+    {"KB/s", "_bytes_per_second", 1024.0},
+    {"MB/s", "_bytes_per_second", 1024.0 * 1024},
+    {"/s",   "_per_second",       1},
+    {"°C",   "_celsius",          1},
+    {NULL,   NULL,                1}
+};
+
+// Pagina resa per una generazione del registro. Il testo non cambia dopo
+// la resa; la versione compressa si aggiunge alla prima richiesta che la
+// accetta. Ogni richiesta in corso tiene un riferimento alla pagina.
+typedef struct {
+    int refs;
+    uint64_t generation;
+    StrBuf text;
+    unsigned char* gzip;
+    size_t gzip_length;
+} Page;
+
+// Una serie della resa in corso
+typedef struct {
+    const Metric* metric;
+    size_t family;      // Offset del nome della famiglia in families
+    double scale;
+    const char* unit;   // Unità non riconosciuta, riportata come etichetta
+} Series;
+
+// Tutto lo stato è protetto da page_mutex
+static pthread_mutex_t page_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Page* current_page = NULL;
+static Metrics snapshot;   // Riutilizzata da una resa all'altra
+static StrBuf families;    // Nomi delle famiglie, terminati da '\0'
+
+static void page_release_locked(Page* page) {
+    if (page && --page->refs == 0) {
+        strbuf_free(&page->text);
+        free(page->gzip);
+        free(page);
+    }
+}
+
+// Nome della famiglia: caratteri non ammessi sostituiti da '_', più il
+// suffisso dell'unità se il nome non lo contiene già
+static void append_family(StrBuf* out, const char* name, size_t length, const char* suffix) {
+    size_t start = out->length;
+    if (length == 0 || isdigit((unsigned char)name[0])) {
+        strbuf_append(out, "_", 1);
+    }
+    strbuf_append(out, name, length);
+    for (char* c = out->data + start; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_' && *c != ':') {
+            *c = '_';
+        }
+    }
+
+    if (suffix) {
+        size_t suffix_length = strlen(suffix);
+        size_t written = out->length - start;
+        if (written < suffix_length ||
+            memcmp(out->data + out->length - suffix_length, suffix, suffix_length) != 0) {
+            strbuf_append(out, suffix, suffix_length);
+        }
+    }
+    strbuf_append(out, "", 1);
+}
+
+// Valore di etichetta tra virgolette, con \\, \" e \n come sequenze di escape
+static void append_label_value(StrBuf* out, const char* value) {
+    strbuf_append(out, "\"", 1);
+    const char* run = value;
+    for (const char* c = value; *c; c++) {
+        if (*c == '\\' || *c == '"' || *c == '\n') {
+            strbuf_append(out, run, c - run);
+            strbuf_append(out, *c == '\n' ? "\\n" : *c == '"' ? "\\\"" : "\\\\", 2);
+            run = c + 1;
+        }
+    }
+    strbuf_append(out, run, strlen(run));
+    strbuf_append(out, "\"", 1);
+}
+
+static void append_value(StrBuf* out, double value) {
+    if (isnan(value)) {
+        strbuf_append(out, "NaN", 3);
+    } else if (isinf(value)) {
+        strbuf_append(out, value > 0 ? "+Inf" : "-Inf", 4);
+    } else {
+        strbuf_append_double(out, value);
+    }
+}
+
+// Le serie di una famiglia devono essere contigue: ordine per famiglia,
+// poi per id (ordine di registrazione)
+static int compare_series(const void* a, const void* b) {
+    const Series* x = a;
+    const Series* y = b;
+    int order = strcmp(families.data + x->family, families.data + y->family);
+    if (order != 0) {
+        return order;
+    }
+    return x->metric->id < y->metric->id ? -1 : x->metric->id > y->metric->id;
+}
+
+static void append_series(StrBuf* out, const Series* s) {
+    strbuf_append(out, families.data + s->family, strlen(families.data + s->family));
+
+    Label labels[LABELS_MAX];
+    int count = labels_get(s->metric->id, labels, LABELS_MAX);
+    bool unit_label = s->unit != NULL;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(labels[i].key, "unit") == 0) {
+            unit_label = false;  // L'etichetta esplicita ha la precedenza
+        }
+    }
+
+    if (count > 0 || unit_label) {
+        for (int i = 0; i < count; i++) {
+            strbuf_append(out, i ? "," : "{", 1);
+            strbuf_append(out, labels[i].key, strlen(labels[i].key));
+            strbuf_append(out, "=", 1);
+            append_label_value(out, labels[i].value);
+        }
+        if (unit_label) {
+            strbuf_append(out, count ? ",unit=" : "{unit=", 6);
+            append_label_value(out, s->unit);
+        }
+        strbuf_append(out, "}", 1);
+    }
+
+    strbuf_append(out, " ", 1);
+    append_value(out, s->metric->value * s->scale);
+    strbuf_append(out, "\n", 1);
+}
+
+// Rende la pagina della generazione corrente con le sole metriche
+// autorizzate da allowed (con page_mutex preso)
+static Page* render_page(const char* allowed) {
+    metrics_get(&snapshot);
+
+    Series* series = malloc((snapshot.count + 1) * sizeof(Series));
+    Page* page = calloc(1, sizeof(Page));
+    if (!series || !page) {
+        free(series);
+        free(page);
+        return NULL;
+    }
+
+    families.length = 0;
+    int count = 0;
+    for (int i = 0; i < snapshot.count; i++) {
+        const Metric* m = &snapshot.metrics[i];
+        if (!token_allows(allowed, m->name)) {
+            continue;
+        }
+        Series* s = &series[count++];
+        s->metric = m;
+        s->scale = 1;
+        s->unit = m->unit && m->unit[0] ? m->unit : NULL;
+
+        const char* suffix = NULL;
+        for (int u = 0; s->unit && unit_map[u].unit; u++) {
+            if (strcmp(s->unit, unit_map[u].unit) == 0) {
+                suffix = unit_map[u].suffix;
+                s->scale = unit_map[u].scale;
+                s->unit = NULL;
+                break;
+            }
+        }
+
+        const char* brace = strchr(m->name, '{');
+        s->family = families.length;
+        append_family(&families, m->name, brace ? (size_t)(brace - m->name) : strlen(m->name), suffix);
+    }
+    qsort(series, count, sizeof(Series), compare_series);
+
+    page->refs = 1;  // Riferimento di current_page
+    page->generation = snapshot.generation;
+    strbuf_init(&page->text);
+
+    const char* previous = NULL;
+    for (int i = 0; i < count; i++) {
+        const char* family = families.data + series[i].family;
+        if (!previous || strcmp(previous, family) != 0) {
+            strbuf_append(&page->text, "# TYPE ", 7);
+            strbuf_append(&page->text, family, strlen(family));
+            strbuf_append(&page->text, " gauge\n", 7);
+            previous = family;
+        }
+        append_series(&page->text, &series[i]);
+    }
+
+    free(series);
+    return page;
+}
+
+// Comprime il testo della pagina in formato gzip (con page_mutex preso)
+static void compress_page(Page* page) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 15 + 16: finestra massima con intestazione gzip invece di zlib
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return;
+    }
+
+    size_t bound = deflateBound(&stream, page->text.length);
+    unsigned char* output = malloc(bound);
+    if (output) {
+        stream.next_in = (Bytef*)page->text.data;
+        stream.avail_in = page->text.length;
+        stream.next_out = output;
+        stream.avail_out = bound;
+        if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
+            page->gzip = output;
+            page->gzip_length = stream.total_out;
+        } else {
+            free(output);
+        }
+    }
+    deflateEnd(&stream);
+}
+
+// Pagina della generazione corrente, resa solo se il registro è cambiato;
+// da rilasciare con page_release_locked
+static Page* page_acquire(bool gzip) {
+    uint64_t generation = metrics_generation();
+
+    pthread_mutex_lock(&page_mutex);
+    if (!current_page || current_page->generation != generation) {
+        Page* page = render_page("");
+        if (page) {
+            page_release_locked(current_page);
+            current_page = page;
+        }
+    }
+
+    Page* page = current_page;
+    if (page) {
+        if (gzip && !page->gzip && page->text.length > 0) {
+            compress_page(page);
+        }
+        page->refs++;
+    }
+    pthread_mutex_unlock(&page_mutex);
+    return page;
+}
+
+void prometheus_handle_request(int client_socket, bool gzip, const char* allowed) {
+    Page* page;
+    if (allowed[0] == '\0') {
+        page = page_acquire(gzip);
+    } else {
+        // Le pagine ridotte dipendono dal token: niente cache
+        pthread_mutex_lock(&page_mutex);
+        page = render_page(allowed);
+        if (page && gzip && page->text.length > 0) {
+            compress_page(page);
+        }
+        pthread_mutex_unlock(&page_mutex);
+    }
+    if (!page) {
+        send_http_error(client_socket, 500, "Internal Server Error");
+        return;
+    }
+
+    // L'invio avviene senza lock: la pagina resta valida finché la si tiene
+    if (gzip && page->gzip) {
+        send_http_response_headers(client_socket, 200, "OK", PROMETHEUS_CONTENT_TYPE,
+                                   "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n",
+                                   (const char*)page->gzip, page->gzip_length);
+    } else {
+        send_http_response_headers(client_socket, 200, "OK", PROMETHEUS_CONTENT_TYPE,
+                                   "Vary: Accept-Encoding\r\n", page->text.data, page->text.length);
+    }
+
+    pthread_mutex_lock(&page_mutex);
+    page_release_locked(page);
+    pthread_mutex_unlock(&page_mutex);
+}
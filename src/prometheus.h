@@ -0,0 +1,15 @@
+// prometheus.h
+#ifndef PROMETHEUS_H
+#define PROMETHEUS_H
+
+#include <stdbool.h>
+
+// GET /metrics: il registro nel formato di esposizione testuale di
+// Prometheus. La pagina viene resa al più una volta per generazione delle
+// metriche (e compressa al più una volta) e servita a tutte le richieste
+// successive finché il registro non cambia. gzip indica se il client
+// accetta Content-Encoding: gzip; allowed è l'elenco autorizzato dal token
+// ("" = tutte): una pagina ridotta viene resa per la sola richiesta.
+void prometheus_handle_request(int client_socket, bool gzip, const char* allowed);
+
+#endif
@@ -0,0 +1,240 @@
+// publisher.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "publisher.h"
+#include "shmexport.h"
+
+// Evento accodato da un collector
+typedef struct {
+    uint64_t enqueue_ns;  // Istante di accodamento
+    uint64_t collect_ns;  // Durata del batch di raccolta
+} PublisherEvent;
+
+// Cella della coda MPSC limitata (schema a numeri di sequenza)
+typedef struct {
+    _Atomic size_t sequence;
+    PublisherEvent event;
+} QueueCell;
+
+static QueueCell queue[PUBLISHER_QUEUE_SIZE];
+static _Atomic size_t enqueue_pos = 0;
+static size_t dequeue_pos = 0;  // Usato solo dal thread di pubblicazione
+
+// Segnalato quando un evento non entra in coda: la pubblicazione avviene comunque
+static _Atomic bool overflow = false;
+
+static sem_t queue_sem;
+static pthread_t publisher_thread;
+static volatile bool publisher_running = false;
+static _Atomic(metrics_callback_t) update_callback = NULL;
+static _Atomic(alert_callback_t) alert_callback = NULL;
+
+// Statistiche
+static _Atomic uint64_t stat_events = 0;
+static _Atomic uint64_t stat_dropped = 0;
+static _Atomic uint64_t stat_publications = 0;
+static LatencyStat stage_latency[PUB_STAGE_COUNT];
+
+static const char* stage_names[PUB_STAGE_COUNT] = {
+    "collect", "queue", "serialize", "fanout"
+};
+
+// Inserisce un evento in coda; restituisce false se la coda è piena
+static bool queue_push(const PublisherEvent* event) {
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+
+    for (;;) {
+        QueueCell* cell = &queue[pos & (PUBLISHER_QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            // Cella libera: prova a prenotarla
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->event = *event;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // Coda piena
+            return false;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// Preleva un evento dalla coda (solo thread di pubblicazione)
+static bool queue_pop(PublisherEvent* event) {
+    QueueCell* cell = &queue[dequeue_pos & (PUBLISHER_QUEUE_SIZE - 1)];
+    size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+
+    if ((intptr_t)seq - (intptr_t)(dequeue_pos + 1) < 0) {
+        return false;  // Coda vuota
+    }
+
+    *event = cell->event;
+    atomic_store_explicit(&cell->sequence, dequeue_pos + PUBLISHER_QUEUE_SIZE, memory_order_release);
+    dequeue_pos++;
+    return true;
+}
+
+// Thread di pubblicazione: serializza e invia fuori dalla sezione critica dei collector
+static void* publisher_thread_main(void* arg) {
+    (void)arg;
+    Metrics snapshot = {0};
+    uint64_t published_generation = 0;
+
+    while (publisher_running) {
+        if (sem_wait(&queue_sem) != 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // Consuma le segnalazioni in eccesso prima di svuotare la coda,
+        // così un evento accodato dopo lo svuotamento ha sempre la sua sveglia
+        while (sem_trywait(&queue_sem) == 0) {
+        }
+
+        bool pending = atomic_exchange(&overflow, false);
+        PublisherEvent event;
+        uint64_t now = now_ns();
+
+        while (queue_pop(&event)) {
+            latency_record(&stage_latency[PUB_STAGE_QUEUE], now - event.enqueue_ns);
+            latency_record(&stage_latency[PUB_STAGE_COLLECT], event.collect_ns);
+            pending = true;
+        }
+
+        // Le transizioni di allarme non si accorpano: vanno inviate tutte, in ordine
+        AlertEvent alerts[64];
+        int num_alerts;
+        alert_callback_t on_alerts = atomic_load(&alert_callback);
+        while ((num_alerts = alerts_take(alerts, 64)) > 0) {
+            if (on_alerts) {
+                on_alerts(alerts, num_alerts);
+            }
+        }
+
+        // Più eventi accumulati durante un invio lento vengono accorpati
+        // in un'unica pubblicazione dello stato più recente
+        // Se la generazione non è cambiata (eventi già coperti dall'ultimo
+        // invio) non c'è nulla da serializzare
+        metrics_callback_t callback = atomic_load(&update_callback);
+        if (pending && metrics_generation() != published_generation) {
+            metrics_get(&snapshot);
+            published_generation = snapshot.generation;
+
+            // La tabella per i lettori locali usa la stessa copia dei client
+            shmexport_write(&snapshot);
+
+            if (callback) {
+                callback(&snapshot);
+                atomic_fetch_add_explicit(&stat_publications, 1, memory_order_relaxed);
+            }
+        }
+    }
+
+    metrics_free(&snapshot);
+    return NULL;
+}
+
+// Avvia il thread di pubblicazione
+bool publisher_start(void) {
+    if (publisher_running) {
+        return false;  // Già in esecuzione
+    }
+
+    for (size_t i = 0; i < PUBLISHER_QUEUE_SIZE; i++) {
+        atomic_init(&queue[i].sequence, i);
+    }
+    atomic_store(&enqueue_pos, 0);
+    dequeue_pos = 0;
+
+    if (sem_init(&queue_sem, 0, 0) != 0) {
+        return false;
+    }
+
+    publisher_running = true;
+
+    if (pthread_create(&publisher_thread, NULL, publisher_thread_main, NULL) != 0) {
+        publisher_running = false;
+        sem_destroy(&queue_sem);
+        return false;
+    }
+
+    return true;
+}
+
+// Ferma il thread di pubblicazione
+void publisher_stop(void) {
+    if (!publisher_running) {
+        return;
+    }
+
+    publisher_running = false;
+    sem_post(&queue_sem);
+    pthread_join(publisher_thread, NULL);
+    sem_destroy(&queue_sem);
+}
+
+// Imposta il callback di aggiornamento
+void publisher_set_callback(metrics_callback_t callback) {
+    atomic_store(&update_callback, callback);
+}
+
+// Imposta il callback per le transizioni di allarme
+void publisher_set_alert_callback(alert_callback_t callback) {
+    atomic_store(&alert_callback, callback);
+}
+
+// Segnala un aggiornamento: accoda l'evento e sveglia il publisher
+void publisher_notify(uint64_t collect_ns) {
+    if (!publisher_running) {
+        return;
+    }
+
+    PublisherEvent event = {
+        .enqueue_ns = now_ns(),
+        .collect_ns = collect_ns
+    };
+
+    atomic_fetch_add_explicit(&stat_events, 1, memory_order_relaxed);
+
+    if (!queue_push(&event)) {
+        // Coda piena: il publisher è già in ritardo e pubblicherà comunque
+        // lo stato più recente, quindi basta segnalarlo
+        atomic_fetch_add_explicit(&stat_dropped, 1, memory_order_relaxed);
+        atomic_store(&overflow, true);
+    }
+
+    sem_post(&queue_sem);
+}
+
+// Registra la durata di una fase della pipeline
+void publisher_record(PublisherStage stage, uint64_t ns) {
+    if (stage < PUB_STAGE_COUNT) {
+        latency_record(&stage_latency[stage], ns);
+    }
+}
+
+// Ottieni le statistiche correnti
+void publisher_get_stats(PublisherStats* stats) {
+    stats->events = atomic_load(&stat_events);
+    stats->dropped = atomic_load(&stat_dropped);
+    stats->publications = atomic_load(&stat_publications);
+
+    for (int i = 0; i < PUB_STAGE_COUNT; i++) {
+        latency_summary(&stage_latency[i], &stats->stages[i]);
+    }
+}
+
+const char* publisher_stage_name(PublisherStage stage) {
+    return stage < PUB_STAGE_COUNT ? stage_names[stage] : "?";
+}
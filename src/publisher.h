@@ -0,0 +1,50 @@
+// publisher.h
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "metrics.h"
+#include "alerts.h"
+#include "utils.h"
+
+#define PUBLISHER_QUEUE_SIZE 1024  // Numero di eventi in coda (potenza di 2)
+
+// Fasi della pipeline di pubblicazione di cui si misura la latenza
+typedef enum {
+    PUB_STAGE_COLLECT,    // Tempo speso dal collector nel batch di aggiornamento
+    PUB_STAGE_QUEUE,      // Attesa in coda fino al prelievo del publisher
+    PUB_STAGE_SERIALIZE,  // Costruzione del messaggio JSON
+    PUB_STAGE_FANOUT,     // Invio del messaggio a tutti i client
+    PUB_STAGE_COUNT
+} PublisherStage;
+
+// Statistiche del publisher
+typedef struct {
+    uint64_t events;        // Eventi accodati dai collector
+    uint64_t dropped;       // Eventi scartati per coda piena (accorpati)
+    uint64_t publications;  // Invocazioni del callback di aggiornamento
+    LatencySummary stages[PUB_STAGE_COUNT];
+} PublisherStats;
+
+// Avvia e ferma il thread di pubblicazione
+bool publisher_start(void);
+void publisher_stop(void);
+
+// Imposta il callback invocato dal thread di pubblicazione
+void publisher_set_callback(metrics_callback_t callback);
+
+// Imposta il callback per le transizioni di allarme
+void publisher_set_alert_callback(alert_callback_t callback);
+
+// Segnala un aggiornamento delle metriche; non blocca mai il chiamante
+void publisher_notify(uint64_t collect_ns);
+
+// Registra la durata di una fase della pipeline
+void publisher_record(PublisherStage stage, uint64_t ns);
+
+// Ottieni le statistiche correnti
+void publisher_get_stats(PublisherStats* stats);
+const char* publisher_stage_name(PublisherStage stage);
+
+#endif
@@ -4,14 +4,22 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <getopt.h>
 #include <time.h>
+#include <stdatomic.h>
+#include <errno.h>
 #include "server.h"
 #include "websocket.h"
 #include "http_handler.h"
 #include "metrics.h"
+#include "publisher.h"
+#include "alerts.h"
+#include "labels.h"
+#include "tokens.h"
+#include "utils.h"
 
 // Inizializzazione della configurazione con valori predefiniti
 ServerConfig server_config = {
@@ -19,83 +27,806 @@ ServerConfig server_config = {
     .max_clients = DEFAULT_MAX_CLIENTS,
     .buffer_size = DEFAULT_BUFFER_SIZE,
     .www_root = DEFAULT_WWW_ROOT,
+    .fanout_threads = 0,
     .verbose = false
 };
 
 static int server_socket;
-static int* client_sockets;
-static int num_clients = 0;
-static pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Callback per l'aggiornamento delle metriche
-void metrics_updated_callback(const Metrics* metrics) {
-    // Prepara il messaggio JSON
-    char message[1024] = "{";
-    char* p = message + 1;
-    
-    // Aggiungi il timestamp
-    time_t now = time(NULL);
-    char time_str[32];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&now));
+// Flussi a cui un client può iscriversi con ?subscribe=values,alerts
+#define SUBSCRIBE_VALUES 1  // Valori delle metriche (predefinito)
+#define SUBSCRIBE_ALERTS 2  // Solo transizioni di allarme
+
+// Tempo massimo per consegnare un frame a un client: oltre, il client è
+// troppo lento e viene disconnesso invece di trattenere il suo shard
+#define CLIENT_SEND_TIMEOUT_MS 5000
+
+// Transizioni di allarme in coda per un client che non ha finito di
+// ricevere il frame precedente; a coda piena il client viene disconnesso
+#define CLIENT_ALERT_QUEUE 64
+
+// Client WebSocket registrato in uno shard. Il socket viene chiuso
+// dall'ultimo riferimento: il thread del client o un invio in corso.
+typedef struct {
+    int socket;
+    int shard;  // Shard a cui è assegnato
+    int slot;   // Posizione nell'array dello shard
+    unsigned subscriptions;
+    int channel;  // Canale dei valori (0 = tutte le metriche, -1 = solo allarmi)
+    int page;     // Pagina delle soglie di allarme (0 = solo quelle globali)
+    char* allowed;  // Metriche autorizzate dal token ("" = tutte)
+    _Atomic int refs;
     
-    p += snprintf(p, sizeof(message) - (p - message), 
-                 "\"timestamp\": \"%s\"", time_str);
+    // Stato dell'invio, usato solo dal thread dello shard
+    struct SharedFrame* partial;  // Frame non ancora consegnato per intero
+    size_t offset;                // Byte di partial già inviati
+    struct SharedFrame* alerts[CLIENT_ALERT_QUEUE];  // Allarmi in attesa, in ordine
+    int alerts_head;
+    int num_alerts;
+    uint64_t blocked_since_ns;    // Inizio dell'attesa con il buffer del socket pieno
+    bool dropped;
+} Client;
+
+// Canale dei valori: i client con lo stesso selettore (?match=...), la
+// stessa pagina e le stesse metriche autorizzate ne condividono i frame,
+// costruiti una volta per pubblicazione
+typedef struct {
+    char selector[256];
+    char allowed[TOKEN_MAX];  // Metriche autorizzate dal token ("" = tutte)
+    int page;                 // Pagina di cui riportare lo stato di allarme
+    int refs;                 // Client iscritti (0 = canale libero)
+    metric_id_t* ids;         // Serie selezionate, in ordine crescente
+    int num_ids;              // -1 = tutte le metriche (nessuna restrizione)
+    uint32_t resolved_count;  // Numero di metriche all'ultima selezione
+    StrBuf cached;            // Ultimo messaggio serializzato, riusato dai nuovi client
+    uint64_t cached_generation;
+} Channel;
+
+// Frame WebSocket costruito una volta e condiviso da tutti gli shard
+typedef struct SharedFrame {
+    unsigned char* data;
+    size_t length;
+    _Atomic int refs;     // Shard che non hanno ancora terminato l'invio
+    uint64_t start_ns;    // Inizio del fan-out
+    AlertEvent event;     // Transizione trasportata, per i frame di allarme
+} SharedFrame;
+
+#define SHARD_FLUSH_INTERVAL_MS 20  // Ripresa degli invii parziali senza nuovi frame
+
+// Partizione dei client servita da un proprio thread di fan-out
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;     // Protegge solo i client di questo shard
+    pthread_cond_t cond;
+    Client** clients;
+    int num_clients;
+    int capacity;
+    Client** sending;          // Copia dei client usata durante l'invio, senza lock
+    int sending_capacity;
+    SharedFrame** pending;     // Ultimo frame di ogni canale, NULL se nessuno
+    int pending_capacity;
+    int num_pending;
+    SharedFrame** alerts;      // Frame di allarme, da inviare tutti in ordine
+    int num_alerts;
+    int alerts_capacity;
+} Shard;
+
+static Shard* shards;
+static int num_shards = 0;
+static _Atomic int num_clients = 0;
+static _Atomic int num_alert_clients = 0;
+
+// Il canale 0 contiene tutte le metriche e non ha selettore. La tabella
+// cresce con le combinazioni di selettore, pagina e token in uso; i canali
+// sono allocati uno per uno, così restano al loro indirizzo.
+static Channel** channels;
+static int num_channels = 0;
+static int channels_capacity = 0;
+static pthread_mutex_t channels_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void deliver_frame(int channel, const char* message, size_t length, uint64_t start_ns);
+static void release_frame(SharedFrame* frame);
+
+// Costruisce il messaggio JSON con le metriche della copia; se num_ids non
+// è negativo include solo quelle di ids (ordinato, come la copia). Lo stato
+// di allarme è quello valutato con le soglie della pagina.
+static void build_metrics_message(const Metrics* metrics, const metric_id_t* ids, int num_ids,
+                                  int page, StrBuf* message) {
+    // Istante della serializzazione in ms dall'epoca Unix; la
+    // formattazione locale spetta al client
+    strbuf_append(message, "{\"timestamp\": ", 14);
+    strbuf_append_int(message, wall_clock_ms());
     
     // Aggiungi le metriche
+    int next = 0;
     for (int i = 0; i < metrics->count; i++) {
-        // Aggiungi virgola e spazio
-        *p++ = ',';
-        *p++ = ' ';
-        
-        // Formatta il valore con precisione appropriata
-        char value_str[32];
-        // Se il valore è un intero, non mostrare decimali
-        if (metrics->metrics[i].value == (int)metrics->metrics[i].value) {
-            snprintf(value_str, sizeof(value_str), "%d", (int)metrics->metrics[i].value);
-        } else {
-            // Altrimenti mostra fino a 2 decimali
-            snprintf(value_str, sizeof(value_str), "%.2f", metrics->metrics[i].value);
+        const Metric* metric = &metrics->metrics[i];
+        if (num_ids >= 0) {
+            while (next < num_ids && ids[next] < metric->id) next++;
+            if (next == num_ids) break;
+            if (ids[next] != metric->id) continue;
         }
         
-        // Aggiungi "nome": {"value": valore, "unit": "unità"}
-        p += snprintf(p, sizeof(message) - (p - message), 
-                     "\"%s\": {\"value\": %s, \"unit\": \"%s\"}", 
-                     metrics->metrics[i].name, 
-                     value_str,
-                     metrics->metrics[i].unit);
+        // Aggiungi "nome": {"value": valore, "unit": "unità"}; i nomi con
+        // etichette contengono virgolette e vanno quindi protetti. Il valore
+        // è il più corto che rilegge lo stesso double: niente arrotondamenti.
+        strbuf_append(message, ", ", 2);
+        strbuf_append_json(message, metric->name);
+        strbuf_append(message, ": {\"value\": ", 11);
+        strbuf_append_double(message, metric->value);
+        strbuf_append(message, ", \"unit\": ", 10);
+        strbuf_append_json(message, metric->unit);
+        
+        // Stato di allarme calcolato dal server, per le metriche con soglie
+        int level = alerts_level(metric->id, page);
+        if (level >= 0) {
+            strbuf_appendf(message, ", \"alert\": \"%s\"", alerts_level_name(level));
+        }
+        strbuf_append(message, "}", 1);
     }
     
     // Chiudi il JSON
-    *p++ = '}';
-    *p = '\0';
+    strbuf_append(message, "}", 1);
+}
+
+// Serie di un canale: quelle del selettore, ridotte alle metriche
+// autorizzate dal token. Restituisce il numero di id (ordinati, da
+// liberare), -1 se non c'è alcuna restrizione e -2 se il selettore non è valido.
+static int select_channel_ids(const Channel* channel, metric_id_t** ids) {
+    *ids = NULL;
+    int count = -1;
+    if (channel->selector[0]) {
+        count = labels_select(channel->selector, ids);
+        if (count < 0) {
+            return -2;
+        }
+    }
+    if (channel->allowed[0] == '\0') {
+        return count;
+    }
+    
+    // Il filtro per nome si ripete solo quando compaiono nuove metriche
+    uint32_t total = count < 0 ? metrics_count() : (uint32_t)count;
+    metric_id_t* allowed = malloc((total ? total : 1) * sizeof(metric_id_t));
+    if (!allowed) {
+        free(*ids);
+        *ids = NULL;
+        return -2;
+    }
+    int num_allowed = 0;
+    for (uint32_t i = 0; i < total; i++) {
+        metric_id_t id = count < 0 ? (metric_id_t)i : (*ids)[i];
+        if (token_allows(channel->allowed, metrics_name(id))) {
+            allowed[num_allowed++] = id;
+        }
+    }
+    free(*ids);
+    *ids = allowed;
+    return num_allowed;
+}
+
+// Aggiorna le serie di un canale se sono state registrate nuove metriche
+// (con channels_mutex preso)
+static void refresh_channel(Channel* channel) {
+    uint32_t count = metrics_count();
+    if (channel->num_ids < 0 || channel->resolved_count == count) {
+        return;
+    }
     
-    // Invia l'aggiornamento a tutti i client
-    broadcast_metrics(message);
+    metric_id_t* ids;
+    int num_ids = select_channel_ids(channel, &ids);
+    if (num_ids >= 0) {
+        free(channel->ids);
+        channel->ids = ids;
+        channel->num_ids = num_ids;
+        channel->resolved_count = count;
+    }
 }
 
-// Aggiunge un client alla lista
-static void add_client(int client_socket) {
-    pthread_mutex_lock(&clients_mutex);
-    if (num_clients < server_config.max_clients) {
-        client_sockets[num_clients++] = client_socket;
+// Conserva il messaggio di un canale per la sua generazione (con
+// channels_mutex preso); una copia più vecchia non sostituisce la corrente
+static void cache_message(Channel* channel, uint64_t generation, const StrBuf* message) {
+    if (generation < channel->cached_generation) {
+        return;
     }
-    pthread_mutex_unlock(&clients_mutex);
+    channel->cached.length = 0;
+    strbuf_append(&channel->cached, message->data, message->length);
+    channel->cached_generation = generation;
 }
 
-// Rimuove un client dalla lista
-static void remove_client(int client_socket) {
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < num_clients; i++) {
-        if (client_sockets[i] == client_socket) {
-            // Sposta gli altri client indietro di una posizione
-            for (int j = i; j < num_clients - 1; j++) {
-                client_sockets[j] = client_sockets[j + 1];
-            }
-            num_clients--;
+// Messaggio con le metriche correnti di un canale, per un nuovo client:
+// se nulla è cambiato dall'ultima serializzazione si riusa quella
+static void current_metrics_message(int c, StrBuf* message) {
+    pthread_mutex_lock(&channels_mutex);
+    Channel* channel = channels[c];
+    if (channel->cached.length > 0 && channel->cached_generation == metrics_generation()) {
+        strbuf_append(message, channel->cached.data, channel->cached.length);
+        pthread_mutex_unlock(&channels_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&channels_mutex);
+    
+    Metrics current = {0};
+    metrics_get(&current);
+    
+    pthread_mutex_lock(&channels_mutex);
+    if (c > 0) {
+        refresh_channel(channel);
+        build_metrics_message(&current, channel->ids, channel->num_ids, channel->page, message);
+    } else {
+        build_metrics_message(&current, NULL, -1, 0, message);
+    }
+    cache_message(channel, current.generation, message);
+    pthread_mutex_unlock(&channels_mutex);
+    
+    metrics_free(&current);
+}
+
+// Callback per l'aggiornamento delle metriche (eseguito dal thread di pubblicazione)
+void metrics_updated_callback(const Metrics* metrics) {
+    // Buffer riusato tra le pubblicazioni: cresce una volta e resta allocato
+    static StrBuf message;
+    uint64_t start = now_ns();
+    
+    // Il messaggio completo serve solo se qualcuno è iscritto al canale 0;
+    // un client che arriva dopo lo costruisce da sé
+    pthread_mutex_lock(&channels_mutex);
+    bool subscribed = channels[0]->refs > 0;
+    pthread_mutex_unlock(&channels_mutex);
+    
+    if (subscribed) {
+        // Prepara il messaggio JSON
+        message.length = 0;
+        build_metrics_message(metrics, NULL, -1, 0, &message);
+        
+        publisher_record(PUB_STAGE_SERIALIZE, now_ns() - start);
+        
+        pthread_mutex_lock(&channels_mutex);
+        cache_message(channels[0], metrics->generation, &message);
+        pthread_mutex_unlock(&channels_mutex);
+        
+        // Invia l'aggiornamento a tutti i client; la durata del fan-out
+        // viene registrata dall'ultimo shard che termina l'invio
+        broadcast_metrics(message.data);
+    }
+    
+    // Un messaggio per ogni altro canale, ridotto al selettore e con lo
+    // stato di allarme della sua pagina
+    for (int c = 1; ; c++) {
+        pthread_mutex_lock(&channels_mutex);
+        if (c >= num_channels) {
+            pthread_mutex_unlock(&channels_mutex);
             break;
         }
+        Channel* channel = channels[c];
+        if (channel->refs == 0) {
+            pthread_mutex_unlock(&channels_mutex);
+            continue;
+        }
+        refresh_channel(channel);
+        message.length = 0;
+        build_metrics_message(metrics, channel->ids, channel->num_ids, channel->page, &message);
+        cache_message(channel, metrics->generation, &message);
+        
+        // Consegna con channels_mutex preso: un canale liberato nel frattempo
+        // e riassegnato a un altro selettore non riceve il frame del vecchio
+        deliver_frame(c, message.data, message.length, 0);
+        pthread_mutex_unlock(&channels_mutex);
+    }
+}
+
+// Aggiunge un canale libero in fondo alla tabella (con channels_mutex
+// preso). Restituisce il suo indice, -1 se manca la memoria.
+static int channel_add(void) {
+    if (num_channels == channels_capacity) {
+        int capacity = channels_capacity ? channels_capacity * 2 : 16;
+        Channel** grown = realloc(channels, capacity * sizeof(Channel*));
+        if (!grown) {
+            return -1;
+        }
+        channels = grown;
+        channels_capacity = capacity;
+    }
+    Channel* channel = calloc(1, sizeof(Channel));
+    if (!channel) {
+        return -1;
+    }
+    strbuf_init(&channel->cached);
+    channels[num_channels] = channel;
+    return num_channels++;
+}
+
+// Crea il canale 0, quello di tutte le metriche
+static void init_channels(void) {
+    pthread_mutex_lock(&channels_mutex);
+    int c = channel_add();
+    pthread_mutex_unlock(&channels_mutex);
+    if (c != 0) {
+        perror("Errore nell'allocazione della memoria per i canali");
+        exit(1);
+    }
+}
+
+// Iscrive un client al canale del selettore, della pagina e delle metriche
+// autorizzate, creandolo se serve. Restituisce -1 se il selettore non è
+// valido o manca la memoria per un nuovo canale.
+static int channel_acquire(const char* selector, int page, const char* allowed) {
+    pthread_mutex_lock(&channels_mutex);
+    if (selector[0] == '\0' && page == 0 && allowed[0] == '\0') {
+        channels[0]->refs++;
+        pthread_mutex_unlock(&channels_mutex);
+        return 0;
+    }
+    
+    int free_slot = -1;
+    for (int c = 1; c < num_channels; c++) {
+        Channel* channel = channels[c];
+        if (channel->refs > 0 && channel->page == page &&
+            strcmp(channel->selector, selector) == 0 &&
+            strcmp(channel->allowed, allowed) == 0) {
+            channel->refs++;
+            pthread_mutex_unlock(&channels_mutex);
+            return c;
+        }
+        if (channel->refs == 0 && free_slot < 0) {
+            free_slot = c;
+        }
+    }
+    if (free_slot < 0) {
+        free_slot = channel_add();
+    }
+    
+    if (free_slot > 0) {
+        Channel* channel = channels[free_slot];
+        snprintf(channel->selector, sizeof(channel->selector), "%s", selector);
+        snprintf(channel->allowed, sizeof(channel->allowed), "%s", allowed);
+        channel->page = page;
+        channel->resolved_count = 0;
+        channel->num_ids = select_channel_ids(channel, &channel->ids);
+        if (channel->num_ids < -1) {
+            free_slot = -1;
+        } else {
+            channel->resolved_count = metrics_count();
+            channel->refs = 1;
+        }
+    }
+    
+    pthread_mutex_unlock(&channels_mutex);
+    return free_slot;
+}
+
+static void channel_release(int c) {
+    if (c < 0) {
+        return;
+    }
+    
+    pthread_mutex_lock(&channels_mutex);
+    Channel* channel = channels[c];
+    if (--channel->refs == 0 && c > 0) {
+        free(channel->ids);
+        channel->ids = NULL;
+        channel->num_ids = 0;
+        strbuf_free(&channel->cached);
+        channel->cached_generation = 0;
+        
+        // I frame non ancora inviati appartengono al vecchio selettore:
+        // si scartano prima che il canale possa essere riassegnato
+        for (int i = 0; i < num_shards; i++) {
+            Shard* shard = &shards[i];
+            pthread_mutex_lock(&shard->mutex);
+            SharedFrame* stale = c < shard->pending_capacity ? shard->pending[c] : NULL;
+            if (stale) {
+                shard->pending[c] = NULL;
+                shard->num_pending--;
+            }
+            pthread_mutex_unlock(&shard->mutex);
+            
+            if (stale) {
+                release_frame(stale);
+            }
+        }
+    }
+    pthread_mutex_unlock(&channels_mutex);
+}
+
+// Rilascia un riferimento al frame condiviso; l'ultimo shard lo libera
+static void release_frame(SharedFrame* frame) {
+    if (atomic_fetch_sub(&frame->refs, 1) == 1) {
+        if (frame->start_ns) {
+            publisher_record(PUB_STAGE_FANOUT, now_ns() - frame->start_ns);
+        }
+        free(frame->data);
+        free(frame);
+    }
+}
+
+static void client_release(Client* client) {
+    if (atomic_fetch_sub(&client->refs, 1) == 1) {
+        if (client->partial) {
+            release_frame(client->partial);
+        }
+        for (int i = 0; i < client->num_alerts; i++) {
+            release_frame(client->alerts[(client->alerts_head + i) % CLIENT_ALERT_QUEUE]);
+        }
+        close(client->socket);
+        free(client->allowed);
+        free(client);
+    }
+}
+
+// Prosegue senza attendere l'invio del frame in corso di un client.
+// false se il client è bloccato da oltre il timeout o il socket è in errore.
+static bool client_write(Client* client, uint64_t now) {
+    while (client->partial) {
+        const SharedFrame* frame = client->partial;
+        ssize_t sent = send(client->socket, frame->data + client->offset, frame->length - client->offset,
+                            MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            if (client->blocked_since_ns == 0) {
+                client->blocked_since_ns = now;
+            }
+            return now - client->blocked_since_ns < (uint64_t)CLIENT_SEND_TIMEOUT_MS * 1000000;
+        }
+        client->offset += sent;
+        if (client->offset == frame->length) {
+            release_frame(client->partial);
+            client->partial = NULL;
+            
+            // Il frame concluso lascia il posto al primo allarme in coda
+            if (client->num_alerts > 0) {
+                client->partial = client->alerts[client->alerts_head];
+                client->offset = 0;
+                client->alerts_head = (client->alerts_head + 1) % CLIENT_ALERT_QUEUE;
+                client->num_alerts--;
+            }
+        }
+    }
+    client->blocked_since_ns = 0;
+    return true;
+}
+
+// Consegna un frame a un client. Un frame di valori contiene lo stato
+// completo del canale: se il client non ha ancora finito di ricevere il
+// precedente lo salta e avrà il successivo. Una transizione di allarme non
+// si può saltare: va in coda e parte quando il socket si libera; false se
+// la coda è piena.
+static bool client_send(Client* client, SharedFrame* frame, bool skippable, uint64_t now) {
+    if (!client_write(client, now)) {
+        return false;
+    }
+    if (client->partial) {
+        if (skippable) {
+            return true;
+        }
+        if (client->num_alerts == CLIENT_ALERT_QUEUE) {
+            return false;
+        }
+        atomic_fetch_add(&frame->refs, 1);
+        client->alerts[(client->alerts_head + client->num_alerts) % CLIENT_ALERT_QUEUE] = frame;
+        client->num_alerts++;
+        return true;
+    }
+    
+    atomic_fetch_add(&frame->refs, 1);
+    client->partial = frame;
+    client->offset = 0;
+    return client_write(client, now);
+}
+
+// Disconnette un client che non riceve più
+static void client_drop(Client* client) {
+    if (client->dropped) {
+        return;
+    }
+    client->dropped = true;
+    if (server_config.verbose) {
+        printf("Errore nell'invio al client %d\n", client->socket);
+    }
+    // Sblocca il thread del client, che si occuperà della rimozione
+    shutdown(client->socket, SHUT_RDWR);
+}
+
+// Invia un frame ai client copiati dallo shard iscritti al flusso e al
+// canale (-1 = tutti i canali); una transizione di allarme va solo ai
+// client della cui pagina determina lo stato. Eseguita senza il lock dello shard.
+static void send_to_clients(Client** clients, int count, SharedFrame* frame,
+                            unsigned subscription, int channel) {
+    uint64_t now = now_ns();
+    for (int i = 0; i < count; i++) {
+        Client* client = clients[i];
+        if (client->dropped || !(client->subscriptions & subscription) ||
+            (channel >= 0 && client->channel != channel) ||
+            (subscription == SUBSCRIBE_ALERTS &&
+             (!alerts_applies(&frame->event, client->page) ||
+              !token_allows(client->allowed, metrics_name(frame->event.id))))) {
+            continue;
+        }
+        if (!client_send(client, frame, subscription == SUBSCRIBE_VALUES, now)) {
+            client_drop(client);
+        }
+    }
+}
+
+// Thread di fan-out: invia ogni nuovo frame ai client del proprio shard
+static void* shard_thread(void* arg) {
+    Shard* shard = (Shard*)arg;
+    SharedFrame** frames = NULL;  // Frame presi dallo shard, con il loro canale
+    int* frame_channels = NULL;
+    int frames_capacity = 0;
+    bool flushing = false;  // Qualche client ha un frame da completare
+    
+    pthread_mutex_lock(&shard->mutex);
+    while (1) {
+        while (shard->num_pending == 0 && shard->num_alerts == 0) {
+            if (!flushing) {
+                pthread_cond_wait(&shard->cond, &shard->mutex);
+                continue;
+            }
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += SHARD_FLUSH_INTERVAL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&shard->cond, &shard->mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        
+        // Con il lock si prendono i frame in attesa e una copia dei client,
+        // ciascuno con un riferimento che ne tiene aperto il socket; l'invio
+        // avviene senza lock, così un client lento non blocca l'ingresso e
+        // l'uscita degli altri client dello shard
+        SharedFrame** alerts = shard->alerts;
+        int num_alerts = shard->num_alerts;
+        shard->alerts = NULL;
+        shard->num_alerts = 0;
+        shard->alerts_capacity = 0;
+        
+        if (frames_capacity < shard->num_pending) {
+            SharedFrame** grown_frames = realloc(frames, shard->pending_capacity * sizeof(SharedFrame*));
+            if (grown_frames) {
+                frames = grown_frames;
+            }
+            int* grown_channels = realloc(frame_channels, shard->pending_capacity * sizeof(int));
+            if (grown_channels) {
+                frame_channels = grown_channels;
+            }
+            if (grown_frames && grown_channels) {
+                frames_capacity = shard->pending_capacity;
+            }
+        }
+        
+        // Senza memoria per prenderli i frame si scartano: la prossima
+        // pubblicazione li sostituisce
+        int num_frames = 0;
+        for (int c = 0; c < shard->pending_capacity && shard->num_pending > 0; c++) {
+            if (shard->pending[c]) {
+                if (num_frames < frames_capacity) {
+                    frames[num_frames] = shard->pending[c];
+                    frame_channels[num_frames++] = c;
+                } else {
+                    release_frame(shard->pending[c]);
+                }
+                shard->pending[c] = NULL;
+                shard->num_pending--;
+            }
+        }
+        
+        if (shard->sending_capacity < shard->num_clients) {
+            Client** sending = realloc(shard->sending, shard->capacity * sizeof(Client*));
+            if (sending) {
+                shard->sending = sending;
+                shard->sending_capacity = shard->capacity;
+            }
+        }
+        int count = shard->num_clients <= shard->sending_capacity ? shard->num_clients : 0;
+        for (int i = 0; i < count; i++) {
+            shard->sending[i] = shard->clients[i];
+            atomic_fetch_add(&shard->sending[i]->refs, 1);
+        }
+        Client** clients = shard->sending;
+        pthread_mutex_unlock(&shard->mutex);
+        
+        // Prima si prosegue con i frame iniziati nei giri precedenti
+        uint64_t now = now_ns();
+        for (int i = 0; i < count; i++) {
+            if (!clients[i]->dropped && !client_write(clients[i], now)) {
+                client_drop(clients[i]);
+            }
+        }
+        
+        // Prima le transizioni di allarme, tutte e nell'ordine in cui sono avvenute
+        for (int a = 0; a < num_alerts; a++) {
+            send_to_clients(clients, count, alerts[a], SUBSCRIBE_ALERTS, -1);
+            release_frame(alerts[a]);
+        }
+        free(alerts);
+        
+        // Per ogni canale solo il frame più recente: gli altri sono già stati superati
+        for (int f = 0; f < num_frames; f++) {
+            send_to_clients(clients, count, frames[f], SUBSCRIBE_VALUES, frame_channels[f]);
+            release_frame(frames[f]);
+        }
+        
+        flushing = false;
+        for (int i = 0; i < count; i++) {
+            flushing |= clients[i]->partial != NULL && !clients[i]->dropped;
+            client_release(clients[i]);
+        }
+        pthread_mutex_lock(&shard->mutex);
+    }
+    
+    pthread_mutex_unlock(&shard->mutex);
+    return NULL;
+}
+
+// Crea gli shard e i relativi thread di fan-out
+static void init_shards(void) {
+    num_shards = server_config.fanout_threads;
+    if (num_shards <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_shards = cpus > 0 ? (int)cpus : 1;
+    }
+    if (num_shards > server_config.max_clients) {
+        num_shards = server_config.max_clients > 0 ? server_config.max_clients : 1;
+    }
+    
+    shards = calloc(num_shards, sizeof(Shard));
+    if (!shards) {
+        perror("Errore nell'allocazione della memoria per gli shard");
+        exit(1);
+    }
+    
+    for (int i = 0; i < num_shards; i++) {
+        pthread_mutex_init(&shards[i].mutex, NULL);
+        pthread_cond_init(&shards[i].cond, NULL);
+        if (pthread_create(&shards[i].thread, NULL, shard_thread, &shards[i]) != 0) {
+            perror("Errore nella creazione del thread di fan-out");
+            exit(1);
+        }
+        pthread_detach(shards[i].thread);
+    }
+    
+    if (server_config.verbose) {
+        printf("Fan-out su %d thread\n", num_shards);
+    }
+}
+
+// Aggiunge un client allo shard meno carico
+static bool add_client(Client* client) {
+    if (atomic_fetch_add(&num_clients, 1) >= server_config.max_clients) {
+        atomic_fetch_sub(&num_clients, 1);
+        return false;
+    }
+    
+    // La lettura dei contatori senza lock è solo indicativa per il bilanciamento
+    int target = 0;
+    for (int i = 1; i < num_shards; i++) {
+        if (shards[i].num_clients < shards[target].num_clients) {
+            target = i;
+        }
+    }
+    
+    Shard* shard = &shards[target];
+    pthread_mutex_lock(&shard->mutex);
+    
+    if (shard->num_clients == shard->capacity) {
+        int capacity = shard->capacity ? shard->capacity * 2 : 16;
+        Client** clients = realloc(shard->clients, capacity * sizeof(Client*));
+        if (!clients) {
+            pthread_mutex_unlock(&shard->mutex);
+            atomic_fetch_sub(&num_clients, 1);
+            return false;
+        }
+        shard->clients = clients;
+        shard->capacity = capacity;
+    }
+    
+    client->shard = target;
+    client->slot = shard->num_clients;
+    shard->clients[shard->num_clients++] = client;
+    
+    pthread_mutex_unlock(&shard->mutex);
+    
+    if (client->subscriptions & SUBSCRIBE_ALERTS) {
+        atomic_fetch_add(&num_alert_clients, 1);
+    }
+    return true;
+}
+
+// Rimuove un client dal suo shard in tempo costante
+static void remove_client(Client* client) {
+    Shard* shard = &shards[client->shard];
+    pthread_mutex_lock(&shard->mutex);
+    
+    // Sposta l'ultimo client nella posizione lasciata libera
+    Client* last = shard->clients[--shard->num_clients];
+    shard->clients[client->slot] = last;
+    last->slot = client->slot;
+    
+    pthread_mutex_unlock(&shard->mutex);
+    atomic_fetch_sub(&num_clients, 1);
+    
+    if (client->subscriptions & SUBSCRIBE_ALERTS) {
+        atomic_fetch_sub(&num_alert_clients, 1);
+    }
+}
+
+// Legge dalla query dell'URL WebSocket i flussi richiesti, il selettore
+// delle serie (GET /ws?subscribe=alerts, GET /ws?match=disk_used{host="n12"}),
+// il token e il nome della pagina (GET /ws?token=...&page=index2.html).
+// Senza ?token= vale quello di "Authorization: Bearer", per i client
+// senza pagina.
+static unsigned parse_websocket_url(const char* request, char* selector, size_t selector_size,
+                                    char* token, size_t token_size, char* page, size_t page_size) {
+    selector[0] = '\0';
+    token[0] = '\0';
+    page[0] = '\0';
+    const char* target = strchr(request, ' ');
+    const char* target_end = target ? strpbrk(target + 1, " \r\n") : NULL;
+    if (!target_end) {
+        return SUBSCRIBE_VALUES;
+    }
+    
+    char url[TOKEN_MAX + 512];
+    size_t length = target_end - (target + 1);
+    if (length >= sizeof(url)) {
+        length = sizeof(url) - 1;
+    }
+    memcpy(url, target + 1, length);
+    url[length] = '\0';
+    
+    char value[64];
+    const char* query = strchr(url, '?');
+    if (query) {
+        http_query_param(query + 1, "match", selector, selector_size);
+        http_query_param(query + 1, "token", token, token_size);
+        http_query_param(query + 1, "page", page, page_size);
+    }
+    if (token[0] == '\0') {
+        http_request_credential(request, token, token_size);
+    }
+    if (!query || !http_query_param(query + 1, "subscribe", value, sizeof(value))) {
+        return SUBSCRIBE_VALUES;
+    }
+    
+    unsigned subscriptions = 0;
+    char* saveptr = NULL;
+    for (char* item = strtok_r(value, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(item, "values") == 0) {
+            subscriptions |= SUBSCRIBE_VALUES;
+        } else if (strcmp(item, "alerts") == 0) {
+            subscriptions |= SUBSCRIBE_ALERTS;
+        }
+    }
+    return subscriptions ? subscriptions : SUBSCRIBE_VALUES;
+}
+
+// Invia a un client iscritto agli allarmi lo stato corrente delle metriche
+// con soglie autorizzate dal suo token, valutate per la sua pagina
+static void send_alert_states(int client_socket, int page, const char* allowed) {
+    StrBuf message;
+    strbuf_init(&message);
+    strbuf_appendf(&message, "{\"type\": \"alerts\", \"states\": {");
+    
+    int n = 0;
+    uint32_t count = metrics_count();
+    for (metric_id_t id = 0; id < count; id++) {
+        int level = alerts_level(id, page);
+        if (level >= 0 && token_allows(allowed, metrics_name(id))) {
+            if (n++) strbuf_append(&message, ", ", 2);
+            strbuf_append_json(&message, metrics_name(id));
+            strbuf_appendf(&message, ": \"%s\"", alerts_level_name(level));
+        }
     }
-    pthread_mutex_unlock(&clients_mutex);
+    strbuf_append(&message, "}}", 2);
+    
+    send_websocket_frame(client_socket, message.data, message.length);
+    strbuf_free(&message);
 }
 
 // Funzione per gestire ogni client in un thread separato
@@ -123,59 +854,87 @@ static void* handle_client(void* arg) {
             printf("Richiesta WebSocket ricevuta\n");
         }
         
-        int handshake_result = handle_websocket_handshake(client_socket, buffer);
+        char selector[256];
+        char token[TOKEN_MAX];
+        char page_name[256];
+        unsigned subscriptions = parse_websocket_url(buffer, selector, sizeof(selector),
+                                                     token, sizeof(token),
+                                                     page_name, sizeof(page_name));
+        int page = alerts_page(page_name);
         
-        if (handshake_result >= 0) {
+        // Serve un token valido, che limita il client alle metriche che
+        // autorizza; la verifica è solo crittografica, quindi vale per i
+        // token emessi da qualunque istanza con la stessa chiave
+        char* allowed = NULL;
+        if (!token_verify(token, &allowed)) {
             if (server_config.verbose) {
-                printf("Client %d connesso via WebSocket\n", client_socket);
+                printf("Client %d rifiutato: token assente, non valido o scaduto\n", client_socket);
             }
-            add_client(client_socket);
+            send_http_error(client_socket, 403, "Forbidden");
+            free(buffer);
+            close(client_socket);
+            return NULL;
+        }
+        
+        // I client con lo stesso selettore, la stessa pagina e le stesse
+        // metriche autorizzate condividono un canale; chi riceve solo gli
+        // allarmi non ne occupa nessuno
+        int channel = -1;
+        if ((subscriptions & SUBSCRIBE_VALUES) &&
+            (channel = channel_acquire(selector, page, allowed)) < 0) {
+            send_http_error(client_socket, 400, "Bad Request");
+            free(allowed);
+            free(buffer);
+            close(client_socket);
+            return NULL;
+        }
+        
+        // Gli invii a un client che non legge falliscono invece di bloccarsi
+        struct timeval send_timeout = {
+            .tv_sec = CLIENT_SEND_TIMEOUT_MS / 1000,
+            .tv_usec = (CLIENT_SEND_TIMEOUT_MS % 1000) * 1000
+        };
+        setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+        
+        int handshake_result = handle_websocket_handshake(client_socket, buffer);
+        
+        if (handshake_result >= 0 && (subscriptions & SUBSCRIBE_ALERTS)) {
+            send_alert_states(client_socket, page, allowed);
+        }
+        
+        if (handshake_result >= 0 && (subscriptions & SUBSCRIBE_VALUES)) {
+            // Invia subito le metriche correnti del canale al nuovo client
+            StrBuf init_message;
+            strbuf_init(&init_message);
+            current_metrics_message(channel, &init_message);
             
-            // Invia subito le metriche correnti al nuovo client
-            Metrics current;
-            metrics_get(&current);
-
-            // Crea il messaggio JSON
-            char init_message[1024] = "{";
-            char* p = init_message + 1;
-
-            // Aggiungi il timestamp
-            time_t now = time(NULL);
-            char time_str[32];
-            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&now));
-
-            p += snprintf(p, sizeof(init_message) - (p - init_message), 
-                         "\"timestamp\": \"%s\"", time_str);
-
-            // Aggiungi le metriche
-            for (int i = 0; i < current.count; i++) {
-                // Aggiungi virgola e spazio
-                *p++ = ',';
-                *p++ = ' ';
-
-                // Formatta il valore con precisione appropriata
-                char value_str[32];
-                // Se il valore è un intero, non mostrare decimali
-                if (current.metrics[i].value == (int)current.metrics[i].value) {
-                    snprintf(value_str, sizeof(value_str), "%d", (int)current.metrics[i].value);
-                } else {
-                    // Altrimenti mostra fino a 2 decimali
-                    snprintf(value_str, sizeof(value_str), "%.2f", current.metrics[i].value);
+            send_websocket_frame(client_socket, init_message.data, init_message.length);
+            strbuf_free(&init_message);
+        }
+        
+        if (handshake_result >= 0) {
+            // Il client entra nello shard solo dopo il messaggio iniziale,
+            // così i suoi frame non si intrecciano con quelli del fan-out
+            Client* client = malloc(sizeof(Client));
+            if (client) {
+                *client = (Client){ .socket = client_socket, .subscriptions = subscriptions,
+                                     .channel = channel, .page = page, .allowed = allowed };
+                atomic_init(&client->refs, 1);
+            }
+            if (!client || !add_client(client)) {
+                if (server_config.verbose) {
+                    printf("Client %d rifiutato: raggiunto il numero massimo di client\n", client_socket);
                 }
-
-                // Aggiungi "nome": {"value": valore, "unit": "unità"}
-                p += snprintf(p, sizeof(init_message) - (p - init_message), 
-                                "\"%s\": {\"value\": %s, \"unit\": \"%s\"}", 
-                                current.metrics[i].name, 
-                                value_str,
-                                current.metrics[i].unit);
+                free(client);
+                free(allowed);
+                channel_release(channel);
+                free(buffer);
+                close(client_socket);
+                return NULL;
+            }
+            if (server_config.verbose) {
+                printf("Client %d connesso via WebSocket\n", client_socket);
             }
-
-            // Chiudi il JSON
-            *p++ = '}';
-            *p = '\0';
-            
-            send_websocket_frame(client_socket, init_message, strlen(init_message));
             
             // Loop principale per il client WebSocket
             unsigned char* ws_buffer = malloc(server_config.buffer_size);
@@ -189,11 +948,19 @@ static void* handle_client(void* arg) {
             if (server_config.verbose) {
                 printf("Client %d disconnesso\n", client_socket);
             }
-            remove_client(client_socket);
+            remove_client(client);
+            channel_release(channel);
+            
+            // Il socket viene chiuso qui o, se uno shard lo sta usando, al termine dell'invio
+            client_release(client);
+            free(buffer);
+            return NULL;
         }
+        free(allowed);
+        channel_release(channel);
     } else {
         // Gestisci come normale richiesta HTTP
-        handle_http_request(client_socket, buffer);
+        handle_http_request(client_socket, buffer, bytes_read);
     }
 
     free(buffer);
@@ -201,22 +968,121 @@ static void* handle_client(void* arg) {
     return NULL;
 }
 
+// Costruisce il frame una sola volta e lo consegna agli shard per un canale
+static void deliver_frame(int channel, const char* message, size_t length, uint64_t start_ns) {
+    SharedFrame* frame = malloc(sizeof(SharedFrame));
+    if (!frame) {
+        return;
+    }
+    
+    frame->start_ns = start_ns;
+    frame->data = build_websocket_frame(message, length, &frame->length);
+    if (!frame->data) {
+        free(frame);
+        return;
+    }
+    atomic_init(&frame->refs, num_shards);
+    
+    for (int i = 0; i < num_shards; i++) {
+        Shard* shard = &shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        
+        // La tabella dei frame in attesa cresce con i canali
+        if (channel >= shard->pending_capacity) {
+            int capacity = shard->pending_capacity ? shard->pending_capacity : 16;
+            while (capacity <= channel) capacity *= 2;
+            SharedFrame** pending = realloc(shard->pending, capacity * sizeof(SharedFrame*));
+            if (!pending) {
+                pthread_mutex_unlock(&shard->mutex);
+                release_frame(frame);
+                continue;
+            }
+            memset(pending + shard->pending_capacity, 0,
+                   (capacity - shard->pending_capacity) * sizeof(SharedFrame*));
+            shard->pending = pending;
+            shard->pending_capacity = capacity;
+        }
+        
+        // Un frame non ancora inviato è superato da quello nuovo
+        SharedFrame* stale = shard->pending[channel];
+        shard->pending[channel] = frame;
+        if (!stale) {
+            shard->num_pending++;
+        }
+        pthread_cond_signal(&shard->cond);
+        
+        pthread_mutex_unlock(&shard->mutex);
+        
+        if (stale) {
+            release_frame(stale);
+        }
+    }
+}
+
+// Invia un messaggio a tutti i client senza selettore
 void broadcast_to_clients(const char* message) {
-    pthread_mutex_lock(&clients_mutex);
     if (server_config.verbose) {
-        printf("Broadcasting to %d clients\n", num_clients);
+        printf("Broadcasting to %d clients\n", atomic_load(&num_clients));
+    }
+    
+    deliver_frame(0, message, strlen(message), now_ns());
+}
+
+// Callback per le transizioni di allarme (eseguito dal thread di pubblicazione).
+// Ogni transizione diventa un frame compatto accodato a tutti gli shard.
+static void alerts_updated_callback(const AlertEvent* events, int count) {
+    if (atomic_load(&num_alert_clients) == 0) {
+        return;
     }
     
-    for (int i = 0; i < num_clients; i++) {
-        int result = send_websocket_frame(client_sockets[i], message, strlen(message));
-        if (result < 0 && server_config.verbose) {
-            printf("Errore nell'invio al client %d\n", client_sockets[i]);
+    for (int e = 0; e < count; e++) {
+        const AlertEvent* event = &events[e];
+        StrBuf message;
+        strbuf_init(&message);
+        strbuf_append(&message, "{\"type\": \"alert\", \"metric\": ", 28);
+        strbuf_append_json(&message, metrics_name(event->id));
+        strbuf_appendf(&message, ", \"state\": \"%s\", \"previous\": \"%s\", \"value\": %.15g, \"ts\": %lld}",
+                       alerts_level_name(event->to), alerts_level_name(event->from),
+                       event->value, (long long)event->ts_ms);
+        
+        SharedFrame* frame = malloc(sizeof(SharedFrame));
+        if (!frame) {
+            strbuf_free(&message);
+            return;
+        }
+        frame->start_ns = 0;  // Il fan-out misurato è quello dei valori
+        frame->event = *event;
+        frame->data = build_websocket_frame(message.data, message.length, &frame->length);
+        strbuf_free(&message);
+        if (!frame->data) {
+            free(frame);
+            return;
+        }
+        atomic_init(&frame->refs, num_shards);
+        
+        for (int i = 0; i < num_shards; i++) {
+            Shard* shard = &shards[i];
+            pthread_mutex_lock(&shard->mutex);
+            
+            if (shard->num_alerts == shard->alerts_capacity) {
+                int capacity = shard->alerts_capacity ? shard->alerts_capacity * 2 : 16;
+                SharedFrame** alerts = realloc(shard->alerts, capacity * sizeof(SharedFrame*));
+                if (!alerts) {
+                    pthread_mutex_unlock(&shard->mutex);
+                    release_frame(frame);
+                    continue;
+                }
+                shard->alerts = alerts;
+                shard->alerts_capacity = capacity;
+            }
+            shard->alerts[shard->num_alerts++] = frame;
+            pthread_cond_signal(&shard->cond);
+            
+            pthread_mutex_unlock(&shard->mutex);
         }
     }
-    pthread_mutex_unlock(&clients_mutex);
 }
 
-
 void update_metrics(int value1, int value2) {
     // Utilizza il modulo metrics per aggiornare i valori
     metrics_update(value1, value2);
@@ -225,15 +1091,13 @@ void update_metrics(int value1, int value2) {
 // Funzione principale del server
 void* start_server(void* arg) {
 
-    // Alloca l'array dei client
-    client_sockets = malloc(server_config.max_clients * sizeof(int));
-    if (!client_sockets) {
-        perror("Errore nell'allocazione della memoria per i client");
-        exit(1);
-    }
+    // Crea gli shard dei client e i thread di fan-out
+    init_shards();
+    init_channels();
 
     // Registra il callback per le metriche
     metrics_register_callback(metrics_updated_callback);
+    publisher_set_alert_callback(alerts_updated_callback);
 
     struct sockaddr_in server_addr;
     
@@ -261,7 +1125,7 @@ void* start_server(void* arg) {
     }
     
     // Listen
-    if (listen(server_socket, 5) < 0) {
+    if (listen(server_socket, SOMAXCONN) < 0) {
         perror("Errore nella listen");
         exit(1);
     }
@@ -301,7 +1165,6 @@ void* start_server(void* arg) {
     }
     
     // Pulizia (questo codice non viene mai raggiunto in questa implementazione)
-    free(client_sockets);
     return NULL;
 }
 
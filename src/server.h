@@ -18,6 +18,7 @@ typedef struct {
     int max_clients;
     int buffer_size;
     char www_root[256];
+    int fanout_threads;  // Thread di invio ai client (0 = uno per CPU)
     bool verbose;
 } ServerConfig;
 
@@ -0,0 +1,109 @@
+// shmexport.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shmexport.h"
+#include "utils.h"
+
+static ShmExportHeader* table = NULL;
+static char table_path[256];
+static uint32_t table_count = 0;
+
+bool shmexport_open(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("Errore nell'apertura del file di esportazione");
+        return false;
+    }
+
+    // Il file resta sparso: le pagine si occupano solo per gli slot usati
+    size_t size = shmexport_size(SHMEXPORT_SLOTS);
+    if (ftruncate(fd, (off_t)size) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return false;
+    }
+
+    ShmExportHeader* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+
+    mapped->version = SHMEXPORT_VERSION;
+    mapped->slots = SHMEXPORT_SLOTS;
+    mapped->entry_size = sizeof(ShmExportEntry);
+    mapped->pid = (uint32_t)getpid();
+    mapped->updated_ms = wall_clock_ms();
+    atomic_store_explicit(&mapped->sequence, 0, memory_order_relaxed);
+    atomic_store_explicit(&mapped->magic, SHMEXPORT_MAGIC, memory_order_release);
+
+    snprintf(table_path, sizeof(table_path), "%s", path);
+    table = mapped;
+    return true;
+}
+
+// Unica scrittura della tabella: solo le voci con una nuova versione
+void shmexport_write(const Metrics* metrics) {
+    if (!table) {
+        return;
+    }
+
+    uint64_t seq = atomic_load_explicit(&table->sequence, memory_order_relaxed);
+    atomic_store_explicit(&table->sequence, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for (int i = 0; i < metrics->count; i++) {
+        const Metric* m = &metrics->metrics[i];
+        if (m->id >= SHMEXPORT_SLOTS) {
+            static bool warned = false;
+            if (!warned) {
+                fprintf(stderr, "Esportazione: oltre %d metriche, le successive non vengono esportate\n",
+                        SHMEXPORT_SLOTS);
+                warned = true;
+            }
+            continue;
+        }
+
+        ShmExportEntry* entry = &table->entries[m->id];
+        if (entry->version == m->version) {
+            continue;  // Invariata dall'ultima scrittura
+        }
+
+        // Il nome non cambia mai per un id: si scrive al primo aggiornamento
+        if (entry->name[0] == '\0') {
+            if (strlen(m->name) >= SHMEXPORT_NAME_MAX) {
+                continue;  // Un nome troncato sarebbe ambiguo
+            }
+            strcpy(entry->name, m->name);
+        }
+        if (strncmp(entry->unit, m->unit, SHMEXPORT_UNIT_MAX) != 0) {
+            strncpy(entry->unit, m->unit, SHMEXPORT_UNIT_MAX - 1);
+        }
+        entry->value = m->value;
+        entry->version = m->version;
+
+        if (m->id >= table_count) {
+            table_count = m->id + 1;
+        }
+    }
+
+    table->count = table_count;
+    table->generation = metrics->generation;
+    table->updated_ms = wall_clock_ms();
+
+    atomic_store_explicit(&table->sequence, seq + 2, memory_order_release);
+}
+
+void shmexport_close(void) {
+    if (!table) {
+        return;
+    }
+
+    // I lettori che hanno ancora il file mappato vedono magic a 0
+    atomic_store_explicit(&table->magic, 0, memory_order_release);
+    munmap(table, shmexport_size(SHMEXPORT_SLOTS));
+    table = NULL;
+    unlink(table_path);
+}
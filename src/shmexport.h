@@ -0,0 +1,138 @@
+// shmexport.h
+#ifndef SHMEXPORT_H
+#define SHMEXPORT_H
+
+// Tabella delle metriche esportata in un file mappato in memoria (es.
+// /dev/shm/swsws.metrics) per i lettori locali. Il server è l'unico
+// scrittore; i lettori mappano il file in sola lettura e leggono senza
+// lock né chiamate di sistema, con le funzioni inline qui sotto:
+//
+//   const ShmExportHeader* table = shmexport_map("/dev/shm/swsws.metrics");
+//   int slot = shmexport_find(table, "cpu");        // una volta: lo slot è stabile
+//   double cpu;
+//   if (slot >= 0 && shmexport_value(table, slot, &cpu, NULL)) ...
+//
+// Layout (little endian, come la macchina che lo scrive):
+//   intestazione ShmExportHeader, allineata a 64 byte
+//   slots voci ShmExportEntry da entry_size byte; lo slot è l'id della
+//   metrica, quindi non cambia finché il server resta in esecuzione
+//
+// Protocollo di lettura (seqlock): leggere sequence; se dispari riprovare;
+// copiare i dati; rileggere sequence: se è cambiata la copia va rifatta.
+// generation cresce a ogni aggiornamento; magic torna a 0 alla chiusura
+// del server.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "metrics.h"
+
+#define SHMEXPORT_MAGIC 0x58575353u  // "SSWX"
+#define SHMEXPORT_VERSION 1
+#define SHMEXPORT_SLOTS 65536        // Metriche esportate (id 0 .. SHMEXPORT_SLOTS - 1)
+#define SHMEXPORT_NAME_MAX 112
+#define SHMEXPORT_UNIT_MAX 16
+#define SHMEXPORT_READ_RETRIES 1000
+
+typedef struct {
+    char name[SHMEXPORT_NAME_MAX];  // "" = slot non ancora usato
+    char unit[SHMEXPORT_UNIT_MAX];
+    double value;
+    uint64_t version;               // Generazione dell'ultimo aggiornamento
+} ShmExportEntry;
+
+typedef struct {
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t entry_size;
+    _Atomic uint64_t sequence;      // Seqlock: dispari durante una scrittura
+    uint64_t generation;            // Generazione del registro copiata
+    int64_t updated_ms;             // Ultima scrittura, ms dall'epoca Unix
+    uint32_t count;                 // Slot in uso: 0 .. count - 1
+    uint32_t pid;                   // Processo del server
+
+    _Alignas(64) ShmExportEntry entries[];
+} ShmExportHeader;
+
+static inline size_t shmexport_size(uint32_t slots) {
+    return sizeof(ShmExportHeader) + (size_t)slots * sizeof(ShmExportEntry);
+}
+
+// Lettori: mappa il file in sola lettura; NULL se manca o non è valido
+static inline const ShmExportHeader* shmexport_map(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmExportHeader)) {
+        close(fd);
+        return NULL;
+    }
+    const ShmExportHeader* table = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {
+        return NULL;
+    }
+    if (atomic_load_explicit(&table->magic, memory_order_acquire) != SHMEXPORT_MAGIC ||
+        table->version != SHMEXPORT_VERSION || table->entry_size != sizeof(ShmExportEntry) ||
+        shmexport_size(table->slots) > (size_t)st.st_size) {
+        munmap((void*)table, st.st_size);
+        return NULL;
+    }
+    return table;
+}
+
+// Slot della metrica name, -1 se non esportata
+static inline int shmexport_find(const ShmExportHeader* table, const char* name) {
+    uint32_t count = table->count;
+    for (uint32_t slot = 0; slot < count && slot < table->slots; slot++) {
+        if (strncmp(table->entries[slot].name, name, SHMEXPORT_NAME_MAX) == 0) {
+            return (int)slot;
+        }
+    }
+    return -1;
+}
+
+// Copia coerente del valore (e della generazione) di uno slot
+static inline bool shmexport_value(const ShmExportHeader* table, int slot, double* value, uint64_t* version) {
+    if (slot < 0 || (uint32_t)slot >= table->slots) {
+        return false;
+    }
+    for (int attempt = 0; attempt < SHMEXPORT_READ_RETRIES; attempt++) {
+        uint64_t before = atomic_load_explicit(&table->sequence, memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        double v = table->entries[slot].value;
+        uint64_t ver = table->entries[slot].version;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&table->sequence, memory_order_relaxed) == before) {
+            *value = v;
+            if (version) {
+                *version = ver;
+            }
+            return ver != 0;
+        }
+    }
+    return false;
+}
+
+// Lato server (implementato in shmexport.c)
+
+// Crea il file e lo dimensiona per SHMEXPORT_SLOTS metriche
+bool shmexport_open(const char* path);
+
+// Copia nella tabella le metriche cambiate (thread di pubblicazione)
+void shmexport_write(const Metrics* metrics);
+
+// Segna la tabella come chiusa e rimuove il file
+void shmexport_close(void);
+
+#endif
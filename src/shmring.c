@@ -0,0 +1,148 @@
+// shmring.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "shmring.h"
+#include "metrics.h"
+#include "utils.h"
+
+#define SHMRING_RELEASE_EVERY 256  // Record letti prima di liberare spazio al produttore
+
+struct ShmReader {
+    ShmRing* ring;
+    size_t size;
+    uint64_t dropped;  // Ultimo valore di ring->dropped già segnalato
+
+    // Id nel registro dei nomi dichiarati e loro versione
+    metric_id_t ids[SHMRING_MAX_NAMES];
+    uint32_t sequences[SHMRING_MAX_NAMES];
+};
+
+ShmReader* shmring_open(const char* name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            perror("shm_open");
+        }
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmRing)) {
+        close(fd);
+        return NULL;  // Il produttore non l'ha ancora dimensionato
+    }
+
+    ShmRing* ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    // Il magic viene scritto per ultimo: senza, l'inizializzazione non è finita
+    uint32_t capacity = ring->capacity;
+    if (atomic_load_explicit(&ring->magic, memory_order_acquire) != SHMRING_MAGIC ||
+        ring->version != SHMRING_VERSION || ring->record_size != sizeof(ShmRingRecord) ||
+        capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        shmring_size(capacity) > (size_t)st.st_size) {
+        munmap(ring, st.st_size);
+        return NULL;
+    }
+
+    ShmReader* reader = calloc(1, sizeof(ShmReader));
+    if (!reader) {
+        munmap(ring, st.st_size);
+        return NULL;
+    }
+    reader->ring = ring;
+    reader->size = st.st_size;
+    reader->dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    for (int i = 0; i < SHMRING_MAX_NAMES; i++) {
+        reader->ids[i] = METRIC_ID_INVALID;
+    }
+
+    // I campioni accodati prima dell'avvio sono vecchi: si parte da head
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+    return reader;
+}
+
+// Id nel registro del nome dichiarato con l'indice index; registra il nome
+// alla prima occorrenza o quando il produttore lo ridichiara
+static metric_id_t resolve(ShmReader* reader, uint32_t index) {
+    if (index >= SHMRING_MAX_NAMES) {
+        return METRIC_ID_INVALID;
+    }
+
+    ShmRingName* entry = &reader->ring->names[index];
+    uint32_t sequence = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+    if (sequence == reader->sequences[index] || (sequence & 1)) {
+        return reader->ids[index];  // Invariato o in riscrittura
+    }
+
+    char name[SHMRING_NAME_MAX];
+    char unit[SHMRING_UNIT_MAX];
+    memcpy(name, entry->name, sizeof(name));
+    memcpy(unit, entry->unit, sizeof(unit));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&entry->sequence, memory_order_relaxed) != sequence) {
+        return reader->ids[index];
+    }
+    name[sizeof(name) - 1] = '\0';
+    unit[sizeof(unit) - 1] = '\0';
+
+    reader->ids[index] = name[0] ? metrics_register(name, unit) : METRIC_ID_INVALID;
+    reader->sequences[index] = sequence;
+    return reader->ids[index];
+}
+
+int shmring_drain(ShmReader* reader) {
+    ShmRing* ring = reader->ring;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (head == tail) {
+        return 0;
+    }
+    if (head - tail > ring->capacity) {
+        tail = head - ring->capacity;  // Produttore non conforme: resta l'ultimo giro
+    }
+
+    uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    if (dropped != reader->dropped) {
+        fprintf(stderr, "Anello in memoria condivisa pieno: %llu campioni persi\n",
+                (unsigned long long)(dropped - reader->dropped));
+        reader->dropped = dropped;
+    }
+
+    int count = (int)(head - tail);
+    int64_t now_ms = wall_clock_ms();
+    uint64_t mask = ring->capacity - 1;
+
+    metrics_batch_begin();
+    while (tail != head) {
+        const ShmRingRecord* record = &ring->records[tail & mask];
+        metric_id_t id = resolve(reader, record->id);
+        if (id != METRIC_ID_INVALID) {
+            metrics_set_id_at(id, record->value, record->timestamp_ms ? record->timestamp_ms : now_ms);
+        }
+
+        // Libera lo spazio letto anche durante uno svuotamento lungo
+        if (++tail % SHMRING_RELEASE_EVERY == 0) {
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        }
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    metrics_batch_end();
+
+    return count;
+}
+
+void shmring_reader_close(ShmReader* reader) {
+    if (!reader) {
+        return;
+    }
+    munmap(reader->ring, reader->size);
+    free(reader);
+}
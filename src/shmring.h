@@ -0,0 +1,159 @@
+// shmring.h
+#ifndef SHMRING_H
+#define SHMRING_H
+
+// Anello in memoria condivisa POSIX tra un produttore sulla stessa macchina
+// e la fonte shm: (un solo produttore e un solo consumatore). Il produttore
+// include questo file e usa solo le funzioni inline, che non dipendono dal
+// resto del server:
+//
+//   ShmRing* ring = shmring_create("/daq", 4096);
+//   shmring_declare(ring, 0, "pressure", "bar");
+//   shmring_push(ring, 0, 1.013, 0);
+//
+// Nessuna chiamata di sistema nel percorso caldo: il produttore scrive il
+// record e avanza head, il consumatore legge fino a head e avanza tail.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHMRING_MAGIC 0x52575353u  // "SSWR"
+#define SHMRING_VERSION 1
+#define SHMRING_MAX_NAMES 1024     // Metriche dichiarabili da un produttore
+#define SHMRING_NAME_MAX 116
+#define SHMRING_UNIT_MAX 16
+
+// Campione: indice della metrica dichiarata, valore e istante
+typedef struct {
+    uint32_t id;
+    uint32_t reserved;
+    double value;
+    int64_t timestamp_ms;  // ms dall'epoca Unix; 0 = istante della lettura
+} ShmRingRecord;
+
+// Nome di una metrica; sequence è dispari mentre il produttore lo riscrive
+typedef struct {
+    _Atomic uint32_t sequence;
+    char unit[SHMRING_UNIT_MAX];
+    char name[SHMRING_NAME_MAX];
+} ShmRingName;
+
+typedef struct {
+    _Atomic uint32_t magic;      // Scritto per ultimo, a inizializzazione completa
+    uint32_t version;
+    uint32_t capacity;           // Record nell'anello, potenza di 2
+    uint32_t record_size;
+
+    _Alignas(64) _Atomic uint64_t head;     // Scritto solo dal produttore
+    _Atomic uint64_t dropped;               // Campioni persi ad anello pieno
+    _Alignas(64) _Atomic uint64_t tail;     // Scritto solo dal consumatore
+
+    _Alignas(64) ShmRingName names[SHMRING_MAX_NAMES];
+    ShmRingRecord records[];
+} ShmRing;
+
+static inline size_t shmring_size(uint32_t capacity) {
+    return sizeof(ShmRing) + (size_t)capacity * sizeof(ShmRingRecord);
+}
+
+// Crea il segmento (o si riattacca a uno esistente con la stessa capacità);
+// capacity viene arrotondata alla potenza di 2 successiva
+static inline ShmRing* shmring_create(const char* name, uint32_t capacity) {
+    uint32_t size = 1;
+    while (size < capacity && size < (1u << 30)) {
+        size <<= 1;
+    }
+    capacity = size;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0660);
+    if (fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size != 0 && (size_t)st.st_size != shmring_size(capacity)) ||
+        (st.st_size == 0 && ftruncate(fd, (off_t)shmring_size(capacity)) != 0)) {
+        fprintf(stderr, "shmring: segmento %s non utilizzabile con capacità %u\n", name, capacity);
+        close(fd);
+        return NULL;
+    }
+
+    ShmRing* ring = mmap(NULL, shmring_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    if (atomic_load_explicit(&ring->magic, memory_order_acquire) != SHMRING_MAGIC) {
+        ring->version = SHMRING_VERSION;
+        ring->capacity = capacity;
+        ring->record_size = sizeof(ShmRingRecord);
+        atomic_store_explicit(&ring->magic, SHMRING_MAGIC, memory_order_release);
+    } else if (ring->version != SHMRING_VERSION || ring->capacity != capacity) {
+        fprintf(stderr, "shmring: segmento %s di una versione diversa\n", name);
+        munmap(ring, shmring_size(capacity));
+        return NULL;
+    }
+    return ring;
+}
+
+// Associa un nome (con etichette, es. temp{probe="3"}) e un'unità all'indice id
+static inline bool shmring_declare(ShmRing* ring, uint32_t id, const char* name, const char* unit) {
+    if (id >= SHMRING_MAX_NAMES || strlen(name) >= SHMRING_NAME_MAX ||
+        strlen(unit ? unit : "") >= SHMRING_UNIT_MAX) {
+        return false;
+    }
+
+    ShmRingName* entry = &ring->names[id];
+    uint32_t sequence = atomic_load_explicit(&entry->sequence, memory_order_relaxed);
+    atomic_store_explicit(&entry->sequence, sequence | 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    strncpy(entry->name, name, SHMRING_NAME_MAX);
+    strncpy(entry->unit, unit ? unit : "", SHMRING_UNIT_MAX);
+    atomic_store_explicit(&entry->sequence, (sequence | 1) + 1, memory_order_release);
+    return true;
+}
+
+// Accoda un campione; false (e dropped incrementato) se l'anello è pieno
+static inline bool shmring_push(ShmRing* ring, uint32_t id, double value, int64_t timestamp_ms) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= ring->capacity) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    ShmRingRecord* record = &ring->records[head & (ring->capacity - 1)];
+    record->id = id;
+    record->reserved = 0;
+    record->value = value;
+    record->timestamp_ms = timestamp_ms;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+static inline void shmring_close(ShmRing* ring) {
+    munmap(ring, shmring_size(ring->capacity));
+}
+
+// Lato consumatore (fonte shm:, implementato in shmring.c)
+typedef struct ShmReader ShmReader;
+
+// Si collega al segmento name; NULL se non esiste ancora o non è valido
+ShmReader* shmring_open(const char* name);
+
+// Pubblica in un unico batch i campioni accodati; restituisce quanti
+int shmring_drain(ShmReader* reader);
+
+void shmring_reader_close(ShmReader* reader);
+
+#endif
@@ -0,0 +1,993 @@
+// sources.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include "sources.h"
+#include "metrics.h"
+#include "procfs.h"
+#include "shmring.h"
+#include "lineproto.h"
+#include "upstream.h"
+#include "utils.h"
+
+#define SOURCE_LINE_MAX 65536         // Lunghezza massima di una riga (tail, stream)
+#define SOURCE_OUTPUT_MAX (1 << 20)   // Output massimo di un comando per esecuzione
+#define CMD_TIMEOUT_MS 30000          // Durata massima di un comando cmd:
+
+// Fonte stream: blocchi di righe chiusi da una riga vuota o da "---"
+#define STREAM_BATCH_TIMEOUT_MS 1000   // Silenzio dopo cui un blocco incompleto viene pubblicato
+#define STREAM_IDLE_TIMEOUT_MS 60000   // Silenzio dopo cui il figlio viene considerato bloccato
+#define STREAM_MIN_BACKOFF_MS 1000
+#define STREAM_MAX_BACKOFF_MS 30000
+#define STREAM_TERM_TIMEOUT_MS 1000    // Attesa dopo SIGTERM prima di SIGKILL
+#define STREAM_TERM_POLL_MS 100        // Controllo dell'uscita durante l'attesa
+
+#define UPSTREAM_CONNECT_TIMEOUT_MS 10000  // Connessione e handshake verso un'istanza a monte
+
+typedef enum {
+    SOURCE_SIM,
+    SOURCE_FILE,
+    SOURCE_TAIL,
+    SOURCE_CMD,
+    SOURCE_STREAM,
+    SOURCE_PROC,
+    SOURCE_SHM,
+    SOURCE_UPSTREAM
+} SourceType;
+
+// Stato di una fonte; usato solo dal thread di acquisizione
+typedef struct {
+    SourceType type;
+    char spec[256];       // Testo originale, per i messaggi
+    char target[256];     // Percorso o comando
+    int interval_ms;
+    bool interval_set;    // Intervallo indicato esplicitamente
+
+    int timer_fd;         // Scadenze periodiche o, per stream e upstream, timeout e riavvii
+    int watch_fd;         // inotify (file, tail)
+
+    // Processo figlio (cmd, stream)
+    pid_t pid;
+    int pipe_fd;
+    int64_t started_ms;
+    int backoff_ms;       // Attesa prima del prossimo riavvio (stream, upstream)
+    bool productive;      // Il figlio ha prodotto almeno un blocco completo
+    int64_t term_deadline_ms;  // stream: SIGTERM inviato, SIGKILL da questo istante (0 = no)
+    StrBuf output;        // Output del comando o righe del blocco corrente
+
+    // Riga incompleta in attesa del suo newline (tail, stream)
+    char* buffer;
+    size_t pending;
+
+    // file: hash dell'ultimo contenuto, per saltare quelli identici
+    uint64_t hash;
+    bool loaded;
+
+    // tail: file aperto, inode e posizione
+    int tail_fd;
+    ino_t inode;
+    off_t offset;
+    bool tail_started;    // Il file è già stato cercato almeno una volta
+
+    int counter;          // sim
+    ProcFs* procfs;       // proc
+    ShmReader* shm;       // shm
+    bool shm_waiting;     // shm: attesa del segmento già segnalata
+    Upstream* upstream;   // upstream
+    int socket_fd;
+} Source;
+
+// Descrittori registrati in epoll: indice della fonte e ruolo
+enum { EVENT_TIMER, EVENT_WATCH, EVENT_PIPE, EVENT_SOCKET };
+#define EVENT_WAKEUP UINT64_MAX
+
+extern char** environ;
+
+static Source sources[SOURCES_MAX];
+static int num_sources = 0;
+static int epoll_fd = -1;
+static int wakeup_pipe[2] = { -1, -1 };  // Sveglia il thread all'arresto
+static pthread_t collection_thread;
+static volatile bool collection_running = false;
+
+// Legge un suffisso "@250ms", "@10s" o "@1m"; false se non è un intervallo
+static bool parse_interval(const char* text, int* interval_ms) {
+    char* end;
+    long value = strtol(text, &end, 10);
+    if (end == text || value <= 0) {
+        return false;
+    }
+
+    if (strcmp(end, "ms") == 0) {
+        *interval_ms = (int)value;
+    } else if (strcmp(end, "s") == 0 || *end == '\0') {
+        *interval_ms = (int)(value * 1000);
+    } else if (strcmp(end, "m") == 0) {
+        *interval_ms = (int)(value * 60000);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool sources_add(const char* spec) {
+    static const struct { const char* prefix; SourceType type; } types[] = {
+        { "sim:", SOURCE_SIM },
+        { "file:", SOURCE_FILE },
+        { "tail:", SOURCE_TAIL },
+        { "cmd:", SOURCE_CMD },
+        { "stream:", SOURCE_STREAM },
+        { "proc:", SOURCE_PROC },
+        { "shm:", SOURCE_SHM },
+        { "upstream:", SOURCE_UPSTREAM },
+    };
+
+    if (num_sources == SOURCES_MAX) {
+        fprintf(stderr, "Troppe fonti di metriche (massimo %d)\n", SOURCES_MAX);
+        return false;
+    }
+
+    Source* source = &sources[num_sources];
+    memset(source, 0, sizeof(*source));
+
+    size_t prefix_length = 0;
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        prefix_length = strlen(types[i].prefix);
+        if (strncmp(spec, types[i].prefix, prefix_length) == 0) {
+            source->type = types[i].type;
+            break;
+        }
+        prefix_length = 0;
+    }
+    if (prefix_length == 0) {
+        fprintf(stderr, "Fonte di metriche sconosciuta: %s\n", spec);
+        return false;
+    }
+
+    snprintf(source->spec, sizeof(source->spec), "%s", spec);
+    snprintf(source->target, sizeof(source->target), "%s", spec + prefix_length);
+    source->interval_ms = SOURCE_DEFAULT_INTERVAL_MS;
+
+    // Un '@' seguito da qualcosa che non è un intervallo fa parte dell'argomento
+    char* at = strrchr(source->target, '@');
+    if (at && parse_interval(at + 1, &source->interval_ms)) {
+        *at = '\0';
+        source->interval_set = true;
+    }
+
+    source->timer_fd = -1;
+    source->watch_fd = -1;
+    source->pipe_fd = -1;
+    source->tail_fd = -1;
+    source->pid = -1;
+    source->socket_fd = -1;
+    source->backoff_ms = STREAM_MIN_BACKOFF_MS;
+    strbuf_init(&source->output);
+
+    // Un URL non valido è un errore di configurazione: lo si segnala subito
+    if (source->type == SOURCE_UPSTREAM) {
+        source->upstream = upstream_create(source->target);
+        if (!source->upstream) {
+            return false;
+        }
+    }
+
+    num_sources++;
+    return true;
+}
+
+// Divide in righe i byte appena letti nel buffer della fonte; la riga
+// incompleta finale resta all'inizio del buffer
+static void split_lines(Source* source, size_t length, void (*handle)(Source*, char*)) {
+    char* start = source->buffer;
+    char* end = source->buffer + source->pending + length;
+    char* newline;
+    while ((newline = memchr(start, '\n', end - start))) {
+        *newline = '\0';
+        handle(source, start);
+        start = newline + 1;
+    }
+
+    source->pending = end - start;
+    memmove(source->buffer, start, source->pending);
+}
+
+// Spazio libero nel buffer delle righe; una riga che lo riempie viene scartata
+static size_t line_space(Source* source) {
+    if (source->pending == SOURCE_LINE_MAX) {
+        fprintf(stderr, "Riga troppo lunga nella fonte %s, scartata\n", source->spec);
+        source->pending = 0;
+    }
+    return SOURCE_LINE_MAX - source->pending;
+}
+
+// Arma il timer della fonte: periodico o a scadenza singola (0 lo disarma)
+static void timer_arm(Source* source, int ms, bool periodic) {
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = (ms % 1000) * 1000000L;
+    if (periodic) {
+        spec.it_interval = spec.it_value;
+    }
+    if (timerfd_settime(source->timer_fd, 0, &spec, NULL) != 0) {
+        perror("timerfd_settime");
+    }
+}
+
+// Registra un descrittore in epoll con l'indice della fonte e il ruolo
+static bool watch_fd(Source* source, int fd, int role) {
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.u64 = (uint64_t)(source - sources) << 2 | role
+    };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+// Avvia "sh -c command" con lo stdout collegato a una pipe non bloccante,
+// in un gruppo di processi proprio così da poter terminare anche i
+// processi della shell
+static pid_t spawn_command(const char* command, int* out_fd) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    pid_t pid;
+    char* argv[] = { "sh", "-c", (char*)command, NULL };
+    int error = posix_spawn(&pid, "/bin/sh", &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+
+    if (error != 0) {
+        fprintf(stderr, "posix_spawn: %s\n", strerror(error));
+        close(fds[0]);
+        return -1;
+    }
+
+    *out_fd = fds[0];
+    return pid;
+}
+
+// Termina subito il gruppo del figlio e lo raccoglie
+static void kill_child(Source* source) {
+    if (source->pipe_fd >= 0) {
+        close(source->pipe_fd);
+        source->pipe_fd = -1;
+    }
+    if (source->pid > 0) {
+        kill(-source->pid, SIGKILL);
+        waitpid(source->pid, NULL, 0);
+        source->pid = -1;
+    }
+}
+
+// All'arresto il figlio ha un secondo per uscire da solo
+static void stop_child(Source* source) {
+    if (source->pid > 0) {
+        kill(-source->pid, SIGTERM);
+        for (int i = 0; i < 10; i++) {
+            if (waitpid(source->pid, NULL, WNOHANG) == source->pid) {
+                source->pid = -1;
+                break;
+            }
+            usleep(100000);
+        }
+    }
+    kill_child(source);
+}
+
+// --- sim: valori simulati a ogni scadenza ---
+
+static void sim_tick(Source* source) {
+    source->counter = (source->counter + 1) % 1000;
+    int counter = source->counter;
+
+    metrics_batch_begin();
+    metrics_set("cpu", counter);
+    metrics_set("memory", 100 + (counter % 50));
+    metrics_set("disk", 200 + (counter % 30));
+    metrics_set("network", 300 + (counter % 70));
+    metrics_batch_end();
+}
+
+// --- file: rilettura completa quando il file cambia ---
+
+// Scarta la riga incompleta in fondo a un output tagliato a
+// SOURCE_OUTPUT_MAX, così una riga spezzata non viene interpretata
+static void cut_to_last_line(StrBuf* output) {
+    while (output->length > 0 && output->data[output->length - 1] != '\n') {
+        output->length--;
+    }
+}
+
+// Legge il file a blocchi con read() nel buffer della fonte, riusato tra
+// una lettura e l'altra; truncated indica che il file superava
+// SOURCE_OUTPUT_MAX ed è stato ridotto all'ultima riga completa
+static bool file_load(Source* source, bool* truncated) {
+    int fd = open(source->target, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    // Si legge un byte oltre il massimo per sapere se il file è più lungo
+    StrBuf* content = &source->output;
+    content->length = 0;
+    while (content->length <= SOURCE_OUTPUT_MAX) {
+        strbuf_reserve(content, 65536);
+        size_t room = content->capacity - content->length - 1;
+        if (room > SOURCE_OUTPUT_MAX + 1 - content->length) {
+            room = SOURCE_OUTPUT_MAX + 1 - content->length;
+        }
+        ssize_t length = read(fd, content->data + content->length, room);
+        if (length < 0) {
+            if (errno == EINTR) continue;
+            perror("read");
+            close(fd);
+            return false;
+        }
+        if (length == 0) {
+            break;
+        }
+        content->length += length;
+    }
+    close(fd);
+
+    *truncated = content->length > SOURCE_OUTPUT_MAX;
+    if (*truncated) {
+        content->length = SOURCE_OUTPUT_MAX;
+        cut_to_last_line(content);
+    }
+    content->data[content->length] = '\0';
+    return true;
+}
+
+static void file_read(Source* source) {
+    bool truncated;
+    if (!file_load(source, &truncated)) {
+        return;
+    }
+
+    // Un contenuto identico non viene né interpretato né pubblicato di nuovo
+    StrBuf* content = &source->output;
+    uint64_t hash = hash_string(content->data);
+    if (!source->loaded || hash != source->hash) {
+        source->hash = hash;
+        source->loaded = true;
+
+        if (truncated) {
+            fprintf(stderr, "Fonte %s: file oltre %d byte, lette solo le righe complete entro il limite\n",
+                    source->spec, SOURCE_OUTPUT_MAX);
+        }
+        int rejected;
+        lineproto_parse_block(content->data, content->length, &rejected);
+        if (rejected > 0) {
+            fprintf(stderr, "Fonte %s: %d righe non valide ignorate\n", source->spec, rejected);
+        }
+    }
+}
+
+// --- tail: solo le righe aggiunte in coda a un file che cresce ---
+
+static void tail_line(Source* source, char* line) {
+    (void)source;
+    lineproto_parse_line(line);
+}
+
+// Legge i byte aggiunti dopo la posizione corrente
+static void tail_read_appended(Source* source) {
+    while (1) {
+        size_t space = line_space(source);
+        ssize_t length = pread(source->tail_fd, source->buffer + source->pending, space, source->offset);
+        if (length <= 0) {
+            if (length < 0) perror("pread");
+            break;
+        }
+        source->offset += length;
+        split_lines(source, length, tail_line);
+    }
+}
+
+// Il file presente all'avvio si legge dalla fine, senza ripetere le righe
+// già scritte. Un inode diverso indica una rotazione: si finisce di leggere
+// il vecchio file e si riparte dall'inizio del nuovo, come per un file
+// creato dopo l'avvio. Una dimensione inferiore alla posizione indica un
+// troncamento.
+static void tail_read(Source* source) {
+    struct stat st;
+    bool first = !source->tail_started;
+    source->tail_started = true;
+    if (stat(source->target, &st) != 0) {
+        return;  // Rotazione in corso o file non ancora creato
+    }
+
+    metrics_batch_begin();
+
+    if (source->tail_fd < 0 || st.st_ino != source->inode) {
+        if (source->tail_fd >= 0) {
+            tail_read_appended(source);
+            close(source->tail_fd);
+        }
+        source->tail_fd = open(source->target, O_RDONLY | O_CLOEXEC);
+        source->inode = st.st_ino;
+        source->offset = first ? st.st_size : 0;
+        source->pending = 0;
+    }
+
+    if (source->tail_fd >= 0) {
+        if (fstat(source->tail_fd, &st) == 0 && st.st_size < source->offset) {
+            source->offset = 0;
+            source->pending = 0;
+        }
+        tail_read_appended(source);
+    }
+
+    metrics_batch_end();
+}
+
+// Osserva il file con inotify. Si osserva la directory: chi scrive con un
+// rename atomico sostituisce l'inode, e IN_MOVED_TO lo segnala.
+static bool watch_file(Source* source, uint32_t mask) {
+    char dir[256];
+    const char* slash = strrchr(source->target, '/');
+    if (!slash) {
+        strcpy(dir, ".");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", slash == source->target ? 1 : (int)(slash - source->target),
+                 source->target);
+    }
+
+    source->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (source->watch_fd < 0) {
+        perror("inotify_init1");
+        return false;
+    }
+    if (inotify_add_watch(source->watch_fd, dir, mask) < 0 ||
+        !watch_fd(source, source->watch_fd, EVENT_WATCH)) {
+        perror("inotify_add_watch");
+        close(source->watch_fd);
+        source->watch_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// Raccoglie tutti gli eventi in coda: più scritture ravvicinate producono
+// una sola rilettura
+static bool file_changed(Source* source) {
+    const char* slash = strrchr(source->target, '/');
+    const char* base = slash ? slash + 1 : source->target;
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t length;
+    while ((length = read(source->watch_fd, events, sizeof(events))) > 0) {
+        for (char* p = events; p < events + length; ) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            if ((event->mask & IN_Q_OVERFLOW) ||
+                (event->len > 0 && strcmp(event->name, base) == 0)) {
+                changed = true;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+// --- cmd: un comando avviato a ogni scadenza, senza bloccare le altre fonti ---
+
+static void cmd_tick(Source* source) {
+    if (source->pid > 0) {
+        if (source->pipe_fd < 0 && waitpid(source->pid, NULL, WNOHANG) == source->pid) {
+            source->pid = -1;
+        } else if ((int64_t)(now_ns() / 1000000) - source->started_ms > CMD_TIMEOUT_MS) {
+            fprintf(stderr, "Comando della fonte %s interrotto dopo %d s\n", source->spec, CMD_TIMEOUT_MS / 1000);
+            kill_child(source);
+            source->output.length = 0;
+        } else {
+            return;  // L'esecuzione precedente è ancora in corso: si salta il turno
+        }
+    }
+
+    source->pid = spawn_command(source->target, &source->pipe_fd);
+    if (source->pid > 0) {
+        source->started_ms = now_ns() / 1000000;
+        watch_fd(source, source->pipe_fd, EVENT_PIPE);
+    }
+}
+
+static void cmd_readable(Source* source) {
+    char chunk[4096];
+    while (1) {
+        ssize_t length = read(source->pipe_fd, chunk, sizeof(chunk));
+        if (length > 0) {
+            if (source->output.length + length <= SOURCE_OUTPUT_MAX) {
+                strbuf_append(&source->output, chunk, length);
+            }
+            continue;
+        }
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length < 0 && errno == EAGAIN) {
+            return;
+        }
+        break;  // Fine dell'output
+    }
+
+    close(source->pipe_fd);
+    source->pipe_fd = -1;
+    if (source->output.length > 0) {
+        lineproto_parse_block(source->output.data, source->output.length, NULL);
+        source->output.length = 0;
+    }
+
+    // Di solito il figlio è già uscito; altrimenti lo si raccoglie alla prossima scadenza
+    if (waitpid(source->pid, NULL, WNOHANG) == source->pid) {
+        source->pid = -1;
+    }
+}
+
+// --- stream: un produttore sempre attivo che scrive blocchi di righe ---
+
+static void stream_publish(Source* source) {
+    if (source->output.length > 0) {
+        lineproto_parse_block(source->output.data, source->output.length, NULL);
+        source->output.length = 0;
+        source->productive = true;
+    }
+}
+
+// Accoda una riga al blocco corrente. Il timeout del blocco parte dalla
+// sua prima riga, così un produttore che scrive di continuo senza chiudere
+// i blocchi viene comunque pubblicato; un blocco che supererebbe
+// SOURCE_OUTPUT_MAX viene pubblicato prima.
+static void stream_line(Source* source, char* line) {
+    if (line[0] == '\0' || strcmp(line, "---") == 0) {
+        stream_publish(source);
+        return;
+    }
+
+    size_t length = strlen(line);
+    if (source->output.length + length + 1 > SOURCE_OUTPUT_MAX) {
+        stream_publish(source);
+    }
+    if (source->output.length == 0) {
+        timer_arm(source, STREAM_BATCH_TIMEOUT_MS, false);
+    }
+    strbuf_append(&source->output, line, length);
+    strbuf_append(&source->output, "\n", 1);
+}
+
+static void stream_spawn(Source* source) {
+    source->pid = spawn_command(source->target, &source->pipe_fd);
+    if (source->pid > 0 && watch_fd(source, source->pipe_fd, EVENT_PIPE)) {
+        source->pending = 0;
+        source->productive = false;
+        timer_arm(source, STREAM_IDLE_TIMEOUT_MS, false);
+    } else {
+        kill_child(source);
+        timer_arm(source, source->backoff_ms, false);
+    }
+}
+
+// Programma il riavvio del produttore terminato, con attesa crescente
+static void stream_schedule(Source* source) {
+    if (source->productive) {
+        source->backoff_ms = STREAM_MIN_BACKOFF_MS;
+    }
+    fprintf(stderr, "Fonte %s terminata, riavvio tra %d ms\n", source->spec, source->backoff_ms);
+    timer_arm(source, source->backoff_ms, false);
+
+    source->backoff_ms *= 2;
+    if (source->backoff_ms > STREAM_MAX_BACKOFF_MS) {
+        source->backoff_ms = STREAM_MAX_BACKOFF_MS;
+    }
+}
+
+// Il produttore è uscito o è bloccato: si chiude la pipe e, se è ancora
+// vivo, gli si invia SIGTERM. L'attesa dell'uscita è scandita dal timer
+// della fonte, senza fermare le altre; allo scadere segue SIGKILL.
+static void stream_restart(Source* source) {
+    stream_publish(source);
+    if (source->pipe_fd >= 0) {
+        close(source->pipe_fd);
+        source->pipe_fd = -1;
+    }
+
+    if (source->pid > 0 && waitpid(source->pid, NULL, WNOHANG) == 0) {
+        kill(-source->pid, SIGTERM);
+        source->term_deadline_ms = now_ns() / 1000000 + STREAM_TERM_TIMEOUT_MS;
+        timer_arm(source, STREAM_TERM_POLL_MS, true);
+        return;
+    }
+    source->pid = -1;
+    stream_schedule(source);
+}
+
+// Controllo periodico di un produttore a cui è stato inviato SIGTERM
+static void stream_terminating(Source* source) {
+    if (waitpid(source->pid, NULL, WNOHANG) == 0) {
+        if ((int64_t)(now_ns() / 1000000) < source->term_deadline_ms) {
+            return;
+        }
+        kill_child(source);
+    }
+    source->pid = -1;
+    source->term_deadline_ms = 0;
+    stream_schedule(source);
+}
+
+static void stream_readable(Source* source) {
+    while (1) {
+        size_t space = line_space(source);
+        ssize_t length = read(source->pipe_fd, source->buffer + source->pending, space);
+        if (length > 0) {
+            split_lines(source, length, stream_line);
+            continue;
+        }
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length < 0 && errno == EAGAIN) {
+            break;
+        }
+        stream_restart(source);
+        return;
+    }
+
+    // Senza blocchi aperti riparte l'attesa del prossimo dato; un blocco
+    // aperto ha già il suo timeout, armato alla prima riga
+    if (source->output.length == 0) {
+        timer_arm(source, STREAM_IDLE_TIMEOUT_MS, false);
+    }
+}
+
+static void stream_timeout(Source* source) {
+    if (source->term_deadline_ms) {
+        stream_terminating(source);
+    } else if (source->pid < 0) {
+        stream_spawn(source);
+    } else if (source->output.length > 0) {
+        // Il produttore non ha chiuso il blocco: si pubblica quello che c'è
+        stream_publish(source);
+        timer_arm(source, STREAM_IDLE_TIMEOUT_MS, false);
+    } else {
+        fprintf(stderr, "Nessun dato dalla fonte %s per %d s\n", source->spec, STREAM_IDLE_TIMEOUT_MS / 1000);
+        stream_restart(source);
+    }
+}
+
+// --- upstream: il flusso WebSocket di un'altra istanza di SWSWS ---
+
+static bool watch_socket(Source* source, int op, uint32_t events) {
+    struct epoll_event event = {
+        .events = events,
+        .data.u64 = (uint64_t)(source - sources) << 2 | EVENT_SOCKET
+    };
+    if (epoll_ctl(epoll_fd, op, source->socket_fd, &event) != 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+static void upstream_start(Source* source);
+
+// Connessione persa o mai riuscita: nuovo tentativo con attesa crescente,
+// dopo aver provato gli altri indirizzi dell'host
+static void upstream_restart(Source* source) {
+    if (upstream_has_next(source->upstream)) {
+        source->socket_fd = -1;  // Chiuso da upstream_connect
+        upstream_start(source);
+        return;
+    }
+
+    bool productive = upstream_productive(source->upstream);
+    bool connected = upstream_state(source->upstream) == UPSTREAM_OPEN;
+    upstream_disconnect(source->upstream);  // La chiusura toglie il socket da epoll
+    source->socket_fd = -1;
+
+    if (productive) {
+        source->backoff_ms = STREAM_MIN_BACKOFF_MS;
+    }
+    fprintf(stderr, "Fonte %s %s, nuovo tentativo tra %d ms\n", source->spec,
+            connected ? "disconnessa" : "non raggiungibile", source->backoff_ms);
+    timer_arm(source, source->backoff_ms, false);
+
+    source->backoff_ms *= 2;
+    if (source->backoff_ms > STREAM_MAX_BACKOFF_MS) {
+        source->backoff_ms = STREAM_MAX_BACKOFF_MS;
+    }
+}
+
+static void upstream_start(Source* source) {
+    source->socket_fd = upstream_connect(source->upstream);
+    if (source->socket_fd >= 0 && watch_socket(source, EPOLL_CTL_ADD, EPOLLOUT)) {
+        timer_arm(source, UPSTREAM_CONNECT_TIMEOUT_MS, false);
+    } else {
+        upstream_restart(source);
+    }
+}
+
+static void upstream_readable(Source* source) {
+    UpstreamState state = upstream_state(source->upstream);
+    if (!upstream_event(source->upstream)) {
+        upstream_restart(source);
+        return;
+    }
+
+    UpstreamState next = upstream_state(source->upstream);
+    if (state == UPSTREAM_CONNECTING && next == UPSTREAM_HANDSHAKE) {
+        // Richiesta inviata: da qui in poi si attende solo in lettura
+        if (!watch_socket(source, EPOLL_CTL_MOD, EPOLLIN)) {
+            upstream_restart(source);
+        }
+    } else if (state != UPSTREAM_OPEN && next == UPSTREAM_OPEN) {
+        timer_arm(source, 0, false);  // Connessa: il keepalive TCP sorveglia il collegamento
+    }
+}
+
+static void upstream_timeout(Source* source) {
+    if (source->socket_fd < 0) {
+        upstream_start(source);
+    } else if (upstream_state(source->upstream) != UPSTREAM_OPEN) {
+        fprintf(stderr, "Fonte %s: nessuna risposta in %d s\n", source->spec, UPSTREAM_CONNECT_TIMEOUT_MS / 1000);
+        upstream_restart(source);
+    }
+}
+
+// --- Ciclo degli eventi ---
+
+// shm: svuota l'anello; finché il produttore non crea il segmento riprova a ogni scadenza
+static void shm_tick(Source* source) {
+    if (!source->shm) {
+        source->shm = shmring_open(source->target);
+        if (!source->shm) {
+            if (!source->shm_waiting) {
+                fprintf(stderr, "Fonte %s: segmento non ancora disponibile, in attesa\n", source->spec);
+                source->shm_waiting = true;
+            }
+            return;
+        }
+        source->shm_waiting = false;
+    }
+    shmring_drain(source->shm);
+}
+
+// Prepara i descrittori della fonte ed esegue la prima lettura
+static bool source_open(Source* source) {
+    source->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (source->timer_fd < 0 || !watch_fd(source, source->timer_fd, EVENT_TIMER)) {
+        perror("timerfd_create");
+        return false;
+    }
+
+    if (source->type == SOURCE_TAIL || source->type == SOURCE_STREAM) {
+        source->buffer = malloc(SOURCE_LINE_MAX);
+        if (!source->buffer) {
+            return false;
+        }
+    }
+
+    switch (source->type) {
+        case SOURCE_SIM:
+            timer_arm(source, source->interval_ms, true);
+            sim_tick(source);
+            break;
+        case SOURCE_FILE:
+        case SOURCE_TAIL: {
+            // Le modifiche arrivano da inotify; un intervallo esplicito (o la
+            // mancanza di inotify) aggiunge una rilettura periodica, utile sui
+            // filesystem che non notificano le modifiche
+            uint32_t mask = source->type == SOURCE_FILE
+                ? IN_CLOSE_WRITE | IN_MOVED_TO
+                : IN_MODIFY | IN_CREATE | IN_MOVED_TO;
+            if (!watch_file(source, mask) || source->interval_set) {
+                timer_arm(source, source->interval_ms, true);
+            }
+            if (source->type == SOURCE_FILE) {
+                file_read(source);
+            } else {
+                tail_read(source);
+            }
+            break;
+        }
+        case SOURCE_CMD:
+            timer_arm(source, source->interval_ms, true);
+            cmd_tick(source);
+            break;
+        case SOURCE_STREAM:
+            stream_spawn(source);
+            break;
+        case SOURCE_PROC:
+            source->procfs = procfs_open(source->target);
+            if (!source->procfs) {
+                return false;
+            }
+            timer_arm(source, source->interval_ms, true);
+            procfs_collect(source->procfs);
+            break;
+        case SOURCE_SHM:
+            timer_arm(source, source->interval_ms, true);
+            shm_tick(source);
+            break;
+        case SOURCE_UPSTREAM:
+            upstream_start(source);
+            break;
+    }
+    return true;
+}
+
+static void source_event(Source* source, int role) {
+    if (role == EVENT_TIMER) {
+        uint64_t expirations;
+        if (read(source->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            return;
+        }
+    }
+
+    switch (source->type) {
+        case SOURCE_SIM:
+            sim_tick(source);
+            break;
+        case SOURCE_FILE:
+            if (role == EVENT_TIMER || file_changed(source)) {
+                file_read(source);
+            }
+            break;
+        case SOURCE_TAIL:
+            if (role == EVENT_TIMER || file_changed(source)) {
+                tail_read(source);
+            }
+            break;
+        case SOURCE_CMD:
+            if (role == EVENT_TIMER) {
+                cmd_tick(source);
+            } else if (source->pipe_fd >= 0) {
+                cmd_readable(source);
+            }
+            break;
+        case SOURCE_STREAM:
+            if (role == EVENT_TIMER) {
+                stream_timeout(source);
+            } else if (source->pipe_fd >= 0) {
+                stream_readable(source);
+            }
+            break;
+        case SOURCE_PROC:
+            procfs_collect(source->procfs);
+            break;
+        case SOURCE_SHM:
+            shm_tick(source);
+            break;
+        case SOURCE_UPSTREAM:
+            if (role == EVENT_TIMER) {
+                upstream_timeout(source);
+            } else if (source->socket_fd >= 0) {
+                upstream_readable(source);
+            }
+            break;
+    }
+}
+
+// Thread di acquisizione: un solo ciclo epoll serve tutte le fonti. I
+// timerfd periodici non accumulano deriva e nessuna fonte si blocca in
+// attesa: i comandi lenti non ritardano le fonti veloci.
+static void* collection_thread_main(void* arg) {
+    (void)arg;
+
+    for (int i = 0; i < num_sources; i++) {
+        if (!source_open(&sources[i])) {
+            fprintf(stderr, "Errore nell'apertura della fonte %s\n", sources[i].spec);
+        }
+    }
+
+    struct epoll_event events[16];
+    while (collection_running) {
+        int n = epoll_wait(epoll_fd, events, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint64_t data = events[i].data.u64;
+            if (data == EVENT_WAKEUP) {
+                return NULL;  // Richiesta di arresto
+            }
+            source_event(&sources[data >> 2], (int)(data & 3));
+        }
+    }
+
+    return NULL;
+}
+
+bool sources_start(void) {
+    if (collection_running) {
+        return false;  // Già in esecuzione
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return false;
+    }
+
+    if (pipe(wakeup_pipe) != 0) {
+        perror("pipe");
+        close(epoll_fd);
+        return false;
+    }
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = EVENT_WAKEUP };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_pipe[0], &event);
+
+    collection_running = true;
+
+    if (pthread_create(&collection_thread, NULL, collection_thread_main, NULL) != 0) {
+        collection_running = false;
+        close(wakeup_pipe[0]);
+        close(wakeup_pipe[1]);
+        close(epoll_fd);
+        return false;
+    }
+
+    return true;
+}
+
+void sources_stop(void) {
+    if (!collection_running) {
+        return;
+    }
+
+    collection_running = false;
+    if (write(wakeup_pipe[1], "", 1) < 0) {
+        perror("write");
+    }
+    pthread_join(collection_thread, NULL);
+
+    for (int i = 0; i < num_sources; i++) {
+        Source* source = &sources[i];
+        stop_child(source);
+        if (source->timer_fd >= 0) close(source->timer_fd);
+        if (source->watch_fd >= 0) close(source->watch_fd);
+        if (source->tail_fd >= 0) close(source->tail_fd);
+        strbuf_free(&source->output);
+        free(source->buffer);
+        procfs_close(source->procfs);
+        shmring_reader_close(source->shm);
+        upstream_free(source->upstream);
+    }
+
+    close(wakeup_pipe[0]);
+    close(wakeup_pipe[1]);
+    close(epoll_fd);
+}
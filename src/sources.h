@@ -0,0 +1,21 @@
+// sources.h
+#ifndef SOURCES_H
+#define SOURCES_H
+
+#include <stdbool.h>
+
+#define SOURCES_MAX 32                    // Fonti contemporanee
+#define SOURCE_DEFAULT_INTERVAL_MS 1000   // Intervallo se non indicato
+
+// Aggiunge una fonte "tipo:argomento[@intervallo]"; l'intervallo è in
+// ms, s o m (es. file:/run/a.dat@250ms, cmd:./get_metrics.sh@10s, shm:/daq@10ms).
+// upstream:ws://host:porta/[#prefisso] riceve le metriche di un'altra istanza.
+bool sources_add(const char* spec);
+
+// Avvia il thread che serve tutte le fonti con un unico ciclo epoll
+bool sources_start(void);
+
+// Ferma il thread e i processi figli delle fonti
+void sources_stop(void);
+
+#endif
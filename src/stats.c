@@ -0,0 +1,309 @@
+// stats.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stats.h"
+
+// Istogramma log-lineare: ogni ottava è divisa in STATS_SUB_BUCKETS parti
+// uguali, con errore relativo massimo di circa 1/(2 * STATS_SUB_BUCKETS).
+// I valori con modulo inferiore a 2^STATS_MIN_EXP contano come zero,
+// quelli oltre 2^STATS_MAX_EXP finiscono nell'ultimo bucket.
+#define STATS_SUB_BUCKETS 8
+#define STATS_MIN_EXP (-20)
+#define STATS_MAX_EXP 43
+#define STATS_HALF_BUCKETS ((STATS_MAX_EXP - STATS_MIN_EXP + 1) * STATS_SUB_BUCKETS)
+#define STATS_BUCKETS (2 * STATS_HALF_BUCKETS + 1)  // Negativi, zero, positivi
+#define STATS_ZERO_BUCKET STATS_HALF_BUCKETS
+
+#define STATS_MIN_WINDOW 5  // Finestra minima in secondi
+#define STATS_QUANTILES 3   // p50, p95, p99
+
+// Sottointervallo della finestra: scade tutto insieme quando la finestra avanza
+typedef struct {
+    int64_t start_ms;  // Inizio del sottointervallo
+    uint64_t count;
+    double sum;
+    double min;
+    double max;
+    int64_t first_ts;  // Primo campione, per la velocità di variazione
+    double first_value;
+    uint32_t histogram[STATS_BUCKETS];
+} StatsSlot;
+
+// Stato di una metrica seguita; usato solo dallo scrittore del registro
+typedef struct {
+    StatsSlot slots[STATS_SLOTS];
+    uint32_t window_histogram[STATS_BUCKETS];  // Somma degli istogrammi attivi
+    // Bucket di ogni quantile e campioni della finestra fino a quel bucket
+    // compreso: un aggiornamento li sposta di pochi bucket invece di
+    // riscorrere l'istogramma (-1 = prima del primo bucket)
+    int quantile_bucket[STATS_QUANTILES];
+    uint64_t quantile_seen[STATS_QUANTILES];
+    metric_id_t derived[STATS_FIELD_COUNT];
+} StatsState;
+
+static const char* field_names[STATS_FIELD_COUNT] = {
+    "avg", "min", "max", "rate", "p50", "p95", "p99"
+};
+
+static const double quantiles[STATS_QUANTILES] = { 0.50, 0.95, 0.99 };
+
+// Configurazione
+static char** tracked_names = NULL;
+static int num_tracked_names = 0;
+static bool track_all = false;
+static int window_seconds = STATS_DEFAULT_WINDOW;
+static int64_t slot_ms = STATS_DEFAULT_WINDOW * 1000LL / STATS_SLOTS;
+
+// Stato per id, allocato a blocchi come il registro
+static StatsState** state_chunks[METRICS_MAX_CHUNKS];
+
+bool stats_init(const char* metrics_list, int window) {
+    if (window < STATS_MIN_WINDOW) {
+        fprintf(stderr, "Finestra delle statistiche troppo breve: %d s (minimo %d)\n",
+                window, STATS_MIN_WINDOW);
+        return false;
+    }
+    window_seconds = window;
+    slot_ms = window * 1000LL / STATS_SLOTS;
+
+    char* list = strdup(metrics_list);
+    if (!list) {
+        return false;
+    }
+
+    char* saveptr = NULL;
+    for (char* name = strtok_r(list, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(name, "*") == 0) {
+            track_all = true;
+            continue;
+        }
+        char** names = realloc(tracked_names, (num_tracked_names + 1) * sizeof(char*));
+        if (!names) {
+            free(list);
+            return false;
+        }
+        tracked_names = names;
+        tracked_names[num_tracked_names] = strdup(name);
+        if (tracked_names[num_tracked_names]) {
+            num_tracked_names++;
+        }
+    }
+
+    free(list);
+    return true;
+}
+
+int stats_window(void) {
+    return window_seconds;
+}
+
+bool stats_should_track(const char* name) {
+    if (track_all) {
+        return true;
+    }
+    for (int i = 0; i < num_tracked_names; i++) {
+        if (strcmp(tracked_names[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static StatsState* get_state(metric_id_t id) {
+    StatsState** states = state_chunks[id / METRICS_CHUNK_SIZE];
+    return states ? states[id % METRICS_CHUNK_SIZE] : NULL;
+}
+
+bool stats_track(metric_id_t id, const metric_id_t derived[STATS_FIELD_COUNT]) {
+    uint32_t chunk = id / METRICS_CHUNK_SIZE;
+    if (!state_chunks[chunk]) {
+        state_chunks[chunk] = calloc(METRICS_CHUNK_SIZE, sizeof(StatsState*));
+        if (!state_chunks[chunk]) {
+            return false;
+        }
+    }
+
+    StatsState* state = state_chunks[chunk][id % METRICS_CHUNK_SIZE];
+    if (!state) {
+        state = calloc(1, sizeof(StatsState));
+        if (!state) {
+            return false;
+        }
+        for (int s = 0; s < STATS_SLOTS; s++) {
+            state->slots[s].start_ms = INT64_MIN;
+        }
+        for (int q = 0; q < STATS_QUANTILES; q++) {
+            state->quantile_bucket[q] = -1;
+        }
+        state_chunks[chunk][id % METRICS_CHUNK_SIZE] = state;
+    }
+
+    memcpy(state->derived, derived, sizeof(state->derived));
+    return true;
+}
+
+bool stats_derived(metric_id_t id, metric_id_t derived[STATS_FIELD_COUNT]) {
+    StatsState* state = get_state(id);
+    if (!state) {
+        return false;
+    }
+    memcpy(derived, state->derived, sizeof(state->derived));
+    return true;
+}
+
+// Bucket di un valore: l'ordine dei bucket segue l'ordine dei valori
+static int bucket_index(double value) {
+    if (!isfinite(value)) {
+        return value > 0 ? STATS_BUCKETS - 1 : 0;
+    }
+
+    int exponent;
+    double mantissa = frexp(fabs(value), &exponent);  // mantissa in [0.5, 1)
+    if (value == 0 || exponent < STATS_MIN_EXP) {
+        return STATS_ZERO_BUCKET;
+    }
+
+    int offset;
+    if (exponent > STATS_MAX_EXP) {
+        offset = STATS_HALF_BUCKETS - 1;
+    } else {
+        int sub = (int)((mantissa - 0.5) * 2 * STATS_SUB_BUCKETS);
+        offset = (exponent - STATS_MIN_EXP) * STATS_SUB_BUCKETS + sub;
+    }
+
+    return value > 0 ? STATS_ZERO_BUCKET + 1 + offset : STATS_ZERO_BUCKET - 1 - offset;
+}
+
+// Valore rappresentativo di un bucket: il centro del suo intervallo
+static double bucket_value(int index) {
+    if (index == STATS_ZERO_BUCKET) {
+        return 0;
+    }
+
+    int offset = index > STATS_ZERO_BUCKET ? index - STATS_ZERO_BUCKET - 1 : STATS_ZERO_BUCKET - 1 - index;
+    int exponent = offset / STATS_SUB_BUCKETS + STATS_MIN_EXP;
+    int sub = offset % STATS_SUB_BUCKETS;
+    double mantissa = 0.5 + (sub + 0.5) / (2 * STATS_SUB_BUCKETS);
+    double value = ldexp(mantissa, exponent);
+
+    return index > STATS_ZERO_BUCKET ? value : -value;
+}
+
+// Svuota un sottointervallo togliendone i conteggi dall'istogramma della
+// finestra e dai conteggi cumulativi dei quantili
+static void slot_reset(StatsState* state, StatsSlot* slot, int64_t start_ms) {
+    if (slot->count > 0) {
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            uint32_t removed = slot->histogram[b];
+            if (removed == 0) continue;
+            state->window_histogram[b] -= removed;
+            for (int q = 0; q < STATS_QUANTILES; q++) {
+                if (b <= state->quantile_bucket[q]) {
+                    state->quantile_seen[q] -= removed;
+                }
+            }
+        }
+        memset(slot->histogram, 0, sizeof(slot->histogram));
+    }
+    slot->start_ms = start_ms;
+    slot->count = 0;
+    slot->sum = 0;
+}
+
+bool stats_update(metric_id_t id, int64_t ts_ms, double value, StatsOutput* out) {
+    StatsState* state = get_state(id);
+    if (!state) {
+        return false;
+    }
+
+    int64_t start = ts_ms - ts_ms % slot_ms;
+    StatsSlot* current = &state->slots[(start / slot_ms) % STATS_SLOTS];
+
+    // Fa scadere i sottointervalli usciti dalla finestra (anche dopo una pausa lunga)
+    if (current->start_ms != start) {
+        slot_reset(state, current, start);
+    }
+    for (int s = 0; s < STATS_SLOTS; s++) {
+        StatsSlot* slot = &state->slots[s];
+        if (slot->count > 0 && slot->start_ms <= start - STATS_SLOTS * slot_ms) {
+            slot_reset(state, slot, INT64_MIN);
+        }
+    }
+
+    if (current->count == 0) {
+        current->min = current->max = value;
+        current->first_ts = ts_ms;
+        current->first_value = value;
+    } else {
+        if (value < current->min) current->min = value;
+        if (value > current->max) current->max = value;
+    }
+    current->count++;
+    current->sum += value;
+
+    int bucket = bucket_index(value);
+    current->histogram[bucket]++;
+    state->window_histogram[bucket]++;
+
+    // Aggregati della finestra: pochi sottointervalli, costo costante
+    uint64_t count = 0;
+    double sum = 0, min = value, max = value;
+    const StatsSlot* oldest = current;
+    for (int s = 0; s < STATS_SLOTS; s++) {
+        const StatsSlot* slot = &state->slots[s];
+        if (slot->count == 0) continue;
+        count += slot->count;
+        sum += slot->sum;
+        if (slot->min < min) min = slot->min;
+        if (slot->max > max) max = slot->max;
+        if (slot->first_ts < oldest->first_ts) oldest = slot;
+    }
+
+    memcpy(out->ids, state->derived, sizeof(out->ids));
+    out->values[STATS_AVG] = sum / count;
+    out->values[STATS_MIN] = min;
+    out->values[STATS_MAX] = max;
+    out->values[STATS_RATE] = ts_ms > oldest->first_ts
+        ? (value - oldest->first_value) * 1000.0 / (ts_ms - oldest->first_ts)
+        : 0;
+
+    // Ogni quantile è nel primo bucket in cui i campioni cumulati
+    // raggiungono la sua quota: si parte dal bucket precedente e ci si sposta
+    // solo quanto serve. Il centro del bucket è limitato a [min, max].
+    for (int q = 0; q < STATS_QUANTILES; q++) {
+        int* b = &state->quantile_bucket[q];
+        uint64_t* seen = &state->quantile_seen[q];
+        uint64_t target = (uint64_t)ceil(quantiles[q] * count);
+        if (bucket <= *b) {
+            (*seen)++;
+        }
+        while (*seen < target && *b < STATS_BUCKETS - 1) {
+            *seen += state->window_histogram[++*b];
+        }
+        while (*b > 0 && *seen - state->window_histogram[*b] >= target) {
+            *seen -= state->window_histogram[(*b)--];
+        }
+
+        double v = bucket_value(*b);
+        if (v < min) v = min;
+        if (v > max) v = max;
+        out->values[STATS_P50 + q] = v;
+    }
+
+    return true;
+}
+
+const char* stats_field_name(StatsField field) {
+    return field < STATS_FIELD_COUNT ? field_names[field] : "";
+}
+
+void stats_metric_name(const char* name, StatsField field, char* out, size_t size) {
+    const char* labels = strchr(name, '{');
+    if (labels) {
+        snprintf(out, size, "%.*s.%s%s", (int)(labels - name), name, stats_field_name(field), labels);
+    } else {
+        snprintf(out, size, "%s.%s", name, stats_field_name(field));
+    }
+}
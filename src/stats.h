@@ -0,0 +1,53 @@
+// stats.h
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "metrics.h"
+
+#define STATS_DEFAULT_WINDOW 300  // Finestra predefinita in secondi (5 minuti)
+#define STATS_SLOTS 5             // Sottointervalli in cui è divisa la finestra
+
+// Campi derivati pubblicati come metriche "<nome>.<campo>"
+typedef enum {
+    STATS_AVG,
+    STATS_MIN,
+    STATS_MAX,
+    STATS_RATE,   // Variazione al secondo nella finestra
+    STATS_P50,
+    STATS_P95,
+    STATS_P99,
+    STATS_FIELD_COUNT
+} StatsField;
+
+// Valori calcolati da un aggiornamento, da scrivere nelle metriche derivate
+typedef struct {
+    metric_id_t ids[STATS_FIELD_COUNT];
+    double values[STATS_FIELD_COUNT];
+} StatsOutput;
+
+// Configura le metriche da seguire ("*" per tutte) e la finestra in secondi
+bool stats_init(const char* metrics_list, int window_seconds);
+int stats_window(void);
+
+// Indica se per una metrica vanno calcolate le statistiche
+bool stats_should_track(const char* name);
+
+// Associa a una metrica gli id delle sue metriche derivate
+bool stats_track(metric_id_t id, const metric_id_t derived[STATS_FIELD_COUNT]);
+
+// Aggiorna le statistiche in O(1); false se la metrica non è seguita.
+// Va chiamata dallo scrittore del registro, che è unico.
+bool stats_update(metric_id_t id, int64_t ts_ms, double value, StatsOutput* out);
+
+// Id delle metriche derivate di una metrica seguita
+bool stats_derived(metric_id_t id, metric_id_t derived[STATS_FIELD_COUNT]);
+
+const char* stats_field_name(StatsField field);
+
+// Nome della metrica derivata: "cpu.p95", oppure "disk.p95{dev="sda"}" con etichette
+void stats_metric_name(const char* name, StatsField field, char* out, size_t size);
+
+#endif
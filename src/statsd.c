@@ -0,0 +1,519 @@
+// statsd.c
+#define _GNU_SOURCE  // recvmmsg
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include "statsd.h"
+#include "metrics.h"
+#include "labels.h"
+
+#define STATSD_BATCH 64               // Pacchetti letti con una sola recvmmsg
+#define STATSD_PACKET_MAX 8192        // Dimensione massima di un pacchetto
+#define STATSD_READS_PER_EVENT 16     // Letture prima di tornare a epoll, per non ritardare il flush
+#define STATSD_RCVBUF (4 << 20)       // Buffer di ricezione del socket
+#define STATSD_KEY_MAX 256            // Nome, tipo e tag di una chiave
+
+typedef enum {
+    STATSD_GAUGE,
+    STATSD_COUNTER,
+    STATSD_TIMER
+} StatsdType;
+
+// Metriche pubblicate: il gauge usa solo la prima, il contatore le prime
+// due (nome al secondo e nome.count), il timer tutte
+enum { OUT_VALUE, OUT_COUNT, OUT_MIN, OUT_MAX, OUT_COUNT_MAX };
+
+// Chiave StatsD e valori accumulati nell'intervallo corrente
+typedef struct {
+    uint64_t hash;
+    char key[STATSD_KEY_MAX];
+    size_t key_length;
+    StatsdType type;
+    metric_id_t ids[OUT_COUNT_MAX];
+
+    bool dirty;       // Aggiornata nell'intervallo corrente
+    bool reported;    // L'ultimo flush ha pubblicato un conteggio non nullo
+
+    double value;     // gauge: valore; contatore: somma; timer: somma dei campioni
+    double count;     // timer: campioni corretti con la frequenza di campionamento
+    uint32_t samples; // timer: campioni ricevuti
+    double min, max;
+} StatsdEntry;
+
+// Descrittori registrati in epoll
+enum { EVENT_SOCKET, EVENT_FLUSH, EVENT_WAKEUP };
+
+// Tabella delle chiavi: indirizzamento aperto su indici (0 = libero)
+#define STATSD_SLOTS (STATSD_MAX_KEYS * 2)
+static uint32_t* slots = NULL;
+static StatsdEntry* entries = NULL;
+static int num_entries = 0;
+
+// Buffer di ricezione, allocati una volta: la lettura non alloca memoria
+static char (*packets)[STATSD_PACKET_MAX + 1] = NULL;
+static struct mmsghdr messages[STATSD_BATCH];
+static struct iovec iovecs[STATSD_BATCH];
+
+static int flush_interval_ms = STATSD_DEFAULT_FLUSH_MS;
+static int statsd_socket = -1;
+static int flush_timer = -1;
+static int epoll_fd = -1;
+static int wakeup_pipe[2] = { -1, -1 };  // Sveglia il thread all'arresto
+static pthread_t statsd_thread;
+static volatile bool statsd_running = false;
+
+static uint64_t hash_bytes(const char* data, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Nome della metrica: i tag "k:v,k2:v2" diventano etichette {k="v",k2="v2"}
+// e il suffisso (".count", ".min", ...) precede le etichette
+static void metric_name(const char* name, size_t name_length, const char* tags,
+                        const char* suffix, char* out, size_t size) {
+    size_t length = (size_t)snprintf(out, size, "%.*s%s", (int)name_length, name, suffix);
+    if (!tags || !*tags || length + 2 >= size) {
+        return;
+    }
+
+    out[length++] = '{';
+    bool in_value = false;
+    for (const char* p = tags; *p && length + 4 < size; p++) {
+        if (*p == ',') {
+            if (!in_value) {
+                memcpy(out + length, "=\"", 2);
+                length += 2;
+            }
+            out[length++] = '"';
+            out[length++] = ',';
+            in_value = false;
+        } else if (*p == ':' && !in_value) {
+            out[length++] = '=';
+            out[length++] = '"';
+            in_value = true;
+        } else {
+            if (*p == '"' || *p == '\\') {
+                out[length++] = '\\';
+            }
+            out[length++] = *p;
+        }
+    }
+    if (length + 4 < size) {
+        if (!in_value) {
+            memcpy(out + length, "=\"", 2);
+            length += 2;
+        }
+        out[length++] = '"';
+        out[length++] = '}';
+    }
+    out[length] = '\0';
+}
+
+// Registra le metriche di una chiave nuova (solo al primo pacchetto)
+static void register_entry(StatsdEntry* entry, const char* name, size_t name_length,
+                           const char* tags, const char* unit) {
+    char metric[LABELS_NAME_MAX];
+    for (int i = 0; i < OUT_COUNT_MAX; i++) {
+        entry->ids[i] = METRIC_ID_INVALID;
+    }
+
+    switch (entry->type) {
+        case STATSD_GAUGE:
+            metric_name(name, name_length, tags, "", metric, sizeof(metric));
+            entry->ids[OUT_VALUE] = metrics_register(metric, "");
+            break;
+        case STATSD_COUNTER:
+            metric_name(name, name_length, tags, "", metric, sizeof(metric));
+            entry->ids[OUT_VALUE] = metrics_register(metric, "/s");
+            metric_name(name, name_length, tags, ".count", metric, sizeof(metric));
+            entry->ids[OUT_COUNT] = metrics_register(metric, "");
+            break;
+        case STATSD_TIMER:
+            metric_name(name, name_length, tags, ".mean", metric, sizeof(metric));
+            entry->ids[OUT_VALUE] = metrics_register(metric, unit);
+            metric_name(name, name_length, tags, ".count", metric, sizeof(metric));
+            entry->ids[OUT_COUNT] = metrics_register(metric, "");
+            metric_name(name, name_length, tags, ".min", metric, sizeof(metric));
+            entry->ids[OUT_MIN] = metrics_register(metric, unit);
+            metric_name(name, name_length, tags, ".max", metric, sizeof(metric));
+            entry->ids[OUT_MAX] = metrics_register(metric, unit);
+            break;
+    }
+}
+
+// Cerca la chiave nome|tipo|tag, creandola se è nuova; NULL se la tabella è piena
+static StatsdEntry* lookup(const char* name, size_t name_length, StatsdType type,
+                           const char* tags, const char* unit) {
+    size_t tags_length = tags ? strlen(tags) : 0;
+    char key[STATSD_KEY_MAX];
+    size_t key_length = name_length + tags_length + 3;
+    if (key_length > sizeof(key)) {
+        return NULL;
+    }
+    memcpy(key, name, name_length);
+    key[name_length] = '|';
+    key[name_length + 1] = (char)('0' + type);
+    key[name_length + 2] = '|';
+    if (tags_length > 0) {
+        memcpy(key + name_length + 3, tags, tags_length);
+    }
+
+    uint64_t hash = hash_bytes(key, key_length);
+    uint32_t slot = (uint32_t)hash & (STATSD_SLOTS - 1);
+    while (slots[slot] != 0) {
+        StatsdEntry* entry = &entries[slots[slot] - 1];
+        if (entry->hash == hash && entry->key_length == key_length &&
+            memcmp(entry->key, key, key_length) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & (STATSD_SLOTS - 1);
+    }
+
+    if (num_entries >= STATSD_MAX_KEYS) {
+        static bool warned = false;
+        if (!warned) {
+            fprintf(stderr, "StatsD: raggiunto il limite di %d chiavi, le nuove vengono ignorate\n",
+                    STATSD_MAX_KEYS);
+            warned = true;
+        }
+        return NULL;
+    }
+
+    StatsdEntry* entry = &entries[num_entries];
+    memset(entry, 0, sizeof(*entry));
+    entry->hash = hash;
+    memcpy(entry->key, key, key_length);
+    entry->key_length = key_length;
+    entry->type = type;
+    register_entry(entry, name, name_length, tags, unit);
+    slots[slot] = (uint32_t)++num_entries;
+    return entry;
+}
+
+// Interpreta una riga nome:valore|tipo[|@frequenza][|#tag,...]
+static bool parse_line(char* line) {
+    char* colon = strchr(line, ':');
+    if (!colon || colon == line) {
+        return false;
+    }
+    char* value_text = colon + 1;
+    char* type_text = strchr(value_text, '|');
+    if (!type_text) {
+        return false;
+    }
+    *type_text++ = '\0';
+
+    // Campi facoltativi: frequenza di campionamento e tag
+    double rate = 1;
+    const char* tags = NULL;
+    char* field = strchr(type_text, '|');
+    while (field) {
+        *field++ = '\0';
+        char* next = strchr(field, '|');
+        if (next) {
+            *next = '\0';
+        }
+        if (field[0] == '@') {
+            rate = strtod(field + 1, NULL);
+        } else if (field[0] == '#') {
+            tags = field + 1;
+        }
+        field = next;
+    }
+    if (!(rate > 0 && rate <= 1)) {
+        rate = 1;
+    }
+
+    StatsdType type;
+    const char* unit = "";
+    if (strcmp(type_text, "g") == 0) {
+        type = STATSD_GAUGE;
+    } else if (strcmp(type_text, "c") == 0) {
+        type = STATSD_COUNTER;
+    } else if (strcmp(type_text, "ms") == 0) {
+        type = STATSD_TIMER;
+        unit = "ms";
+    } else if (strcmp(type_text, "h") == 0 || strcmp(type_text, "d") == 0) {
+        type = STATSD_TIMER;
+    } else {
+        return false;  // Insiemi ("s") e tipi sconosciuti
+    }
+
+    char* end;
+    double value = strtod(value_text, &end);
+    if (end == value_text || *end != '\0' || !isfinite(value)) {
+        return false;
+    }
+
+    StatsdEntry* entry = lookup(line, (size_t)(colon - line), type, tags, unit);
+    if (!entry) {
+        return false;
+    }
+
+    switch (type) {
+        case STATSD_GAUGE:
+            // Un segno esplicito indica una variazione del valore corrente
+            if (value_text[0] == '+' || value_text[0] == '-') {
+                entry->value += value;
+            } else {
+                entry->value = value;
+            }
+            break;
+        case STATSD_COUNTER:
+            entry->value += value / rate;
+            break;
+        case STATSD_TIMER:
+            if (entry->samples == 0 || value < entry->min) entry->min = value;
+            if (entry->samples == 0 || value > entry->max) entry->max = value;
+            entry->value += value;
+            entry->count += 1 / rate;
+            entry->samples++;
+            break;
+    }
+    entry->dirty = true;
+    return true;
+}
+
+// Un pacchetto può contenere più righe separate da '\n'
+static void parse_packet(char* data, size_t length) {
+    data[length] = '\0';
+    while (data) {
+        char* newline = strchr(data, '\n');
+        if (newline) {
+            *newline++ = '\0';
+        }
+        if (*data) {
+            parse_line(data);
+        }
+        data = newline;
+    }
+}
+
+// Svuota il socket a blocchi di STATSD_BATCH pacchetti per chiamata
+static void receive_packets(void) {
+    for (int reads = 0; reads < STATSD_READS_PER_EVENT; reads++) {
+        int n = recvmmsg(statsd_socket, messages, STATSD_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("recvmmsg");
+            }
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            parse_packet(packets[i], messages[i].msg_len);
+        }
+        if (n < STATSD_BATCH) {
+            return;
+        }
+    }
+}
+
+// Pubblica i valori dell'intervallo in un unico batch e azzera contatori e timer
+static void flush(void) {
+    metrics_batch_begin();
+    for (int i = 0; i < num_entries; i++) {
+        StatsdEntry* entry = &entries[i];
+        switch (entry->type) {
+            case STATSD_GAUGE:
+                if (entry->dirty) {
+                    metrics_set_id(entry->ids[OUT_VALUE], entry->value);
+                }
+                break;
+            case STATSD_COUNTER:
+                // Un contatore fermo viene riportato a zero una volta
+                if (entry->dirty || entry->reported) {
+                    metrics_set_id(entry->ids[OUT_VALUE], entry->value * 1000.0 / flush_interval_ms);
+                    metrics_set_id(entry->ids[OUT_COUNT], entry->value);
+                }
+                entry->reported = entry->dirty;
+                entry->value = 0;
+                break;
+            case STATSD_TIMER:
+                if (entry->dirty) {
+                    metrics_set_id(entry->ids[OUT_VALUE], entry->value / entry->samples);
+                    metrics_set_id(entry->ids[OUT_COUNT], entry->count);
+                    metrics_set_id(entry->ids[OUT_MIN], entry->min);
+                    metrics_set_id(entry->ids[OUT_MAX], entry->max);
+                } else if (entry->reported) {
+                    metrics_set_id(entry->ids[OUT_COUNT], 0);
+                }
+                entry->reported = entry->dirty;
+                entry->value = 0;
+                entry->count = 0;
+                entry->samples = 0;
+                break;
+        }
+        entry->dirty = false;
+    }
+    metrics_batch_end();
+}
+
+static void* statsd_thread_main(void* arg) {
+    (void)arg;
+
+    struct epoll_event events[4];
+    while (statsd_running) {
+        int n = epoll_wait(epoll_fd, events, 4, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            switch (events[i].data.u64) {
+                case EVENT_SOCKET:
+                    receive_packets();
+                    break;
+                case EVENT_FLUSH: {
+                    uint64_t expirations;
+                    if (read(flush_timer, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                        flush();
+                    }
+                    break;
+                }
+                case EVENT_WAKEUP:
+                    return NULL;  // Richiesta di arresto
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void close_all(void) {
+    if (statsd_socket >= 0) close(statsd_socket);
+    if (flush_timer >= 0) close(flush_timer);
+    if (epoll_fd >= 0) close(epoll_fd);
+    if (wakeup_pipe[0] >= 0) close(wakeup_pipe[0]);
+    if (wakeup_pipe[1] >= 0) close(wakeup_pipe[1]);
+    statsd_socket = flush_timer = epoll_fd = -1;
+    wakeup_pipe[0] = wakeup_pipe[1] = -1;
+
+    free(slots);
+    free(entries);
+    free(packets);
+    slots = NULL;
+    entries = NULL;
+    packets = NULL;
+    num_entries = 0;
+}
+
+static bool add_event(int fd, uint64_t data) {
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = data };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+bool statsd_start(int port, int interval_ms) {
+    if (statsd_running) {
+        return false;  // Già in esecuzione
+    }
+    flush_interval_ms = interval_ms > 0 ? interval_ms : STATSD_DEFAULT_FLUSH_MS;
+
+    slots = calloc(STATSD_SLOTS, sizeof(*slots));
+    entries = calloc(STATSD_MAX_KEYS, sizeof(*entries));
+    packets = malloc(STATSD_BATCH * sizeof(*packets));
+    if (!slots || !entries || !packets) {
+        perror("Errore nell'allocazione della tabella StatsD");
+        close_all();
+        return false;
+    }
+    for (int i = 0; i < STATSD_BATCH; i++) {
+        iovecs[i].iov_base = packets[i];
+        iovecs[i].iov_len = STATSD_PACKET_MAX;  // Lascia posto al terminatore
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    statsd_socket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (statsd_socket < 0) {
+        perror("Errore nella creazione del socket StatsD");
+        close_all();
+        return false;
+    }
+
+    // Un buffer ampio assorbe i picchi mentre il thread pubblica
+    int rcvbuf = STATSD_RCVBUF;
+    setsockopt(statsd_socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(statsd_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("Errore nel binding del socket StatsD");
+        close_all();
+        return false;
+    }
+
+    flush_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (flush_timer < 0) {
+        perror("timerfd_create");
+        close_all();
+        return false;
+    }
+    struct itimerspec spec = {
+        .it_interval = { flush_interval_ms / 1000, (long)(flush_interval_ms % 1000) * 1000000 },
+        .it_value = { flush_interval_ms / 1000, (long)(flush_interval_ms % 1000) * 1000000 }
+    };
+    timerfd_settime(flush_timer, 0, &spec, NULL);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        close_all();
+        return false;
+    }
+    if (pipe(wakeup_pipe) != 0) {
+        perror("pipe");
+        close_all();
+        return false;
+    }
+    if (!add_event(statsd_socket, EVENT_SOCKET) || !add_event(flush_timer, EVENT_FLUSH) ||
+        !add_event(wakeup_pipe[0], EVENT_WAKEUP)) {
+        close_all();
+        return false;
+    }
+
+    statsd_running = true;
+
+    if (pthread_create(&statsd_thread, NULL, statsd_thread_main, NULL) != 0) {
+        statsd_running = false;
+        close_all();
+        return false;
+    }
+
+    return true;
+}
+
+void statsd_stop(void) {
+    if (!statsd_running) {
+        return;
+    }
+
+    statsd_running = false;
+    if (write(wakeup_pipe[1], "", 1) < 0) {
+        perror("write");
+    }
+    pthread_join(statsd_thread, NULL);
+
+    close_all();
+}
@@ -0,0 +1,17 @@
+// statsd.h
+#ifndef STATSD_H
+#define STATSD_H
+
+#include <stdbool.h>
+
+#define STATSD_DEFAULT_FLUSH_MS 1000  // Intervallo di aggregazione predefinito
+#define STATSD_MAX_KEYS 8192          // Chiavi StatsD distinte
+
+// Avvia il thread che riceve i pacchetti StatsD sulla porta UDP indicata e
+// pubblica i valori aggregati ogni flush_interval_ms, in un unico batch.
+// Formato: nome:valore|g|c|ms|h|d[|@frequenza][|#tag:valore,...]
+bool statsd_start(int port, int flush_interval_ms);
+
+void statsd_stop(void);
+
+#endif
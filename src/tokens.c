@@ -0,0 +1,225 @@
+// tokens.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include "tokens.h"
+#include "stats.h"
+#include "utils.h"
+
+#define SIGNATURE_SIZE 32     // HMAC-SHA256
+#define SIGNATURE_CHARS 43    // SIGNATURE_SIZE in base64url senza padding
+#define RANDOM_KEY_SIZE 32
+
+// Scritta una volta da tokens_init prima dell'avvio dei thread
+static unsigned char key[TOKEN_KEY_MAX];
+static size_t key_length = 0;
+
+// Chiave delle scritture remote, scritta una volta da tokens_init_write_key
+static char write_key[TOKEN_KEY_MAX];
+static size_t write_key_length = 0;
+
+// Legge una chiave di almeno TOKEN_KEY_MIN byte da key_file; what
+// descrive la chiave nei messaggi. Restituisce la lunghezza, -1 in errore.
+static ssize_t read_key_file(const char* key_file, void* buffer, size_t size, const char* what) {
+    int fd = open(key_file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Errore nell'apertura del file della chiave %s: %s: %s\n",
+                what, key_file, strerror(errno));
+        return -1;
+    }
+    ssize_t n = read(fd, buffer, size);
+    close(fd);
+    if (n < TOKEN_KEY_MIN) {
+        fprintf(stderr, "Chiave %s troppo corta: %s (almeno %d byte)\n", what, key_file, TOKEN_KEY_MIN);
+        return -1;
+    }
+    return n;
+}
+
+bool tokens_init(const char* key_file) {
+    if (!key_file) {
+        // Senza chiave condivisa i token valgono solo per questa istanza
+        ssize_t n = getrandom(key, RANDOM_KEY_SIZE, 0);
+        if (n != RANDOM_KEY_SIZE) {
+            perror("getrandom");
+            return false;
+        }
+        key_length = RANDOM_KEY_SIZE;
+        return true;
+    }
+
+    ssize_t n = read_key_file(key_file, key, sizeof(key), "dei token");
+    if (n < 0) {
+        return false;
+    }
+    key_length = (size_t)n;
+    return true;
+}
+
+bool tokens_init_write_key(const char* key_file) {
+    // La chiave viaggia in un'intestazione HTTP: niente spazi né ritorni a
+    // capo, e quello finale lasciato dagli editor non ne fa parte
+    ssize_t n = read_key_file(key_file, write_key, sizeof(write_key) - 1, "delle scritture");
+    if (n < 0) {
+        return false;
+    }
+    while (n > 0 && (write_key[n - 1] == '\n' || write_key[n - 1] == '\r' ||
+                     write_key[n - 1] == ' ' || write_key[n - 1] == '\t')) {
+        n--;
+    }
+    write_key[n] = '\0';
+    if (n < TOKEN_KEY_MIN || strcspn(write_key, " \t\r\n") != (size_t)n) {
+        fprintf(stderr, "Chiave delle scritture non valida: %s (almeno %d caratteri, senza spazi)\n",
+                key_file, TOKEN_KEY_MIN);
+        return false;
+    }
+    write_key_length = (size_t)n;
+    return true;
+}
+
+bool token_verify_write_key(const char* credential) {
+    return write_key_length > 0 && credential && strlen(credential) == write_key_length &&
+           CRYPTO_memcmp(credential, write_key, write_key_length) == 0;
+}
+
+static void sign(const char* data, size_t length, unsigned char signature[SIGNATURE_SIZE]) {
+    unsigned int signature_length = SIGNATURE_SIZE;
+    HMAC(EVP_sha256(), key, (int)key_length, (const unsigned char*)data, length,
+         signature, &signature_length);
+}
+
+bool token_issue(const char* metrics, int64_t ttl, char* token, size_t size, int64_t* expires) {
+    size_t metrics_length = strlen(metrics);
+    int64_t expiry = (int64_t)time(NULL) + ttl;
+
+    // Scadenza, '.', elenco codificato, '.', firma e terminatore
+    char prefix[24];
+    int prefix_length = snprintf(prefix, sizeof(prefix), "%lld.", (long long)expiry);
+    size_t encoded_length = (metrics_length * 4 + 2) / 3;
+    if (key_length == 0 || prefix_length + encoded_length + 1 + SIGNATURE_CHARS + 1 > size) {
+        return false;
+    }
+
+    size_t n = prefix_length;
+    memcpy(token, prefix, n);
+    n += base64url_encode((const unsigned char*)metrics, metrics_length, token + n);
+
+    unsigned char signature[SIGNATURE_SIZE];
+    sign(token, n, signature);
+    token[n++] = '.';
+    n += base64url_encode(signature, SIGNATURE_SIZE, token + n);
+    token[n] = '\0';
+
+    if (expires) {
+        *expires = expiry;
+    }
+    return true;
+}
+
+bool token_verify(const char* token, char** metrics) {
+    if (key_length == 0) {
+        return false;
+    }
+
+    // scadenza.metriche.firma: la firma copre tutto ciò che precede l'ultimo '.'
+    const char* dot = strchr(token, '.');
+    const char* last = strrchr(token, '.');
+    if (!dot || dot == token || last == dot || strlen(last + 1) != SIGNATURE_CHARS) {
+        return false;
+    }
+
+    unsigned char expected[SIGNATURE_SIZE];
+    unsigned char received[SIGNATURE_SIZE + 2];
+    sign(token, last - token, expected);
+    if (base64url_decode(last + 1, SIGNATURE_CHARS, received) != SIGNATURE_SIZE ||
+        CRYPTO_memcmp(expected, received, SIGNATURE_SIZE) != 0) {
+        return false;
+    }
+
+    // Il contenuto è autentico: resta solo da controllare la scadenza
+    char* end;
+    long long expiry = strtoll(token, &end, 10);
+    if (end != dot || expiry <= (long long)time(NULL)) {
+        return false;
+    }
+
+    if (metrics) {
+        size_t encoded_length = last - (dot + 1);
+        *metrics = malloc(encoded_length * 3 / 4 + 3);
+        if (!*metrics) {
+            return false;
+        }
+        long length = base64url_decode(dot + 1, encoded_length, (unsigned char*)*metrics);
+        if (length < 0) {
+            free(*metrics);
+            *metrics = NULL;
+            return false;
+        }
+        (*metrics)[length] = '\0';
+    }
+    return true;
+}
+
+// Vero se l'elemento item (di length caratteri) è la metrica formata da
+// family_length caratteri di family seguiti dalle etichette labels, o la
+// sua famiglia
+static bool item_matches(const char* item, size_t length, const char* family, size_t family_length,
+                         const char* labels) {
+    if (length < family_length || strncmp(item, family, family_length) != 0) {
+        return false;
+    }
+    size_t labels_length = length - family_length;
+    return labels_length == 0 ||
+           (labels_length == strlen(labels) && strncmp(item + family_length, labels, labels_length) == 0);
+}
+
+// Lunghezza del nome di origine di una statistica "<nome>.<campo>" di
+// stats_metric_name, le cui etichette seguono il campo; 0 se name non lo è
+static size_t stats_base_length(const char* name, size_t family_length) {
+    const char* dot = NULL;
+    for (const char* p = name; p < name + family_length; p++) {
+        if (*p == '.') dot = p;
+    }
+    if (!dot || dot == name) {
+        return 0;
+    }
+    size_t field_length = family_length - (dot + 1 - name);
+    for (int field = 0; field < STATS_FIELD_COUNT; field++) {
+        const char* field_name = stats_field_name(field);
+        if (strlen(field_name) == field_length && strncmp(dot + 1, field_name, field_length) == 0) {
+            return dot - name;
+        }
+    }
+    return 0;
+}
+
+bool token_allows(const char* metrics, const char* name) {
+    if (metrics[0] == '\0') {
+        return true;
+    }
+
+    // Le statistiche di una metrica ("cpu.p95", "disk.avg{dev=\"sda\"}")
+    // sono autorizzate insieme a lei
+    const char* brace = strchr(name, '{');
+    size_t family_length = brace ? (size_t)(brace - name) : strlen(name);
+    const char* labels = name + family_length;
+    size_t base_length = stats_base_length(name, family_length);
+    for (const char* item = metrics; *item; ) {
+        const char* comma = strchr(item, ',');
+        size_t length = comma ? (size_t)(comma - item) : strlen(item);
+        if (item_matches(item, length, name, family_length, labels) ||
+            (base_length > 0 && item_matches(item, length, name, base_length, labels))) {
+            return true;
+        }
+        item += comma ? length + 1 : length;
+    }
+    return false;
+}
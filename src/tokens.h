@@ -0,0 +1,48 @@
+// tokens.h
+#ifndef TOKENS_H
+#define TOKENS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Token di autenticazione senza stato: "scadenza.metriche.firma", con la
+// scadenza in secondi dall'epoca Unix, l'elenco delle metriche autorizzate
+// in base64url e la firma HMAC-SHA256 delle prime due parti, anch'essa in
+// base64url. Qualunque istanza con la stessa chiave verifica i token delle
+// altre senza archivio né ricerche.
+
+#define TOKEN_MAX 1024      // Buffer di un token, terminatore compreso
+#define TOKEN_TTL 3600      // Validità di un token in secondi
+#define TOKEN_KEY_MIN 16    // Byte minimi della chiave condivisa
+#define TOKEN_KEY_MAX 4096
+
+// Legge la chiave HMAC da key_file (la stessa per tutte le istanze dietro
+// un bilanciatore); con NULL genera una chiave casuale valida solo per
+// questo processo
+bool tokens_init(const char* key_file);
+
+// Legge la chiave condivisa che autorizza le scritture remote
+// (POST /api/write); senza chiave le scritture sono disabilitate
+bool tokens_init_write_key(const char* key_file);
+
+// Vero se credential (l'intestazione "Authorization: Bearer ...") è la
+// chiave delle scritture
+bool token_verify_write_key(const char* credential);
+
+// Firma un token che autorizza metrics per ttl secondi (TOKEN_TTL per le
+// pagine); expires riceve la scadenza in secondi dall'epoca Unix. false se
+// non entra in size.
+bool token_issue(const char* metrics, int64_t ttl, char* token, size_t size, int64_t* expires);
+
+// Verifica firma e scadenza; se metrics non è NULL riceve l'elenco
+// autorizzato (da liberare)
+bool token_verify(const char* token, char** metrics);
+
+// Vero se l'elenco autorizzato da un token ("cpu,disk") comprende la
+// metrica name, per nome esatto o per famiglia ("disk" comprende
+// "disk{dev=\"sda\"}"), insieme alle sue statistiche ("cpu.p95",
+// "disk.avg{dev=\"sda\"}"). Un elenco vuoto comprende tutte le metriche.
+bool token_allows(const char* metrics, const char* name);
+
+#endif
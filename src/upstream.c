@@ -0,0 +1,684 @@
+// upstream.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/evp.h>
+#include "upstream.h"
+#include "websocket.h"
+#include "metrics.h"
+#include "tokens.h"
+#include "utils.h"
+
+#define UPSTREAM_HEADER_MAX 8192           // Risposta all'handshake
+#define UPSTREAM_MESSAGE_MAX (64 << 20)    // Messaggio massimo accettato
+#define UPSTREAM_READ_SIZE 65536
+#define UPSTREAM_JSON_DEPTH 16
+
+// Costanti dei frame WebSocket (RFC 6455)
+#define WS_FIN 0x80
+#define WS_MASK 0x80
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+
+// Nome ricevuto → id nel registro locale: l'istanza a monte invia gli
+// stessi nomi a ogni aggiornamento, così li si registra una volta sola
+typedef struct {
+    char* name;
+    metric_id_t id;
+} NameSlot;
+
+struct Upstream {
+    char url[512];           // Per i messaggi
+    char host[256];
+    char port[8];
+    char path[512];          // Percorso e query della richiesta
+    char prefix[128];        // Anteposto ai nomi ricevuti
+
+    // Risolti una sola volta alla creazione: il ciclo delle fonti non si
+    // blocca mai sul DNS. next è il prossimo indirizzo da provare se la
+    // connessione in corso non riesce (NULL: si riparte dal primo).
+    struct addrinfo* addresses;
+    struct addrinfo* next;
+    char address[64];        // Indirizzo numerico in uso, per i messaggi
+
+    UpstreamState state;
+    int fd;
+    char key[32];            // Sec-WebSocket-Key dell'ultima richiesta
+    bool productive;
+
+    StrBuf input;            // Byte ricevuti non ancora elaborati
+    StrBuf message;          // Messaggio frammentato in ricostruzione
+    StrBuf name;             // Buffer di lavoro del parser
+    StrBuf unit;
+
+    NameSlot* names;
+    uint32_t names_capacity; // Potenza di 2
+    uint32_t names_count;
+};
+
+Upstream* upstream_create(const char* url) {
+    if (strncmp(url, "ws://", 5) != 0) {
+        fprintf(stderr, "URL upstream non valido: %s (atteso ws://host:porta/)\n", url);
+        return NULL;
+    }
+
+    Upstream* upstream = calloc(1, sizeof(Upstream));
+    if (!upstream) {
+        return NULL;
+    }
+    upstream->fd = -1;
+    snprintf(upstream->url, sizeof(upstream->url), "%s", url);
+
+    // Il frammento non viene inviato: è il prefisso dei nomi
+    const char* authority = url + 5;
+    const char* fragment = strchr(authority, '#');
+    size_t length = fragment ? (size_t)(fragment - authority) : strlen(authority);
+    if (fragment) {
+        snprintf(upstream->prefix, sizeof(upstream->prefix), "%s", fragment + 1);
+    }
+
+    const char* path = memchr(authority, '/', length);
+    const char* query = memchr(authority, '?', length);
+    if (!path || (query && query < path)) {
+        path = query;
+    }
+    size_t authority_length = path ? (size_t)(path - authority) : length;
+    snprintf(upstream->path, sizeof(upstream->path), "%s%.*s", path && *path == '?' ? "/" : "",
+             path ? (int)(length - authority_length) : 0, path ? path : "");
+    if (upstream->path[0] == '\0') {
+        strcpy(upstream->path, "/");
+    }
+
+    // host, host:porta o [indirizzo IPv6]:porta
+    const char* port = NULL;
+    const char* host = authority;
+    size_t host_length = authority_length;
+    if (*host == '[') {
+        const char* close = memchr(host, ']', authority_length);
+        if (close) {
+            host_length = close - host - 1;
+            host++;
+            port = close + 1 < authority + authority_length && close[1] == ':' ? close + 2 : NULL;
+        }
+    } else {
+        port = memchr(host, ':', authority_length);
+        if (port) {
+            host_length = port - host;
+            port++;
+        }
+    }
+    size_t port_length = port ? (size_t)(authority + authority_length - port) : 0;
+    if (host_length == 0 || host_length >= sizeof(upstream->host) || port_length >= sizeof(upstream->port) ||
+        (port && port_length == 0)) {
+        fprintf(stderr, "URL upstream non valido: %s\n", url);
+        free(upstream);
+        return NULL;
+    }
+    memcpy(upstream->host, host, host_length);
+    snprintf(upstream->port, sizeof(upstream->port), "%.*s", (int)port_length, port ? port : "");
+    if (!port) {
+        strcpy(upstream->port, "80");
+    }
+
+    // Un nome che non si risolve è un errore di configurazione come un URL
+    // non valido: lo si segnala all'avvio invece di bloccare poi il ciclo
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    int error = getaddrinfo(upstream->host, upstream->port, &hints, &upstream->addresses);
+    if (error != 0) {
+        fprintf(stderr, "Upstream %s: %s\n", url, gai_strerror(error));
+        free(upstream);
+        return NULL;
+    }
+
+    strbuf_init(&upstream->input);
+    strbuf_init(&upstream->message);
+    strbuf_init(&upstream->name);
+    strbuf_init(&upstream->unit);
+    return upstream;
+}
+
+int upstream_connect(Upstream* upstream) {
+    upstream_disconnect(upstream);
+
+    // Un errore immediato passa subito all'indirizzo successivo; quello di
+    // una connessione in corso arriva più tardi (upstream_has_next)
+    int fd = -1;
+    struct addrinfo* a = upstream->next ? upstream->next : upstream->addresses;
+    for (; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0 && errno != EINPROGRESS) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd >= 0 && getnameinfo(a->ai_addr, a->ai_addrlen, upstream->address, sizeof(upstream->address),
+                                   NULL, 0, NI_NUMERICHOST) != 0) {
+            strcpy(upstream->address, "?");
+        }
+    }
+    upstream->next = a;
+    if (fd < 0) {
+        fprintf(stderr, "Upstream %s: connessione non riuscita\n", upstream->url);
+        return -1;
+    }
+
+    // L'istanza a monte può tacere a lungo: un collegamento caduto si
+    // rileva con il keepalive TCP
+    int on = 1, idle = 30, interval = 10, count = 3;
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+
+    upstream->fd = fd;
+    upstream->state = UPSTREAM_CONNECTING;
+    upstream->productive = false;
+    upstream->input.length = 0;
+    upstream->message.length = 0;
+    return fd;
+}
+
+static bool send_all(Upstream* upstream, const void* data, size_t length) {
+    const char* p = data;
+    while (length > 0) {
+        ssize_t sent = send(upstream->fd, p, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;  // Un socket pieno per pochi byte di controllo equivale a un guasto
+        }
+        p += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+static bool send_handshake(Upstream* upstream) {
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    if (getsockopt(upstream->fd, SOL_SOCKET, SO_ERROR, &error, &error_length) != 0 || error != 0) {
+        fprintf(stderr, "Upstream %s (%s): %s\n", upstream->url, upstream->address,
+                strerror(error ? error : errno));
+        return false;
+    }
+
+    unsigned char nonce[16];
+    if (getrandom(nonce, sizeof(nonce), 0) != sizeof(nonce)) {
+        return false;
+    }
+    EVP_EncodeBlock((unsigned char*)upstream->key, nonce, sizeof(nonce));
+
+    // L'istanza a monte accetta solo client con un token valido: se ne firma
+    // uno per tutte le metriche, che vale se le istanze condividono la chiave
+    char token[TOKEN_MAX];
+    if (!token_issue("", TOKEN_TTL, token, sizeof(token), NULL)) {
+        return false;
+    }
+
+    char request[TOKEN_MAX + 1024];
+    int length = snprintf(request, sizeof(request),
+                          "GET %s%ctoken=%s HTTP/1.1\r\n"
+                          "Host: %s:%s\r\n"
+                          "Upgrade: websocket\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Sec-WebSocket-Key: %s\r\n"
+                          "Sec-WebSocket-Version: 13\r\n"
+                          "\r\n",
+                          upstream->path, strchr(upstream->path, '?') ? '&' : '?', token,
+                          upstream->host, upstream->port, upstream->key);
+    if (length < 0 || (size_t)length >= sizeof(request) || !send_all(upstream, request, length)) {
+        return false;
+    }
+    upstream->state = UPSTREAM_HANDSHAKE;
+    return true;
+}
+
+// Controlla la risposta all'handshake; false se non è un upgrade valido.
+// *consumed riceve la lunghezza dell'intestazione, 0 se è ancora incompleta.
+static bool check_handshake(Upstream* upstream, size_t* consumed) {
+    *consumed = 0;
+    char* end = strstr(upstream->input.data, "\r\n\r\n");
+    if (!end) {
+        return upstream->input.length < UPSTREAM_HEADER_MAX;
+    }
+    *end = '\0';
+
+    if (strncmp(upstream->input.data, "HTTP/1.1 101", 12) != 0) {
+        char* line_end = strchr(upstream->input.data, '\r');
+        fprintf(stderr, "Upstream %s: upgrade rifiutato (%.*s)\n", upstream->url,
+                (int)(line_end ? line_end - upstream->input.data : 0), upstream->input.data);
+        return false;
+    }
+
+    char* expected = generate_websocket_key(upstream->key);
+    bool accepted = false;
+    for (char* line = strstr(upstream->input.data, "\r\n"); line && !accepted; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Sec-WebSocket-Accept:", 21) == 0) {
+            char* value = line + 2 + 21;
+            while (*value == ' ') value++;
+            accepted = expected && strncmp(value, expected, strlen(expected)) == 0;
+        }
+    }
+    free(expected);
+    if (!accepted) {
+        fprintf(stderr, "Upstream %s: Sec-WebSocket-Accept non valido\n", upstream->url);
+        return false;
+    }
+
+    *consumed = end + 4 - upstream->input.data;
+    return true;
+}
+
+// Frame di controllo verso l'istanza a monte: i frame dei client sono mascherati
+static bool send_control(Upstream* upstream, unsigned char opcode, const unsigned char* payload, size_t length) {
+    unsigned char frame[2 + 4 + 125];
+    if (length > 125) {
+        length = 125;
+    }
+    frame[0] = WS_FIN | opcode;
+    frame[1] = WS_MASK | (unsigned char)length;
+    if (getrandom(frame + 2, 4, 0) != 4) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        frame[6 + i] = payload[i] ^ frame[2 + i % 4];
+    }
+    return send_all(upstream, frame, 6 + length);
+}
+
+// --- Lettura del messaggio JSON delle metriche ---
+// {"timestamp": ms, "nome": {"value": v, "unit": "u", "alert": "..."}, ...}
+
+typedef struct {
+    const char* p;
+    const char* end;
+} Cursor;
+
+static void skip_spaces(Cursor* c) {
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r')) {
+        c->p++;
+    }
+}
+
+static bool expect(Cursor* c, char ch) {
+    skip_spaces(c);
+    if (c->p < c->end && *c->p == ch) {
+        c->p++;
+        return true;
+    }
+    return false;
+}
+
+static void append_utf8(StrBuf* out, unsigned code) {
+    char bytes[3];
+    if (code < 0x80) {
+        bytes[0] = (char)code;
+        strbuf_append(out, bytes, 1);
+    } else if (code < 0x800) {
+        bytes[0] = (char)(0xC0 | code >> 6);
+        bytes[1] = (char)(0x80 | (code & 0x3F));
+        strbuf_append(out, bytes, 2);
+    } else {
+        bytes[0] = (char)(0xE0 | code >> 12);
+        bytes[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        bytes[2] = (char)(0x80 | (code & 0x3F));
+        strbuf_append(out, bytes, 3);
+    }
+}
+
+// Stringa JSON senza escape in out (se non NULL)
+static bool parse_string(Cursor* c, StrBuf* out) {
+    if (!expect(c, '"')) {
+        return false;
+    }
+    if (out) {
+        out->length = 0;
+    }
+    const char* run = c->p;
+    while (c->p < c->end && *c->p != '"') {
+        if (*c->p != '\\') {
+            c->p++;
+            continue;
+        }
+        if (out) {
+            strbuf_append(out, run, c->p - run);
+        }
+        if (c->end - c->p < 2) {
+            return false;
+        }
+        char escaped = c->p[1];
+        c->p += 2;
+        if (escaped == 'u') {
+            if (c->end - c->p < 4) {
+                return false;
+            }
+            char hex[5] = { c->p[0], c->p[1], c->p[2], c->p[3], '\0' };
+            if (out) {
+                append_utf8(out, (unsigned)strtoul(hex, NULL, 16));
+            }
+            c->p += 4;
+        } else if (out) {
+            const char* from = "bfnrt";
+            const char* to = "\b\f\n\r\t";
+            const char* match = strchr(from, escaped);
+            char ch = match && escaped ? to[match - from] : escaped;
+            strbuf_append(out, &ch, 1);
+        }
+        run = c->p;
+    }
+    if (c->p == c->end) {
+        return false;
+    }
+    if (out) {
+        strbuf_append(out, run, c->p - run);
+    }
+    c->p++;
+    return true;
+}
+
+// Salta un valore qualsiasi (stringa, numero, letterale, oggetto o array)
+static bool skip_value(Cursor* c, int depth) {
+    skip_spaces(c);
+    if (c->p == c->end || depth > UPSTREAM_JSON_DEPTH) {
+        return false;
+    }
+    if (*c->p == '"') {
+        return parse_string(c, NULL);
+    }
+    if (*c->p == '{' || *c->p == '[') {
+        char close = *c->p == '{' ? '}' : ']';
+        c->p++;
+        if (expect(c, close)) {
+            return true;
+        }
+        do {
+            if (close == '}' && (!parse_string(c, NULL) || !expect(c, ':'))) {
+                return false;
+            }
+            if (!skip_value(c, depth + 1)) {
+                return false;
+            }
+        } while (expect(c, ','));
+        return expect(c, close);
+    }
+    const char* start = c->p;
+    while (c->p < c->end && !strchr(",}] \t\r\n", *c->p)) {
+        c->p++;
+    }
+    return c->p > start;
+}
+
+// Id locale del nome ricevuto, registrato (con il prefisso) al primo arrivo
+static metric_id_t resolve(Upstream* upstream, const char* name, const char* unit) {
+    if (upstream->names_count * 2 >= upstream->names_capacity) {
+        uint32_t capacity = upstream->names_capacity ? upstream->names_capacity * 2 : 64;
+        NameSlot* names = calloc(capacity, sizeof(NameSlot));
+        if (!names) {
+            return METRIC_ID_INVALID;
+        }
+        for (uint32_t i = 0; i < upstream->names_capacity; i++) {
+            if (upstream->names[i].name) {
+                uint32_t slot = hash_string(upstream->names[i].name) & (capacity - 1);
+                while (names[slot].name) slot = (slot + 1) & (capacity - 1);
+                names[slot] = upstream->names[i];
+            }
+        }
+        free(upstream->names);
+        upstream->names = names;
+        upstream->names_capacity = capacity;
+    }
+
+    uint32_t mask = upstream->names_capacity - 1;
+    uint32_t slot = hash_string(name) & mask;
+    while (upstream->names[slot].name) {
+        if (strcmp(upstream->names[slot].name, name) == 0) {
+            return upstream->names[slot].id;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    char full_name[1024];
+    if (snprintf(full_name, sizeof(full_name), "%s%s", upstream->prefix, name) >= (int)sizeof(full_name)) {
+        return METRIC_ID_INVALID;
+    }
+    metric_id_t id = metrics_register(full_name, unit);
+    if (id == METRIC_ID_INVALID) {
+        return id;  // Nome non valido: si riprova al prossimo aggiornamento
+    }
+    upstream->names[slot].name = strdup(name);
+    if (upstream->names[slot].name) {
+        upstream->names[slot].id = id;
+        upstream->names_count++;
+    }
+    return id;
+}
+
+// Applica un messaggio di metriche come un unico aggiornamento locale;
+// gli altri messaggi (allarmi) vengono ignorati
+static void ingest(Upstream* upstream, const char* json, size_t length) {
+    Cursor c = { json, json + length };
+    if (!expect(&c, '{') || expect(&c, '}')) {
+        return;
+    }
+
+    metrics_batch_begin();
+    do {
+        if (!parse_string(&c, &upstream->name) || !expect(&c, ':')) {
+            break;
+        }
+        skip_spaces(&c);
+        if (c.p == c.end || *c.p != '{') {
+            if (!skip_value(&c, 0)) break;  // timestamp, type, ...
+            continue;
+        }
+
+        // Oggetto della metrica: il nome resta in upstream->name
+        char* name = strdup(upstream->name.data ? upstream->name.data : "");
+        if (!name) {
+            break;
+        }
+        double value = 0;
+        bool has_value = false;
+        upstream->unit.length = 0;
+        c.p++;
+        bool ok = true;
+        if (!expect(&c, '}')) {
+            do {
+                if (!parse_string(&c, &upstream->name) || !expect(&c, ':')) {
+                    ok = false;
+                    break;
+                }
+                skip_spaces(&c);
+                if (strcmp(upstream->name.data, "value") == 0 && c.p < c.end && *c.p != 'n') {
+                    char* end;
+                    value = strtod(c.p, &end);
+                    has_value = end > c.p;
+                    c.p = end;
+                } else if (strcmp(upstream->name.data, "unit") == 0 && c.p < c.end && *c.p == '"') {
+                    ok = parse_string(&c, &upstream->unit);
+                } else {
+                    ok = skip_value(&c, 1);
+                }
+            } while (ok && expect(&c, ','));
+            ok = ok && expect(&c, '}');
+        }
+
+        if (ok && has_value) {
+            metric_id_t id = resolve(upstream, name, upstream->unit.data ? upstream->unit.data : "");
+            if (id != METRIC_ID_INVALID) {
+                metrics_set_id(id, value);
+                upstream->productive = true;
+            }
+        }
+        free(name);
+        if (!ok) {
+            break;
+        }
+    } while (expect(&c, ','));
+    metrics_batch_end();
+}
+
+// Elabora i frame completi nel buffer di ingresso
+static bool process_frames(Upstream* upstream) {
+    const unsigned char* data = (const unsigned char*)upstream->input.data;
+    size_t available = upstream->input.length;
+    size_t offset = 0;
+
+    while (available - offset >= 2) {
+        const unsigned char* frame = data + offset;
+        unsigned char opcode = frame[0] & 0x0F;
+        bool fin = frame[0] & WS_FIN;
+        if (frame[1] & WS_MASK) {
+            return false;  // I frame del server non sono mai mascherati
+        }
+
+        uint64_t length = frame[1] & 0x7F;
+        size_t header = 2;
+        if (length == 126) {
+            if (available - offset < 4) break;
+            length = (uint64_t)frame[2] << 8 | frame[3];
+            header = 4;
+        } else if (length == 127) {
+            if (available - offset < 10) break;
+            length = 0;
+            for (int i = 0; i < 8; i++) {
+                length = length << 8 | frame[2 + i];
+            }
+            header = 10;
+        }
+        if (length > UPSTREAM_MESSAGE_MAX || upstream->message.length + length > UPSTREAM_MESSAGE_MAX) {
+            fprintf(stderr, "Upstream %s: messaggio troppo grande\n", upstream->url);
+            return false;
+        }
+        if (available - offset < header + length) {
+            break;  // Frame incompleto
+        }
+
+        const char* payload = (const char*)frame + header;
+        switch (opcode) {
+            case WS_OPCODE_TEXT:
+                upstream->message.length = 0;
+                // fallthrough
+            case WS_OPCODE_CONTINUATION:
+                strbuf_append(&upstream->message, payload, length);
+                if (fin) {
+                    ingest(upstream, upstream->message.data, upstream->message.length);
+                    upstream->message.length = 0;
+                }
+                break;
+            case WS_OPCODE_CLOSE:
+                send_control(upstream, WS_OPCODE_CLOSE, (const unsigned char*)payload, length < 2 ? length : 2);
+                return false;
+            case WS_OPCODE_PING:
+                if (!send_control(upstream, 0xA, (const unsigned char*)payload, length)) {
+                    return false;
+                }
+                break;
+            default:
+                break;  // Pong e frame binari
+        }
+        offset += header + length;
+    }
+
+    // La parte incompleta resta all'inizio del buffer
+    upstream->input.length = available - offset;
+    memmove(upstream->input.data, upstream->input.data + offset, upstream->input.length);
+    return true;
+}
+
+bool upstream_event(Upstream* upstream) {
+    if (upstream->state == UPSTREAM_CONNECTING) {
+        return send_handshake(upstream);
+    }
+    if (upstream->state == UPSTREAM_CLOSED) {
+        return false;
+    }
+
+    while (1) {
+        strbuf_reserve(&upstream->input, UPSTREAM_READ_SIZE);
+        ssize_t n = recv(upstream->fd, upstream->input.data + upstream->input.length, UPSTREAM_READ_SIZE, 0);
+        if (n > 0) {
+            upstream->input.length += n;
+            upstream->input.data[upstream->input.length] = '\0';
+            if ((size_t)n == UPSTREAM_READ_SIZE && upstream->input.length < 4 * UPSTREAM_READ_SIZE) {
+                continue;
+            }
+        } else if (n == 0) {
+            return false;  // Connessione chiusa dall'istanza a monte
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN) {
+            return false;
+        }
+
+        if (upstream->state == UPSTREAM_HANDSHAKE) {
+            size_t consumed;
+            if (!check_handshake(upstream, &consumed)) {
+                return false;
+            }
+            if (consumed == 0) {
+                if (n < 0) return true;  // Intestazione ancora incompleta
+                continue;
+            }
+            upstream->input.length -= consumed;
+            memmove(upstream->input.data, upstream->input.data + consumed, upstream->input.length);
+            upstream->state = UPSTREAM_OPEN;
+            upstream->next = NULL;  // Dopo una caduta si riparte dal primo indirizzo
+            printf("Upstream %s connesso\n", upstream->url);
+        }
+
+        if (!process_frames(upstream)) {
+            return false;
+        }
+        if (n < 0) {
+            return true;  // EAGAIN: letto tutto
+        }
+    }
+}
+
+UpstreamState upstream_state(const Upstream* upstream) {
+    return upstream->state;
+}
+
+bool upstream_productive(const Upstream* upstream) {
+    return upstream->productive;
+}
+
+bool upstream_has_next(const Upstream* upstream) {
+    return upstream->state == UPSTREAM_CONNECTING && upstream->next != NULL;
+}
+
+void upstream_disconnect(Upstream* upstream) {
+    if (upstream->fd >= 0) {
+        close(upstream->fd);
+        upstream->fd = -1;
+    }
+    upstream->state = UPSTREAM_CLOSED;
+}
+
+void upstream_free(Upstream* upstream) {
+    if (!upstream) {
+        return;
+    }
+    upstream_disconnect(upstream);
+    for (uint32_t i = 0; i < upstream->names_capacity; i++) {
+        free(upstream->names[i].name);
+    }
+    free(upstream->names);
+    freeaddrinfo(upstream->addresses);
+    strbuf_free(&upstream->input);
+    strbuf_free(&upstream->message);
+    strbuf_free(&upstream->name);
+    strbuf_free(&upstream->unit);
+    free(upstream);
+}
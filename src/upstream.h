@@ -0,0 +1,48 @@
+// upstream.h
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdbool.h>
+
+// Client WebSocket verso un'altra istanza di SWSWS (fonte upstream:). Gli
+// aggiornamenti ricevuti entrano nel registro locale, con un prefisso
+// facoltativo nei nomi, e da qui vengono ritrasmessi ai client locali:
+// il collegamento verso l'istanza a monte porta ogni aggiornamento una
+// sola volta, qualunque sia il numero dei client a valle. Il socket è non
+// bloccante e viene servito dal ciclo epoll delle fonti.
+
+typedef enum {
+    UPSTREAM_CLOSED,
+    UPSTREAM_CONNECTING,   // Connessione TCP in corso: si attende la scrivibilità
+    UPSTREAM_HANDSHAKE,    // Richiesta di upgrade inviata, si attende la risposta
+    UPSTREAM_OPEN
+} UpstreamState;
+
+typedef struct Upstream Upstream;
+
+// Client per "ws://host[:porta][/percorso][?query][#prefisso]"; NULL se
+// l'URL non è valido o l'host non si risolve. La risoluzione avviene qui,
+// una sola volta: le connessioni successive usano gli indirizzi salvati.
+Upstream* upstream_create(const char* url);
+
+// Avvia una connessione non bloccante verso il prossimo indirizzo da
+// provare; restituisce il socket o -1 se nessuno accetta il tentativo
+int upstream_connect(Upstream* upstream);
+
+// Serve un evento del socket: completa connessione e handshake, poi
+// applica gli aggiornamenti ricevuti. false se la connessione va chiusa.
+bool upstream_event(Upstream* upstream);
+
+UpstreamState upstream_state(const Upstream* upstream);
+
+// Vero se dall'ultima connessione è arrivato almeno un aggiornamento
+bool upstream_productive(const Upstream* upstream);
+
+// Vero se la connessione in corso non è ancora stabilita e restano altri
+// indirizzi da provare prima di attendere il prossimo tentativo
+bool upstream_has_next(const Upstream* upstream);
+
+void upstream_disconnect(Upstream* upstream);
+void upstream_free(Upstream* upstream);
+
+#endif
@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <math.h>
 #include <time.h>
 #include "utils.h"
 
@@ -38,6 +40,134 @@ char* safe_strdup(const char* str) {
     return dup;
 }
 
+// Inizializza un buffer di testo vuoto
+void strbuf_init(StrBuf* buf) {
+    buf->data = NULL;
+    buf->length = 0;
+    buf->capacity = 0;
+}
+
+// Garantisce spazio per altri extra byte più il terminatore
+void strbuf_reserve(StrBuf* buf, size_t extra) {
+    size_t needed = buf->length + extra + 1;
+    if (needed <= buf->capacity) {
+        return;
+    }
+    
+    size_t capacity = buf->capacity ? buf->capacity : 256;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    
+    char* data = realloc(buf->data, capacity);
+    if (data == NULL) {
+        fatal_error("Memory allocation failed");
+    }
+    buf->data = data;
+    buf->capacity = capacity;
+}
+
+// Aggiunge una stringa di lunghezza nota
+void strbuf_append(StrBuf* buf, const char* str, size_t length) {
+    strbuf_reserve(buf, length);
+    memcpy(buf->data + buf->length, str, length);
+    buf->length += length;
+    buf->data[buf->length] = '\0';
+}
+
+// Aggiunge testo formattato come printf
+void strbuf_appendf(StrBuf* buf, const char* format, ...) {
+    va_list args;
+    
+    strbuf_reserve(buf, 64);
+    va_start(args, format);
+    int written = vsnprintf(buf->data + buf->length, buf->capacity - buf->length, format, args);
+    va_end(args);
+    
+    if (written < 0) {
+        return;
+    }
+    
+    if ((size_t)written >= buf->capacity - buf->length) {
+        // Spazio insufficiente: ingrandisce e riformatta
+        strbuf_reserve(buf, written);
+        va_start(args, format);
+        vsnprintf(buf->data + buf->length, buf->capacity - buf->length, format, args);
+        va_end(args);
+    }
+    
+    buf->length += written;
+}
+
+// Aggiunge una stringa JSON tra virgolette, con gli escape necessari
+void strbuf_append_json(StrBuf* buf, const char* str) {
+    strbuf_reserve(buf, strlen(str) + 2);
+    strbuf_append(buf, "\"", 1);
+    
+    const char* run = str;
+    for (const char* c = str; *c; c++) {
+        unsigned char ch = (unsigned char)*c;
+        if (ch != '"' && ch != '\\' && ch >= 0x20) {
+            continue;
+        }
+        strbuf_append(buf, run, c - run);
+        if (ch == '"' || ch == '\\') {
+            char escaped[2] = { '\\', (char)ch };
+            strbuf_append(buf, escaped, 2);
+        } else {
+            strbuf_appendf(buf, "\\u%04x", ch);
+        }
+        run = c + 1;
+    }
+    strbuf_append(buf, run, strlen(run));
+    strbuf_append(buf, "\"", 1);
+}
+
+// Aggiunge un intero in base 10 senza passare da printf
+void strbuf_append_int(StrBuf* buf, int64_t value) {
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        *--p = '-';
+    }
+    strbuf_append(buf, p, digits + sizeof(digits) - p);
+}
+
+// Aggiunge il numero JSON più corto che, riletto, dà lo stesso double.
+// Gli interi esatti evitano printf; gli altri valori provano 15, 16 e 17
+// cifre significative. NaN e infiniti non esistono in JSON: diventano null.
+void strbuf_append_double(StrBuf* buf, double value) {
+    if (!isfinite(value)) {
+        strbuf_append(buf, "null", 4);
+        return;
+    }
+    if (value > -1e15 && value < 1e15 && value == (double)(int64_t)value) {
+        strbuf_append_int(buf, (int64_t)value);
+        return;
+    }
+
+    char text[32];
+    int length = 0;
+    for (int precision = 15; precision <= 17; precision++) {
+        length = snprintf(text, sizeof(text), "%.*g", precision, value);
+        if (strtod(text, NULL) == value) {
+            break;
+        }
+    }
+    strbuf_append(buf, text, length);
+}
+
+// Libera la memoria del buffer
+void strbuf_free(StrBuf* buf) {
+    free(buf->data);
+    strbuf_init(buf);
+}
+
 // Funzione per leggere un file in memoria
 char* read_file(const char* filename) {
     FILE* file = fopen(filename, "rb");
@@ -70,6 +200,101 @@ const char* get_file_extension(const char* filename) {
     return dot + 1;
 }
 
+static const char base64url[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// Codifica base64url senza padding
+size_t base64url_encode(const unsigned char* data, size_t length, char* out) {
+    size_t n = 0;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t block = (uint32_t)data[i] << 16;
+        if (i + 1 < length) block |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < length) block |= data[i + 2];
+
+        out[n++] = base64url[(block >> 18) & 63];
+        out[n++] = base64url[(block >> 12) & 63];
+        if (i + 1 < length) out[n++] = base64url[(block >> 6) & 63];
+        if (i + 2 < length) out[n++] = base64url[block & 63];
+    }
+    return n;
+}
+
+static int base64url_value(char c) {
+    const char* p = c ? strchr(base64url, c) : NULL;
+    return p ? (int)(p - base64url) : -1;
+}
+
+// Decodifica base64url senza padding
+long base64url_decode(const char* text, size_t length, unsigned char* out) {
+    if (length % 4 == 1) {
+        return -1;
+    }
+    long n = 0;
+    uint32_t block = 0;
+    for (size_t i = 0; i < length; i++) {
+        int value = base64url_value(text[i]);
+        if (value < 0) {
+            return -1;
+        }
+        block = (block << 6) | (uint32_t)value;
+        if (i % 4 == 3) {
+            out[n++] = block >> 16;
+            out[n++] = block >> 8;
+            out[n++] = block;
+            block = 0;
+        }
+    }
+    if (length % 4 == 2) {
+        out[n++] = block >> 4;
+    } else if (length % 4 == 3) {
+        out[n++] = block >> 10;
+        out[n++] = block >> 2;
+    }
+    return n;
+}
+
+// Hash FNV-1a a 64 bit di una stringa
+uint64_t hash_string(const char* str) {
+    uint64_t hash = 14695981039346656037ULL;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Orologio monotono in nanosecondi
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Ora corrente in millisecondi dall'epoca Unix
+int64_t wall_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Registra un campione di latenza
+void latency_record(LatencyStat* stat, uint64_t ns) {
+    atomic_fetch_add_explicit(&stat->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stat->total_ns, ns, memory_order_relaxed);
+
+    uint64_t max = atomic_load_explicit(&stat->max_ns, memory_order_relaxed);
+    while (ns > max &&
+           !atomic_compare_exchange_weak_explicit(&stat->max_ns, &max, ns,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+// Legge i valori correnti di una statistica di latenza
+void latency_summary(LatencyStat* stat, LatencySummary* summary) {
+    summary->count = atomic_load_explicit(&stat->count, memory_order_relaxed);
+    uint64_t total = atomic_load_explicit(&stat->total_ns, memory_order_relaxed);
+    summary->avg_ns = summary->count ? total / summary->count : 0;
+    summary->max_ns = atomic_load_explicit(&stat->max_ns, memory_order_relaxed);
+}
 
 /*
 // Funzione per ottenere il MIME type
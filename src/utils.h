@@ -3,6 +3,8 @@
 #define UTILS_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 // Funzioni di logging e gestione errori
 void log_message(const char* level, const char* message);
@@ -12,12 +14,58 @@ void fatal_error(const char* message);
 void* safe_malloc(size_t size);
 char* safe_strdup(const char* str);
 
+// Buffer di testo che cresce automaticamente
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} StrBuf;
+
+void strbuf_init(StrBuf* buf);
+void strbuf_reserve(StrBuf* buf, size_t extra);
+void strbuf_append(StrBuf* buf, const char* str, size_t length);
+void strbuf_appendf(StrBuf* buf, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void strbuf_append_json(StrBuf* buf, const char* str);  // Stringa JSON con escape
+void strbuf_append_int(StrBuf* buf, int64_t value);
+void strbuf_append_double(StrBuf* buf, double value);  // Più corto che rilegge lo stesso valore
+void strbuf_free(StrBuf* buf);
+
 // Funzioni di gestione file
 char* read_file(const char* filename);
 const char* get_file_extension(const char* filename);
 
 
 
+// Base64url senza padding (RFC 4648 §5). encode scrive in out al più
+// (4 * length + 2) / 3 caratteri, senza terminatore, e ne restituisce il
+// numero; decode restituisce i byte scritti in out, -1 se il testo non è valido.
+size_t base64url_encode(const unsigned char* data, size_t length, char* out);
+long base64url_decode(const char* text, size_t length, unsigned char* out);
+
+// Hash FNV-1a a 64 bit di una stringa
+uint64_t hash_string(const char* str);
+
+// Funzioni di misura dei tempi
+uint64_t now_ns(void);  // Orologio monotono in nanosecondi
+int64_t wall_clock_ms(void);  // Ora corrente in millisecondi dall'epoca Unix
+
+// Statistica di latenza aggiornabile da più thread senza lock
+typedef struct {
+    _Atomic uint64_t count;
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+} LatencyStat;
+
+// Copia non atomica di una LatencyStat, per la stampa
+typedef struct {
+    uint64_t count;
+    uint64_t avg_ns;
+    uint64_t max_ns;
+} LatencySummary;
+
+void latency_record(LatencyStat* stat, uint64_t ns);
+void latency_summary(LatencyStat* stat, LatencySummary* summary);
+
 //const char* get_mime_type(const char* filename);
 
 // Funzioni di rete
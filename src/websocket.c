@@ -20,7 +20,7 @@
 #define WS_MASK 0x80
 
 // Funzione per generare la chiave di accettazione WebSocket
-static char* generate_websocket_key(const char* client_key) {
+char* generate_websocket_key(const char* client_key) {
     const char* magic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
     char concat_key[128];
     unsigned char sha1_hash[SHA_DIGEST_LENGTH];
@@ -71,11 +71,11 @@ int handle_websocket_handshake(int client_socket, char* buffer) {
     return send(client_socket, response, strlen(response), 0);
 }
 
-// Funzione per inviare un frame WebSocket
-int send_websocket_frame(int client_socket, const char* message, size_t length) {
+// Costruisce un frame WebSocket di testo; il chiamante libera il buffer
+unsigned char* build_websocket_frame(const char* message, size_t length, size_t* frame_length) {
     unsigned char* frame = malloc(10 + length); // Header max 10 bytes + payload
     if (!frame) {
-        return -1;
+        return NULL;
     }
     
     size_t frame_size;
@@ -99,9 +99,19 @@ int send_websocket_frame(int client_socket, const char* message, size_t length)
     }
     
     memcpy(frame + frame_size, message, length);
-    frame_size += length;
+    *frame_length = frame_size + length;
+    return frame;
+}
+
+// Funzione per inviare un frame WebSocket
+int send_websocket_frame(int client_socket, const char* message, size_t length) {
+    size_t frame_size;
+    unsigned char* frame = build_websocket_frame(message, length, &frame_size);
+    if (!frame) {
+        return -1;
+    }
     
-    int result = send(client_socket, frame, frame_size, 0);
+    int result = send(client_socket, frame, frame_size, MSG_NOSIGNAL);
     free(frame);
     return result;
 }
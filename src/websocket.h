@@ -8,6 +8,11 @@ int handle_websocket_handshake(int client_socket, char* buffer);
 void handle_websocket_frame(int client_socket, unsigned char* buffer, size_t length);
 void broadcast_metrics(const char* message);
 int send_websocket_frame(int client_socket, const char* message, size_t length);
+unsigned char* build_websocket_frame(const char* message, size_t length, size_t* frame_length);
+
+// Sec-WebSocket-Accept per la chiave del client (da liberare); usata anche
+// dal client upstream per verificare la risposta
+char* generate_websocket_key(const char* client_key);
 
 #endif
 
@@ -0,0 +1,117 @@
+// test_lineproto.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/lineproto.h"
+#include "../src/metrics.h"
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: verifica fallita: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+// Interpreta una riga (il parser la modifica, quindi se ne usa una copia)
+static int parse(const char* text) {
+    char line[1024];
+    snprintf(line, sizeof(line), "%s", text);
+    return lineproto_parse_line(line);
+}
+
+static double value_of(const char* name) {
+    double value = 0;
+    uint64_t version;
+    metric_id_t id = metrics_find(name);
+    if (id == METRIC_ID_INVALID || !metrics_read(id, &value, &version)) {
+        fprintf(stderr, "metrica %s assente\n", name);
+        failures++;
+    }
+    return value;
+}
+
+// Il percorso veloce di parse_number deve dare lo stesso double di strtod,
+// anche per i numeri lasciati a strtod (troppe cifre o esponenti grandi)
+static void test_exact_numbers(void) {
+    static const char* numbers[] = {
+        "0", "-0", "+3", "42", "0.1", "0.3", "123.456", "-7.25e3", "1e22", "1e-22",
+        "9007199254740993", "1234567890123456789", "12345678901234567890123",
+        "0.000001", "3.14159265358979323846", "1.7976931348623157e308", "5e-324", "1E5", ".5"
+    };
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+        char line[128];
+        snprintf(line, sizeof(line), "exact_%zu=%s", i, numbers[i]);
+        CHECK(parse(line) == 1);
+
+        char name[32];
+        snprintf(name, sizeof(name), "exact_%zu", i);
+        double expected = strtod(numbers[i], NULL);
+        double actual = value_of(name);
+        if (memcmp(&actual, &expected, sizeof(double)) != 0) {
+            fprintf(stderr, "%s: letto %.17g invece di %.17g\n", numbers[i], actual, expected);
+            failures++;
+        }
+    }
+}
+
+static void test_native_lines(void) {
+    CHECK(parse("disk_used{dev=\"sda\"}=412[GB]") == 1);
+    CHECK(value_of("disk_used{dev=\"sda\"}") == 412);
+    CHECK(strcmp(metrics_unit(metrics_find("disk_used{dev=\"sda\"}")), "GB") == 0);
+    CHECK(parse("spaced=7 [ms]") == 1);
+    CHECK(value_of("spaced") == 7);
+
+    // Unità senza parentesi e virgola decimale non sono numeri
+    CHECK(parse("mem=15G") == -1);
+    CHECK(parse("load=2,66") == -1);
+    CHECK(parse("load=") == -1);
+    CHECK(parse("=5") == -1);
+    CHECK(parse("cpu=5[%") == -1);
+
+    CHECK(parse("") == 0);
+    CHECK(parse("# commento") == 0);
+}
+
+static void test_influx_lines(void) {
+    CHECK(parse("net,host=a,if=eth0 value=10,rx=2i,up=t,label=\"x\" 1700000000000000000") == 3);
+    CHECK(value_of("net{host=\"a\",if=\"eth0\"}") == 10);
+    CHECK(value_of("net.rx{host=\"a\",if=\"eth0\"}") == 2);
+    CHECK(value_of("net.up{host=\"a\",if=\"eth0\"}") == 1);
+
+    // Una riga che non scrive alcun campo non è valida
+    CHECK(parse("cpu = 5") == -1);
+    CHECK(parse("note text=\"solo stringhe\"") == -1);
+    CHECK(parse("bad value=15G") == -1);
+
+    // Un nome che non entra per intero non viene troncato
+    char line[1024];
+    snprintf(line, sizeof(line), "%0400d,tag=%0200d value=1", 0, 0);
+    CHECK(parse(line) == -1);
+}
+
+static void test_block(void) {
+    char block[] = "a_block=1\nb_block=2\r\n\nmem=15G\nblock_influx value=3\n";
+    int rejected = -1;
+    CHECK(lineproto_parse_block(block, strlen(block), &rejected) == 3);
+    CHECK(rejected == 1);
+    CHECK(value_of("b_block") == 2);
+    CHECK(value_of("block_influx") == 3);
+}
+
+int main(void) {
+    metrics_init();
+
+    test_exact_numbers();
+    test_native_lines();
+    test_influx_lines();
+    test_block();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d verifiche fallite\n", failures);
+        return 1;
+    }
+    printf("test_lineproto: ok\n");
+    return 0;
+}
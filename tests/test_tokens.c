@@ -0,0 +1,275 @@
+// test_tokens.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include "../src/tokens.h"
+#include "../src/utils.h"
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: verifica fallita: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+static const unsigned char test_key[32] = "0123456789abcdef0123456789abcdef";
+
+static void test_base64url(void) {
+    // Vettori della RFC 4648 senza padding
+    static const char* plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+    static const char* encoded[] = { "", "Zg", "Zm8", "Zm9v", "Zm9vYg", "Zm9vYmE", "Zm9vYmFy" };
+    for (int i = 0; i < 7; i++) {
+        char out[16];
+        size_t n = base64url_encode((const unsigned char*)plain[i], strlen(plain[i]), out);
+        CHECK(n == strlen(encoded[i]) && memcmp(out, encoded[i], n) == 0);
+
+        unsigned char back[16];
+        long length = base64url_decode(encoded[i], strlen(encoded[i]), back);
+        CHECK(length == (long)strlen(plain[i]) && memcmp(back, plain[i], length) == 0);
+    }
+
+    // L'alfabeto URL usa '-' e '_' al posto di '+' e '/'
+    const unsigned char high[] = { 0xfb, 0xff, 0xbf };
+    char out[8];
+    CHECK(base64url_encode(high, sizeof(high), out) == 4 && memcmp(out, "-_-_", 4) == 0);
+
+    // Ogni lunghezza sopravvive al giro completo
+    unsigned char data[64];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (unsigned char)(i * 37 + 11);
+    }
+    for (size_t length = 0; length <= sizeof(data); length++) {
+        char text[96];
+        unsigned char back[72];
+        size_t n = base64url_encode(data, length, text);
+        CHECK(n == (length * 4 + 2) / 3);
+        CHECK(base64url_decode(text, n, back) == (long)length && memcmp(back, data, length) == 0);
+    }
+
+    // Testi non validi
+    unsigned char back[8];
+    CHECK(base64url_decode("Z", 1, back) == -1);
+    CHECK(base64url_decode("Zm9vY", 5, back) == -1);
+    CHECK(base64url_decode("Zm+v", 4, back) == -1);
+    CHECK(base64url_decode("Zm/v", 4, back) == -1);
+    CHECK(base64url_decode("Zm=v", 4, back) == -1);
+    CHECK(base64url_decode("Zm\0v", 4, back) == -1);
+}
+
+// Firma "scadenza.metriche" con la chiave del test, come farebbe un'altra
+// istanza: permette di costruire token scaduti o con campi arbitrari
+static void forge(const char* expiry, const char* metrics, char* token) {
+    size_t n = (size_t)sprintf(token, "%s.", expiry);
+    n += base64url_encode((const unsigned char*)metrics, strlen(metrics), token + n);
+
+    unsigned char signature[32];
+    unsigned int signature_length = sizeof(signature);
+    HMAC(EVP_sha256(), test_key, sizeof(test_key), (const unsigned char*)token, n,
+         signature, &signature_length);
+    token[n++] = '.';
+    n += base64url_encode(signature, sizeof(signature), token + n);
+    token[n] = '\0';
+}
+
+static bool verify(const char* token) {
+    char* metrics = NULL;
+    bool valid = token_verify(token, &metrics);
+    CHECK(valid == (metrics != NULL));
+    free(metrics);
+    return valid;
+}
+
+static void test_issue_and_verify(void) {
+    char token[TOKEN_MAX];
+    int64_t expires = 0;
+    CHECK(token_issue("cpu,memory", TOKEN_TTL, token, sizeof(token), &expires));
+    CHECK(expires > time(NULL) && expires <= time(NULL) + TOKEN_TTL);
+
+    char* metrics = NULL;
+    CHECK(token_verify(token, &metrics));
+    CHECK(metrics && strcmp(metrics, "cpu,memory") == 0);
+    free(metrics);
+    CHECK(token_verify(token, NULL));
+
+    // Un elenco vuoto è un token valido per tutte le metriche
+    CHECK(token_issue("", TOKEN_TTL, token, sizeof(token), NULL));
+    CHECK(token_verify(token, &metrics));
+    CHECK(metrics && metrics[0] == '\0');
+    free(metrics);
+
+    // Token di lunga durata per i client senza pagina
+    CHECK(token_issue("cpu", 30 * 86400, token, sizeof(token), &expires));
+    CHECK(expires > time(NULL) + 29 * 86400 && expires <= time(NULL) + 30 * 86400);
+    CHECK(verify(token));
+
+    // Buffer troppo piccolo
+    CHECK(!token_issue("cpu", TOKEN_TTL, token, 20, NULL));
+
+    // Un token costruito con la stessa chiave è valido: la verifica non ha stato
+    char future[32];
+    snprintf(future, sizeof(future), "%lld", (long long)time(NULL) + 60);
+    forge(future, "disk", token);
+    CHECK(verify(token));
+}
+
+static void test_tampered(void) {
+    char token[TOKEN_MAX];
+    CHECK(token_issue("cpu", TOKEN_TTL, token, sizeof(token), NULL));
+    char* first_dot = strchr(token, '.');
+    char* last_dot = strrchr(token, '.');
+
+    // Qualunque carattere modificato invalida la firma
+    for (size_t i = 0; token[i]; i++) {
+        if (token[i] == '.') {
+            continue;
+        }
+        char original = token[i];
+        token[i] = original == 'A' ? 'B' : 'A';
+        if (token[i] == original) token[i] = 'C';
+        CHECK(!verify(token));
+        token[i] = original;
+    }
+    CHECK(verify(token));
+
+    // Elenco sostituito con quello di un altro token, firma originale
+    char other[TOKEN_MAX];
+    CHECK(token_issue("cpu,memory,disk", TOKEN_TTL, other, sizeof(other), NULL));
+    char spliced[TOKEN_MAX * 2];
+    snprintf(spliced, sizeof(spliced), "%.*s%.*s%s", (int)(first_dot - token), token,
+             (int)(strrchr(other, '.') - strchr(other, '.')), strchr(other, '.'), last_dot);
+    CHECK(!verify(spliced));
+
+    // Firmato con un'altra chiave
+    char forged[TOKEN_MAX];
+    forge("99999999999", "cpu", forged);
+    char* sig = strrchr(forged, '.') + 1;
+    sig[0] = sig[0] == 'A' ? 'B' : 'A';
+    CHECK(!verify(forged));
+}
+
+static void test_expired(void) {
+    char token[TOKEN_MAX];
+    char expiry[32];
+    snprintf(expiry, sizeof(expiry), "%lld", (long long)time(NULL) - 1);
+    forge(expiry, "cpu", token);
+    CHECK(!verify(token));
+
+    forge("0", "cpu", token);
+    CHECK(!verify(token));
+
+    snprintf(expiry, sizeof(expiry), "%lld", (long long)time(NULL));
+    forge(expiry, "cpu", token);
+    CHECK(!verify(token));
+}
+
+static void test_malformed(void) {
+    static const char* tokens[] = {
+        "", ".", "..", "abc", "123", "123.", "123..", ".Y3B1.", "123.Y3B1",
+        "123.Y3B1.short",
+        "123.Y3B1.AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA",
+        "123.Y3B1.AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA+",
+    };
+    for (size_t i = 0; i < sizeof(tokens) / sizeof(tokens[0]); i++) {
+        if (verify(tokens[i])) {
+            fprintf(stderr, "token malformato accettato: \"%s\"\n", tokens[i]);
+            failures++;
+        }
+    }
+
+    // Firme valide ma campi non validi
+    char token[TOKEN_MAX];
+    forge("99999999999x", "cpu", token);
+    CHECK(!verify(token));
+    forge("", "cpu", token);
+    CHECK(!verify(token));
+
+    // Elenco che non è base64url: la firma è valida ma il contenuto no
+    char future[32];
+    snprintf(future, sizeof(future), "%lld.", (long long)time(NULL) + 60);
+    char bad[TOKEN_MAX];
+    snprintf(bad, sizeof(bad), "%s", future);
+    strcat(bad, "a");  // Lunghezza 1: mai prodotta da un encoder
+    size_t n = strlen(bad);
+    unsigned char signature[32];
+    unsigned int signature_length = sizeof(signature);
+    HMAC(EVP_sha256(), test_key, sizeof(test_key), (const unsigned char*)bad, n,
+         signature, &signature_length);
+    bad[n++] = '.';
+    n += base64url_encode(signature, sizeof(signature), bad + n);
+    bad[n] = '\0';
+    CHECK(!verify(bad));
+}
+
+static void test_allows(void) {
+    CHECK(token_allows("", "anything{a=\"b\"}"));
+    CHECK(token_allows("cpu,memory", "cpu"));
+    CHECK(token_allows("cpu,memory", "memory"));
+    CHECK(!token_allows("cpu,memory", "disk"));
+    CHECK(!token_allows("cpu,memory", "cp"));
+    CHECK(!token_allows("cpu,memory", "cpu2"));
+    CHECK(token_allows("disk", "disk{dev=\"sda\"}"));
+    CHECK(token_allows("disk{dev=\"sda\"}", "disk{dev=\"sda\"}"));
+    CHECK(!token_allows("disk{dev=\"sda\"}", "disk{dev=\"sdb\"}"));
+    CHECK(!token_allows("disk{dev=\"sda\"}", "disk"));
+
+    // Le statistiche seguono la metrica di origine, con le etichette dopo il campo
+    CHECK(token_allows("cpu,memory", "cpu.p95"));
+    CHECK(token_allows("cpu,memory", "memory.avg"));
+    CHECK(token_allows("cpu", "cpu.rate"));
+    CHECK(token_allows("cpu.p95", "cpu.p95"));
+    CHECK(!token_allows("cpu.p95", "cpu.p99"));
+    CHECK(!token_allows("cpu,memory", "cpu.other"));
+    CHECK(!token_allows("cpu,memory", "cpu2.p95"));
+    CHECK(!token_allows("cpu,memory", "disk.p95"));
+    CHECK(!token_allows("cpu,memory", ".p95"));
+    CHECK(token_allows("disk", "disk.p95{dev=\"sda\"}"));
+    CHECK(token_allows("disk{dev=\"sda\"}", "disk.p95{dev=\"sda\"}"));
+    CHECK(!token_allows("disk{dev=\"sda\"}", "disk.p95{dev=\"sdb\"}"));
+    CHECK(!token_allows("disk{dev=\"sda\"}", "disk.p95"));
+    CHECK(token_allows("site.cpu", "site.cpu.avg"));
+    CHECK(!token_allows("site", "site.cpu"));
+}
+
+int main(void) {
+    char key_path[] = "/tmp/swsws-test-key-XXXXXX";
+    int fd = mkstemp(key_path);
+    if (fd < 0 || write(fd, test_key, sizeof(test_key)) != (ssize_t)sizeof(test_key)) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    // Una chiave troppo corta viene rifiutata
+    char short_path[] = "/tmp/swsws-test-key-XXXXXX";
+    int short_fd = mkstemp(short_path);
+    if (short_fd >= 0) {
+        CHECK(write(short_fd, "short", 5) == 5);
+        close(short_fd);
+        CHECK(!tokens_init(short_path));
+        unlink(short_path);
+    }
+
+    bool ready = tokens_init(key_path);
+    unlink(key_path);
+    CHECK(ready);
+
+    test_base64url();
+    test_issue_and_verify();
+    test_tampered();
+    test_expired();
+    test_malformed();
+    test_allows();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d verifiche fallite\n", failures);
+        return 1;
+    }
+    printf("test_tokens: ok\n");
+    return 0;
+}
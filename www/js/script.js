@@ -29,6 +29,9 @@ document.addEventListener('DOMContentLoaded', function() {
     // Ottieni il token di sicurezza inserito dal server
     const config = window.SWSWS_CONFIG || {};
     const securityToken = config.securityToken || '';
+    const tokenExpires = config.tokenExpires || 0;
+    // Pagina di cui il server valuta le soglie (vuota se non le conosce)
+    const page = config.page || '';
 
     // Funzione per determinare lo stato di allarme
     function getAlertState(name, value) {
@@ -62,8 +65,10 @@ document.addEventListener('DOMContentLoaded', function() {
             timestampElement = document.getElementById('last-update');
         }
     
-        // Aggiorna il timestamp
-        timestampElement.textContent = timestamp;
+        // Aggiorna il timestamp: il server invia i millisecondi dall'epoca Unix
+        timestampElement.textContent = typeof timestamp === 'number'
+            ? new Date(timestamp).toLocaleString()
+            : timestamp;
     }
 
     // Funzione per creare o aggiornare una metrica
@@ -73,12 +78,19 @@ document.addEventListener('DOMContentLoaded', function() {
             return; // Ignora metriche non autorizzate
         }
     
-        // Estrai valore e unità
+        // Estrai valore e unità; il server invia il valore a piena
+        // precisione, la pagina mostra al più due decimali
         const value = data.value;
+        const displayValue = typeof value === 'number' && !Number.isInteger(value)
+            ? value.toFixed(2)
+            : value;
         const unit = data.unit || '';
     
-        // Determina lo stato di allarme
-        const alertState = getAlertState(name, value);
+        // Determina lo stato di allarme: quello calcolato dal server (con
+        // isteresi) se valuta le soglie di questa pagina o la pagina non
+        // ne ha per la metrica, altrimenti dalle soglie della pagina
+        const serverState = data.alert && (page || !thresholds[name]);
+        const alertState = serverState ? data.alert : getAlertState(name, value);
 
         // Cerca se esiste già un elemento per questa metrica
         let metricElement = document.getElementById('metric-' + name);
@@ -96,7 +108,7 @@ document.addEventListener('DOMContentLoaded', function() {
             const metricValue = document.createElement('div');
             metricValue.className = 'metric-value';
             metricValue.id = 'metric-' + name;
-            metricValue.textContent = value;
+            metricValue.textContent = displayValue;
         
             const metricUnit = document.createElement('div');
             metricUnit.className = 'metric-unit';
@@ -114,7 +126,7 @@ document.addEventListener('DOMContentLoaded', function() {
             metricsContainer.appendChild(metricCard);
         } else {
             // Altrimenti aggiorna solo il valore, l'unità e lo stato di allarme
-            metricElement.textContent = value;
+            metricElement.textContent = displayValue;
             metricElement.className = 'metric-value ' + alertState;
             
             if (unitElement) {
@@ -128,10 +140,17 @@ document.addEventListener('DOMContentLoaded', function() {
     }
 
     function connect() {
+        // Un token scaduto verrebbe rifiutato: si ricarica la pagina per averne uno nuovo
+        if (tokenExpires && Date.now() >= tokenExpires) {
+            window.location.reload();
+            return;
+        }
+        
         // Usa il protocollo corretto (ws o wss)
         const protocol = window.location.protocol === 'https:' ? 'wss:' : 'ws:';
         // Includi il token di sicurezza nella connessione
-        const wsUrl = `${protocol}//${window.location.host}?token=${securityToken}`;
+        const wsUrl = `${protocol}//${window.location.host}?token=${securityToken}` +
+            (page ? `&page=${encodeURIComponent(page)}` : '');
         
         console.log('Tentativo di connessione a:', wsUrl);
         